@@ -0,0 +1,153 @@
+////////////////////////////////////////////////////////////////////////
+// Shared vertex and index buffers for all the static shapes.  See
+// arena.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <string.h>
+
+#include <glbinding/gl/gl.h>
+#include <glbinding/Binding.h>
+using namespace gl;
+
+#include <glu.h>                // For gluErrorString
+#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line arena.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "arena.h"
+
+// The pool for a layout, made if there is none yet
+MeshArena::Pool& MeshArena::Find(const VertexFormat format, const int attribs)
+{
+    for (int p=0;  p<pools.size();  p++)
+        if (pools[p].format == format && pools[p].attribs == attribs)
+            return pools[p];
+
+    Pool pool;
+    pool.format = format;
+    pool.attribs = attribs;
+    pool.stride = VertexStride(format, attribs);
+    pool.vertexSize = maVertexBytes - maVertexBytes%pool.stride;
+    pool.indexSize = maIndexBytes;
+    pool.vertexUsed = pool.indexUsed = 0;
+
+    glGenVertexArrays(1, &pool.vao);
+    glGenBuffers(1, &pool.vertexBuffer);
+    glGenBuffers(1, &pool.indexBuffer);
+    BindVAO(pool.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, pool.vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, pool.vertexSize, NULL, GL_STATIC_DRAW);
+    VertexAttributes(format, attribs);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, pool.indexSize, NULL, GL_STATIC_DRAW);
+    BindVAO(0);
+    CHECKERROR;
+
+    pools.push_back(pool);
+    return pools.back();
+}
+
+// Make a buffer hold at least needed bytes, keeping its first used
+// ones, by doubling it into a new buffer.  Returns whether it was
+// replaced.
+bool MeshArena::Grow(unsigned int& buffer, size_t& size, const size_t used, const size_t needed)
+{
+    if (needed <= size)
+        return false;
+    size_t newSize = size;
+    while (newSize < needed)
+        newSize *= 2;
+
+    GLuint newBuffer;
+    glGenBuffers(1, &newBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, newSize, NULL, GL_STATIC_DRAW);
+    if (used > 0) {
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0); }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+    CHECKERROR;
+
+    buffer = newBuffer;
+    size = newSize;
+    return true;
+}
+
+// The vertices are packed straight into the mapped end of the pool's
+// vertex buffer.  The indices go after the pool's others, aligned to
+// 4 bytes, and the ranges' base vertices are moved to where the
+// shape's vertices start.
+void MeshArena::Add(Shape* shape)
+{
+    Pool& pool = Find(shape->format, VertexAttribs(shape->Nrm, shape->Tex, shape->Tan));
+
+    std::vector<unsigned char> indices;
+    shape->indexSize = PackIndices(shape->Tri, shape->ranges, indices);
+
+    const size_t vertexBytes = (size_t)pool.stride*shape->Pnt.size();
+    const size_t indexStart = (pool.indexUsed + 3) & ~(size_t)3;
+    const bool newVertices = Grow(pool.vertexBuffer, pool.vertexSize, pool.vertexUsed,
+                                  pool.vertexUsed + vertexBytes);
+    const bool newIndices = Grow(pool.indexBuffer, pool.indexSize, pool.indexUsed,
+                                 indexStart + indices.size());
+
+    // A replaced buffer must be attached to the VAO again
+    if (newVertices || newIndices) {
+        BindVAO(pool.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, pool.vertexBuffer);
+        VertexAttributes(pool.format, pool.attribs);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.indexBuffer);
+        BindVAO(0); }
+
+    glBindBuffer(GL_ARRAY_BUFFER, pool.vertexBuffer);
+    void* dst = glMapBufferRange(GL_ARRAY_BUFFER, pool.vertexUsed, vertexBytes,
+                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    PackVertices(dst, shape->Pnt, shape->Nrm, shape->Tex, shape->Tan,
+                 shape->format, shape->minP, shape->maxP);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Not through GL_ELEMENT_ARRAY_BUFFER, which would change the bound VAO's
+    glBindBuffer(GL_COPY_WRITE_BUFFER, pool.indexBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, indexStart, indices.size(), &indices[0]);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    CHECKERROR;
+
+    const int baseVertex = (int)(pool.vertexUsed/pool.stride);
+    for (int r=0;  r<shape->ranges.size();  r++)
+        shape->ranges[r].baseVertex += baseVertex;
+    shape->indexOffset = indexStart;
+    shape->vaoID = pool.vao;
+
+    pool.vertexUsed += vertexBytes;
+    pool.indexUsed = indexStart + indices.size();
+}
+
+size_t MeshArena::VertexBytes() const
+{
+    size_t bytes = 0;
+    for (int p=0;  p<pools.size();  p++)
+        bytes += pools[p].vertexUsed;
+    return bytes;
+}
+
+size_t MeshArena::IndexBytes() const
+{
+    size_t bytes = 0;
+    for (int p=0;  p<pools.size();  p++)
+        bytes += pools[p].indexUsed;
+    return bytes;
+}
+
+MeshArena& Arena()
+{
+    static MeshArena arena;
+    return arena;
+}
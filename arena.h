@@ -0,0 +1,53 @@
+////////////////////////////////////////////////////////////////////////
+// Shared vertex and index buffers for all the static shapes.
+//
+// Shape::MakeVAO adds each mesh to the pool for its vertex layout (its
+// VertexFormat, and which attributes it has), so a handful of pools
+// hold every shape.  A pool has one VAO, one vertex buffer and one
+// index buffer, and each of its shapes is drawn with
+// glDrawElementsBaseVertex from its place in them, so drawing shapes
+// of the same pool one after another binds nothing.
+//
+// A pool's buffers start at maVertexBytes and maIndexBytes, and double
+// when full, copied on the graphics card.  Shapes are never removed.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _ARENA
+#define _ARENA
+
+#include <vector>
+
+#include "shapes.h"
+
+const size_t maVertexBytes = 1<<22; // Initial size of a pool's vertex buffer
+const size_t maIndexBytes = 1<<20;  // Initial size of a pool's index buffer
+
+class MeshArena
+{
+    struct Pool
+    {
+        VertexFormat format;
+        int attribs, stride;
+        unsigned int vao, vertexBuffer, indexBuffer;
+        size_t vertexSize, vertexUsed;      // In bytes
+        size_t indexSize, indexUsed;
+    };
+    std::vector<Pool> pools;
+
+    Pool& Find(const VertexFormat format, const int attribs);
+    bool Grow(unsigned int& buffer, size_t& size, const size_t used, const size_t needed);
+
+public:
+    // Put a shape's mesh, in its format, into its pool:  sets the
+    // shape's vaoID, indexSize, indexOffset and ranges.
+    void Add(Shape* shape);
+
+    int PoolCount() const { return (int)pools.size(); }
+    size_t VertexBytes() const;
+    size_t IndexBytes() const;
+};
+
+// The arena used by all shapes
+MeshArena& Arena();
+
+#endif
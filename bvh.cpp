@@ -0,0 +1,235 @@
+////////////////////////////////////////////////////////////////////////
+// Frustum culling through a bounding volume hierarchy.  See bvh.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <float.h>
+#include <algorithm>
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "framework.h"
+#include "object.h"
+#include "hierarchy.h"
+#include "bvh.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BV_SSE
+#include <emmintrin.h>
+#endif
+
+// The frustum's planes, each (a,b,c,d) with ax+by+cz+d >= 0 inside, as
+// two groups of four in columns:  x[g] holds the a's of group g, and
+// so on.  The last two slots repeat the first plane.
+struct BvPlanes
+{
+    float x[2][4], y[2][4], z[2][4], w[2][4];
+};
+
+// Returns -1 if the box is outside a plane, 1 if inside all of them,
+// and 0 if it crosses any.
+static int TestBox(const BvPlanes& planes, const glm::vec3& lo, const glm::vec3& hi)
+{
+    const glm::vec3 c = (lo + hi)*0.5f;
+    const glm::vec3 e = (hi - lo)*0.5f;
+#ifdef BV_SSE
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 cx = _mm_set1_ps(c.x), cy = _mm_set1_ps(c.y), cz = _mm_set1_ps(c.z);
+    const __m128 ex = _mm_set1_ps(e.x), ey = _mm_set1_ps(e.y), ez = _mm_set1_ps(e.z);
+    int outside = 0, inside = 0;
+    for (int g=0;  g<2;  g++) {
+        const __m128 px = _mm_loadu_ps(planes.x[g]), py = _mm_loadu_ps(planes.y[g]);
+        const __m128 pz = _mm_loadu_ps(planes.z[g]), pw = _mm_loadu_ps(planes.w[g]);
+        const __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, cx), _mm_mul_ps(py, cy)),
+                                       _mm_add_ps(_mm_mul_ps(pz, cz), pw));
+        const __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign, px), ex),
+                                                    _mm_mul_ps(_mm_andnot_ps(sign, py), ey)),
+                                         _mm_mul_ps(_mm_andnot_ps(sign, pz), ez));
+        outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist, radius), _mm_setzero_ps()));
+        inside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(dist, radius), _mm_setzero_ps())); }
+    return outside ? -1 : (inside ? 0 : 1);
+#else
+    int result = 1;
+    for (int g=0;  g<2;  g++)
+        for (int p=0;  p<4;  p++) {
+            const float dist = planes.x[g][p]*c.x + planes.y[g][p]*c.y + planes.z[g][p]*c.z + planes.w[g][p];
+            const float radius = fabs(planes.x[g][p])*e.x + fabs(planes.y[g][p])*e.y + fabs(planes.z[g][p])*e.z;
+            if (dist + radius < 0.0f)
+                return -1;
+            if (dist - radius < 0.0f)
+                result = 0; }
+    return result;
+#endif
+}
+
+// The world box around a node's shape:  the box of its eight
+// transformed corners, found from the matrix's columns.
+void BoundingVolumes::FitLeaf(const FlatHierarchy& hierarchy, const int b)
+{
+    const int n = leaf[b];
+    const Shape* shape = hierarchy.NodeObject(n)->shape;
+    leafShape[b] = shape;
+    const glm::mat4& m = hierarchy.WorldTr(n);
+    glm::vec3 lo = m[3].xyz(), hi = m[3].xyz();
+    for (int c=0;  c<3;  c++) {
+        const glm::vec3 a = m[c].xyz()*shape->minP[c];
+        const glm::vec3 z = m[c].xyz()*shape->maxP[c];
+        lo += glm::min(a, z);
+        hi += glm::max(a, z); }
+    boxMin[b] = lo;
+    boxMax[b] = hi;
+    shapeMin[n] = shape->minP;
+    shapeMax[n] = shape->maxP;
+}
+
+// Append the subtree over nodes[first..last), and return its index
+int BoundingVolumes::Split(const FlatHierarchy& hierarchy, std::vector<int>& nodes,
+                           const std::vector<glm::vec3>& center, const int first, const int last,
+                           const int parentIndex)
+{
+    const int b = (int)end.size();
+    boxMin.push_back(glm::vec3(0.0));
+    boxMax.push_back(glm::vec3(0.0));
+    end.push_back(0);
+    parent.push_back(parentIndex);
+    leaf.push_back(-1);
+    leafShape.push_back(NULL);
+
+    if (last - first == 1) {
+        leaf[b] = nodes[first];
+        leafOf[nodes[first]] = b;
+        FitLeaf(hierarchy, b);
+        end[b] = b+1;
+        return b; }
+
+    // Split at the median center along the longest axis of the centers
+    glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    for (int i=first;  i<last;  i++) {
+        lo = glm::min(lo, center[nodes[i]]);
+        hi = glm::max(hi, center[nodes[i]]); }
+    const glm::vec3 extent = hi - lo;
+    const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    const int mid = (first + last)/2;
+    std::nth_element(nodes.begin() + first, nodes.begin() + mid, nodes.begin() + last,
+                     [&](const int a, const int c) { return center[a][axis] < center[c][axis]; });
+
+    const int left = Split(hierarchy, nodes, center, first, mid, b);
+    const int right = Split(hierarchy, nodes, center, mid, last, b);
+    boxMin[b] = glm::min(boxMin[left], boxMin[right]);
+    boxMax[b] = glm::max(boxMax[left], boxMax[right]);
+    end[b] = (int)end.size();
+    return b;
+}
+
+void BoundingVolumes::Build(const FlatHierarchy& hierarchy)
+{
+    boxMin.clear();
+    boxMax.clear();
+    end.clear();
+    parent.clear();
+    leaf.clear();
+    leafShape.clear();
+
+    const int count = hierarchy.NodeCount();
+    leafOf.assign(count, -1);
+    inFrustum.assign(count, true);
+    shapeMin.resize(count);
+    shapeMax.resize(count);
+
+    std::vector<int> nodes;
+    std::vector<glm::vec3> center(count);
+    for (int n=0;  n<count;  n++) {
+        const Shape* shape = hierarchy.NodeObject(n)->shape;
+        if (!shape)
+            continue;
+        nodes.push_back(n);
+        center[n] = (hierarchy.WorldTr(n)*glm::vec4((shape->minP + shape->maxP)*0.5f, 1.0)).xyz(); }
+    if (!nodes.empty())
+        Split(hierarchy, nodes, center, 0, (int)nodes.size(), -1);
+    dirty.assign(end.size(), false);
+
+    builtVersion = hierarchy.version;
+    refitCount = (int)nodes.size();
+}
+
+// The dirty leaves are refit and their ancestors marked.  Children
+// follow their parents, so going backwards refits each marked
+// ancestor after both of its children.
+void BoundingVolumes::Refit(const FlatHierarchy& hierarchy)
+{
+    if (builtVersion != hierarchy.version) {
+        Build(hierarchy);
+        return; }
+
+    refitCount = 0;
+    for (int b=0;  b<end.size();  b++) {
+        if (leaf[b] < 0)
+            continue;
+        const int n = leaf[b];
+        const Shape* shape = hierarchy.NodeObject(n)->shape;
+        if (!hierarchy.Changed(n) && shape->minP == shapeMin[n] && shape->maxP == shapeMax[n])
+            continue;
+        FitLeaf(hierarchy, b);
+        refitCount++;
+        for (int p=parent[b];  p >= 0 && !dirty[p];  p=parent[p])
+            dirty[p] = true; }
+
+    for (int b=(int)end.size()-1;  b>=0;  b--)
+        if (dirty[b]) {
+            const int left = b+1, right = end[left];
+            boxMin[b] = glm::min(boxMin[left], boxMin[right]);
+            boxMax[b] = glm::max(boxMax[left], boxMax[right]);
+            dirty[b] = false; }
+}
+
+// Every leaf of the subtree at b is visible
+void BoundingVolumes::MarkSubtree(const int b)
+{
+    for (int i=b;  i<end[b];  i++)
+        if (leaf[i] >= 0)
+            inFrustum[leaf[i]] = true;
+}
+
+// The planes are the sums and differences of the matrix's last row
+// and each of its others (for clip coordinates within -w..w).  They
+// are left unnormalized, which does not change their signs.
+void BoundingVolumes::Cull(const glm::mat4& viewProj)
+{
+    BvPlanes planes;
+    for (int p=0;  p<8;  p++) {
+        const int i = p < 6 ? p/2 : 0;
+        const float s = p < 6 && p%2 ? -1.0f : 1.0f;
+        const int g = p/4, k = p%4;
+        planes.x[g][k] = viewProj[0][3] + s*viewProj[0][i];
+        planes.y[g][k] = viewProj[1][3] + s*viewProj[1][i];
+        planes.z[g][k] = viewProj[2][3] + s*viewProj[2][i];
+        planes.w[g][k] = viewProj[3][3] + s*viewProj[3][i]; }
+
+    std::fill(inFrustum.begin(), inFrustum.end(), false);
+    testedCount = culledCount = culledTriangles = 0;
+    const int count = (int)end.size();
+    int b = 0;
+    while (b < count) {
+        testedCount++;
+        const int result = TestBox(planes, boxMin[b], boxMax[b]);
+        if (result < 0) {
+            for (int i=b;  i<end[b];  i++)
+                if (leaf[i] >= 0) {
+                    culledCount++;
+                    culledTriangles += leafShape[i]->count; }
+            b = end[b]; }
+        else if (result > 0) {
+            MarkSubtree(b);
+            b = end[b]; }
+        else {
+            if (leaf[b] >= 0)
+                inFrustum[leaf[b]] = true;
+            b++; } }
+
+    // Nodes with no shape are never culled
+    for (int n=0;  n<inFrustum.size();  n++)
+        if (leafOf[n] < 0)
+            inFrustum[n] = true;
+}
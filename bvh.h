@@ -0,0 +1,75 @@
+////////////////////////////////////////////////////////////////////////
+// Frustum culling of a FlatHierarchy through a bounding volume
+// hierarchy.
+//
+// Every node of the hierarchy with a shape is a leaf, bounded by the
+// world-space box around its Shape's minP/maxP under the node's world
+// transformation.  Build splits the leaves at the median of their
+// centers along the longest axis, down to one leaf each, and stores
+// the tree depth first in parallel arrays:  a node's left child
+// follows it, its right child starts where the left subtree ends, and
+// end[node] is one past its subtree, so a subtree can be skipped by
+// jumping there (as in FlatHierarchy).
+//
+// Refit recomputes the boxes of only the leaves whose world
+// transformation changed in the last FlatHierarchy::Update (the
+// animated subtrees), or whose shape's bounds changed (the terrain),
+// and then the boxes of their ancestors.  Cull tests the boxes against
+// the six planes of the view frustum, four planes to an SSE
+// instruction:  a box outside a plane skips its subtree, and a box
+// inside all of them marks its whole subtree visible untested.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _BVH
+#define _BVH
+
+#include <vector>
+
+class Shape;
+class FlatHierarchy;
+
+class BoundingVolumes
+{
+    // The tree, depth first
+    std::vector<glm::vec3> boxMin, boxMax;
+    std::vector<int> end;               // One past the last node of the subtree
+    std::vector<int> parent;            // -1 for the root
+    std::vector<int> leaf;              // The hierarchy node of a leaf, or -1
+    std::vector<const Shape*> leafShape;
+    std::vector<bool> dirty;            // Box to recompute in this Refit
+
+    // Per hierarchy node
+    std::vector<int> leafOf;            // The node's leaf, or -1
+    std::vector<bool> inFrustum;
+    std::vector<glm::vec3> shapeMin, shapeMax;  // The shape's bounds when last fit
+
+    int builtVersion;
+
+    int Split(const FlatHierarchy& hierarchy, std::vector<int>& nodes,
+              const std::vector<glm::vec3>& center, const int first, const int last,
+              const int parentIndex);
+    void FitLeaf(const FlatHierarchy& hierarchy, const int b);
+    void MarkSubtree(const int b);
+
+public:
+    // Statistics of the last Refit and Cull
+    int refitCount, testedCount, culledCount, culledTriangles;
+
+    BoundingVolumes() : builtVersion(-1), refitCount(0), testedCount(0), culledCount(0), culledTriangles(0) {}
+
+    // Build the tree over the hierarchy's nodes with shapes
+    void Build(const FlatHierarchy& hierarchy);
+
+    // Bring the boxes up to date after hierarchy.Update (rebuilding if
+    // the hierarchy was rebuilt)
+    void Refit(const FlatHierarchy& hierarchy);
+
+    // Find the leaves inside the frustum of a projection*view matrix
+    void Cull(const glm::mat4& viewProj);
+
+    // Whether a hierarchy node was found inside the frustum (nodes
+    // with no shape always are)
+    bool InFrustum(const int node) const { return node >= inFrustum.size() || inFrustum[node]; }
+};
+
+#endif
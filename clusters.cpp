@@ -0,0 +1,162 @@
+////////////////////////////////////////////////////////////////////////
+// Clustered shading of the local lights.  See clusters.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <algorithm>
+
+#include "framework.h"
+#include "object.h"
+#include "hierarchy.h"
+#include "clusters.h"
+
+#include <glu.h>                // For gluErrorString
+#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line clusters.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+// The texture buffers, in the order of buffers[] and textures[]
+enum { lcLights, lcRanges, lcIndices, lcBuffers };
+static const char* lcSamplers[lcBuffers] = { "clusterLights", "clusterRanges", "clusterIndices" };
+
+LightClusters::LightClusters()
+    : tilesX(1), tilesY(1), sliceScale(0.0f), sliceBias(0.0f),
+      lightCount(0), maxPerCluster(0), indexCount(0)
+{
+    for (int b=0;  b<lcBuffers;  b++)
+        buffers[b] = textures[b] = 0;
+}
+
+// Refill a texture buffer, orphaning its storage
+static void Upload(const unsigned int buffer, const unsigned int texture, const GLenum format,
+                   const void* data, const size_t bytes)
+{
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, bytes, data, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+// Each light's view-space sphere is bounded by a box, whose depth
+// range picks the slices, and whose sides, projected at its nearest
+// and farthest depths, pick the tiles.  A sphere reaching in front of
+// the near plane covers every tile.
+void LightClusters::Build(const FlatHierarchy& lightNodes, const glm::mat4& worldView,
+                          const float rx, const float ry, const float front, const float back,
+                          const int width, const int height)
+{
+    tilesX = std::max((width + lcTileSize-1)/lcTileSize, 1);
+    tilesY = std::max((height + lcTileSize-1)/lcTileSize, 1);
+    sliceScale = lcSlices/log(back/front);
+    sliceBias = -sliceScale*log(front);
+    const int clusterCount = tilesX*tilesY*lcSlices;
+
+    lights.clear();
+    first.clear();
+    last.clear();
+    int n = 0;
+    while (n < lightNodes.NodeCount()) {
+        const Object* obj = lightNodes.NodeObject(n);
+        n = obj->drawMe ? n+1 : lightNodes.SubtreeEnd(n);
+        if (!obj->isLight || !obj->drawMe)
+            continue;
+
+        const glm::vec3 c = (worldView*glm::vec4(obj->position, 1.0)).xyz();
+        const float r = obj->range;
+        const float nearDepth = std::max(-c.z - r, front);
+        const float farDepth = std::min(-c.z + r, back);
+        if (nearDepth > farDepth)
+            continue;
+
+        glm::ivec3 lo, hi;
+        lo.z = std::max((int)floor(log(nearDepth)*sliceScale + sliceBias), 0);
+        hi.z = std::min((int)floor(log(farDepth)*sliceScale + sliceBias), lcSlices-1);
+        if (-c.z - r <= front) {
+            lo.x = lo.y = 0;
+            hi.x = tilesX-1;
+            hi.y = tilesY-1; }
+        else {
+            // The box's sides in normalized device coordinates are the
+            // extremes of each side over its two depths
+            const float x0 = std::min((c.x - r)/(rx*nearDepth), (c.x - r)/(rx*farDepth));
+            const float x1 = std::max((c.x + r)/(rx*nearDepth), (c.x + r)/(rx*farDepth));
+            const float y0 = std::min((c.y - r)/(ry*nearDepth), (c.y - r)/(ry*farDepth));
+            const float y1 = std::max((c.y + r)/(ry*nearDepth), (c.y + r)/(ry*farDepth));
+            if (x0 > 1.0f || x1 < -1.0f || y0 > 1.0f || y1 < -1.0f)
+                continue;
+            lo.x = std::max((int)floor((0.5f*x0 + 0.5f)*width/lcTileSize), 0);
+            hi.x = std::min((int)floor((0.5f*x1 + 0.5f)*width/lcTileSize), tilesX-1);
+            lo.y = std::max((int)floor((0.5f*y0 + 0.5f)*height/lcTileSize), 0);
+            hi.y = std::min((int)floor((0.5f*y1 + 0.5f)*height/lcTileSize), tilesY-1); }
+
+        lights.push_back(glm::vec4(obj->position, r));
+        lights.push_back(glm::vec4(obj->diffuseColor, 0.0));
+        lights.push_back(glm::vec4(obj->specularColor, 0.0));
+        first.push_back(lo);
+        last.push_back(hi); }
+    lightCount = (int)first.size();
+
+    // Count each cluster's lights, turn the counts into offsets, and
+    // fill in the lists.  The ranges are (offset, count) pairs.
+    ranges.assign(2*clusterCount, 0);
+    for (int l=0;  l<lightCount;  l++)
+        for (int z=first[l].z;  z<=last[l].z;  z++)
+            for (int y=first[l].y;  y<=last[l].y;  y++)
+                for (int x=first[l].x;  x<=last[l].x;  x++)
+                    ranges[2*((z*tilesY + y)*tilesX + x) + 1]++;
+
+    unsigned int offset = 0;
+    maxPerCluster = 0;
+    for (int k=0;  k<clusterCount;  k++) {
+        ranges[2*k] = offset;
+        offset += ranges[2*k+1];
+        maxPerCluster = std::max(maxPerCluster, (int)ranges[2*k+1]);
+        ranges[2*k+1] = 0; }
+    indexCount = (int)offset;
+
+    indices.resize(std::max(indexCount, 1));
+    for (int l=0;  l<lightCount;  l++)
+        for (int z=first[l].z;  z<=last[l].z;  z++)
+            for (int y=first[l].y;  y<=last[l].y;  y++)
+                for (int x=first[l].x;  x<=last[l].x;  x++) {
+                    const int k = (z*tilesY + y)*tilesX + x;
+                    indices[ranges[2*k] + ranges[2*k+1]++] = l; }
+
+    if (lights.empty())
+        lights.push_back(glm::vec4(0.0));
+
+    if (!buffers[0]) {
+        glGenBuffers(lcBuffers, buffers);
+        glGenTextures(lcBuffers, textures); }
+    Upload(buffers[lcLights], textures[lcLights], GL_RGBA32F,
+           &lights[0], lights.size()*sizeof(glm::vec4));
+    Upload(buffers[lcRanges], textures[lcRanges], GL_RG32UI,
+           &ranges[0], ranges.size()*sizeof(unsigned int));
+    Upload(buffers[lcIndices], textures[lcIndices], GL_R32UI,
+           &indices[0], indices.size()*sizeof(unsigned int));
+    CHECKERROR;
+}
+
+void LightClusters::Bind(ShaderProgram* program)
+{
+    for (int b=0;  b<lcBuffers;  b++) {
+        glActiveTexture((gl::GLenum)((int)GL_TEXTURE0 + lcFirstUnit + b));
+        glBindTexture(GL_TEXTURE_BUFFER, textures[b]);
+        program->Set(lcSamplers[b], lcFirstUnit + b); }
+
+    program->Set(shTileSize, lcTileSize);
+    program->Set(shTilesX, tilesX);
+    program->Set(shTilesY, tilesY);
+    program->Set(shSlices, lcSlices);
+    program->Set(shSliceScale, sliceScale);
+    program->Set(shSliceBias, sliceBias);
+    CHECKERROR;
+}
+
+void LightClusters::Unbind()
+{
+    for (int b=0;  b<lcBuffers;  b++) {
+        glActiveTexture((gl::GLenum)((int)GL_TEXTURE0 + lcFirstUnit + b));
+        glBindTexture(GL_TEXTURE_BUFFER, 0); }
+    glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,68 @@
+////////////////////////////////////////////////////////////////////////
+// Clustered shading of the local lights.
+//
+// Instead of drawing each light's sphere and lighting every pixel it
+// covers, the view frustum is split into clusters:  screen tiles of
+// lcTileSize pixels, each cut into lcSlices slices of view depth,
+// spaced exponentially between the near and far planes.  Build bins
+// each light into the clusters its sphere's bounding box overlaps,
+// on the CPU, and uploads three texture buffers (GL 3.3 has no
+// compute shaders or storage buffers):
+//
+//   clusterLights:   three RGBA32F texels per light:  its position and
+//                    range, its value, and its ambient value
+//   clusterRanges:   per cluster, the offset and count of its lights
+//                    in clusterIndices (RG32UI)
+//   clusterIndices:  the lights of each cluster in turn (R32UI)
+//
+// Clustered.frag is then drawn once over the whole screen:  each
+// pixel finds its cluster from its position and depth, and adds up
+// only that cluster's lights.  The cost per pixel follows the lights
+// near it, not the number of lights or the area they cover.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _CLUSTERS
+#define _CLUSTERS
+
+#include <vector>
+
+class ShaderProgram;
+class FlatHierarchy;
+
+const int lcTileSize = 64;      // Tile width and height in pixels
+const int lcSlices = 16;        // Depth slices
+const int lcFirstUnit = 4;      // First texture unit of the texture buffers
+
+class LightClusters
+{
+    // The lights, as uploaded
+    std::vector<glm::vec4> lights;
+
+    // Lights per cluster, then their offsets and the lists
+    std::vector<unsigned int> ranges;
+    std::vector<unsigned int> indices;
+    std::vector<glm::ivec3> first, last;    // Each light's corner clusters (x, y, slice)
+
+    unsigned int buffers[3], textures[3];
+
+    int tilesX, tilesY;
+    float sliceScale, sliceBias;        // slice = log(depth)*sliceScale + sliceBias
+
+public:
+    // Statistics of the last Build
+    int lightCount, maxPerCluster, indexCount;
+
+    LightClusters();
+
+    // Bin the lights of a hierarchy (its objects with isLight, not
+    // below one with drawMe off) for a view, and upload them
+    void Build(const FlatHierarchy& lightNodes, const glm::mat4& worldView,
+               const float rx, const float ry, const float front, const float back,
+               const int width, const int height);
+
+    // Bind the texture buffers, and set the program's uniforms for them
+    void Bind(ShaderProgram* program);
+    void Unbind();
+};
+
+#endif
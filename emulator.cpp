@@ -1,5 +1,608 @@
+////////////////////////////////////////////////////////////////////////
+// A software emulation of the graphics pipeline, used to render the
+// Object hierarchy on machines without a GPU.  See emulator.h for an
+// outline of the stages.
+//
+// Rasterization follows the OpenGL rules: vertices are snapped to a
+// 1/16th pixel grid, pixels are sampled at their centers, and edges
+// are resolved with the top-left fill rule, so that triangles sharing
+// an edge never both cover (nor both miss) a pixel along it.
+////////////////////////////////////////////////////////////////////////
 
+#include "math.h"
+#include <algorithm>
+#include <stdlib.h>
 
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
 
+#include "framework.h"
+#include "object.h"
+#include "workers.h"
+#include "emulator.h"
 
-// This file is intentionally blank
+// Planes of the clip volume, in homogeneous clip coordinates.  The x
+// and y planes are a guard band outside the viewport; they only exist
+// to keep snapped coordinates within integer range.  (At a guard band
+// of 2, edge values within a tile fit the 32 bit arithmetic of the
+// raster kernels for any viewport up to 4096 pixels.)  Triangles
+// crossing the real screen edges are handled by the bounding box
+// clamp instead.
+static const float guardBand = 2.0f;
+static const int numClipPlanes = 6;
+
+static float PlaneDist(const glm::vec4& c, const int plane)
+{
+    switch (plane) {
+    case 0: return c.z + c.w;              // near
+    case 1: return c.w - c.z;              // far
+    case 2: return guardBand*c.w - c.x;
+    case 3: return guardBand*c.w + c.x;
+    case 4: return guardBand*c.w - c.y;
+    default: return guardBand*c.w + c.y; }
+}
+
+static int OutCode(const glm::vec4& c)
+{
+    int code = 0;
+    for (int p=0;  p<numClipPlanes;  p++)
+        if (PlaneDist(c, p) < 0.0f)
+            code |= 1<<p;
+    return code;
+}
+
+static EmVertex Lerp(const EmVertex& a, const EmVertex& b, const float t)
+{
+    EmVertex r;
+    r.clip = a.clip + t*(b.clip - a.clip);
+    for (int k=0;  k<emVaryings;  k++)
+        r.var[k] = a.var[k] + t*(b.var[k] - a.var[k]);
+    return r;
+}
+
+// BRDF() of BRDF.frag for one light and a block of G-buffer pixels
+// (the planes g, starting at the block), with the kernels' LightBlock
+static void BRDFBlock(const EmKernels* kernels, const float* const* g, const EmLight& light,
+                      const glm::vec3& eyePos, const unsigned int lanes, float out[3][emBlock])
+{
+    EmGBufferBlock block;
+    for (int c=0;  c<3;  c++) {
+        block.pos[c] = g[gPosX+c];
+        block.nrm[c] = g[gNrmX+c];
+        block.kd[c] = g[gKdR+c];
+        block.ks[c] = g[gKsR+c]; }
+    block.alpha = g[gAlpha];
+
+    EmLightValues values;
+    for (int c=0;  c<3;  c++) {
+        values.pos[c] = light.pos[c];
+        values.val[c] = light.val[c];
+        values.amb[c] = light.amb[c];
+        values.eye[c] = eyePos[c]; }
+    values.range = light.range;
+    values.local = light.isLight;
+    kernels->LightBlock(block, values, lanes, out);
+}
+
+Emulator::Emulator()
+    : width(0), height(0), tilesX(0), tilesY(0),
+      clearColor(0.5, 0.5, 0.5, 1.0),
+      drawID(0), toggle(0), pass(emGBufferPass), jobFirst(0), jobLast(0), lightBase(0),
+      drawCount(0), triangleCount(0), binnedCount(0)
+{
+    kernels = &EmGetKernels(EmDetectSimd());
+    printf("Software pipeline: %s kernels, %d threads\n", kernels->name, Workers().Size());
+}
+
+void Emulator::Resize(const int w, const int h)
+{
+    width = w;
+    height = h;
+    tilesX = (w + emTileSize - 1)/emTileSize;
+    tilesY = (h + emTileSize - 1)/emTileSize;
+    color.resize(w*h);
+    depth.resize(w*h);
+    lightMask.resize(w*h);
+
+    // The lighting stage reads whole blocks, so pad past the last pixel.
+    for (int k=0;  k<emGPlanes;  k++)
+        gbuffer[k].resize(w*h + emBlock);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Collect the drawable objects, with the same traversal and
+// transformation order as FlatHierarchy::Collect.  In the light volume
+// pass, each one is also a local light, with the values Object::Block
+// gives the shader.
+void Emulator::Gather(const Object* obj, const glm::mat4& objectTr)
+{
+    if (!obj->drawMe)
+        return;
+
+    if (obj->shape && obj->shape->Tri.size() > 0) {
+        if (drawCount == draws.size())
+            draws.push_back(EmDraw());
+        EmDraw& d = draws[drawCount++];
+        d.object = obj;
+        d.modelTr = objectTr;
+        d.normalTr = glm::inverse(objectTr);
+        d.light = -1;
+
+        if (pass == emLightPass) {
+            EmLight light = {obj->position, obj->diffuseColor, obj->specularColor, obj->range, obj->isLight};
+            d.light = (int)lights.size();
+            lights.push_back(light); } }
+
+    for (int i=0;  i<obj->instances.size();  i++)
+        Gather(obj->instances[i].first, objectTr*obj->instances[i].second*obj->animTr);
+}
+
+////////////////////////////////////////////////////////////////////////
+// The equivalent of GBuffer.vert, run over fixed size chunks of every
+// draw's vertices.
+void Emulator::VertexStage()
+{
+    const int chunk = 4096;
+    std::vector<glm::ivec2> tasks;
+    for (int d=0;  d<drawCount;  d++) {
+        const int n = (int)draws[d].object->shape->Pnt.size();
+        draws[d].verts.resize(n);
+        for (int first=0;  first<n;  first+=chunk)
+            tasks.push_back(glm::ivec2(d, first)); }
+
+    const glm::mat4 viewProj = WorldProj*WorldView;
+    Workers().ParallelFor((int)tasks.size(), [&](int t) {
+        EmDraw& d = draws[tasks[t].x];
+        const Shape* shape = d.object->shape;
+        const glm::mat4 clipTr = viewProj*d.modelTr;
+        const glm::mat3 modelTr3 = glm::mat3(d.modelTr);
+        const glm::mat3 normalTr3 = glm::mat3(d.normalTr);
+        const int first = tasks[t].y;
+        const int last = std::min(first+chunk, (int)d.verts.size());
+        const bool hasN = shape->Nrm.size() > 0;
+        const bool hasT = shape->Tex.size() > 0;
+        const bool hasD = shape->Tan.size() > 0;
+
+        for (int i=first;  i<last;  i++) {
+            EmVertex& v = d.verts[i];
+            const glm::vec4& P = shape->Pnt[i];
+            v.clip = clipTr*P;
+            glm::vec3 world = (d.modelTr*P).xyz();
+            glm::vec3 N = hasN ? shape->Nrm[i]*normalTr3 : glm::vec3(0.0f);
+            glm::vec2 T = hasT ? shape->Tex[i] : glm::vec2(0.0f);
+            glm::vec3 D = hasD ? modelTr3*shape->Tan[i] : glm::vec3(0.0f);
+            v.var[0] = world.x;  v.var[1] = world.y;  v.var[2] = world.z;
+            v.var[3] = N.x;      v.var[4] = N.y;      v.var[5] = N.z;
+            v.var[6] = T.x;      v.var[7] = T.y;
+            v.var[8] = D.x;      v.var[9] = D.y;      v.var[10] = D.z; } });
+}
+
+////////////////////////////////////////////////////////////////////////
+// Snap a triangle to the subpixel grid, compute its edge functions
+// and bounding box, and keep it if it covers any pixel center.
+void Emulator::SetupTriangle(EmJob& job, const int draw,
+                             const EmVertex* v0, const EmVertex* v1, const EmVertex* v2)
+{
+    const int sub = 1<<emSubBits;
+    EmTriangle t;
+    t.draw = draw;
+    t.v[0] = v0;  t.v[1] = v1;  t.v[2] = v2;
+
+    for (int i=0;  i<3;  i++) {
+        const glm::vec4& c = t.v[i]->clip;
+        float iw = 1.0f/c.w;
+        t.X[i] = (int)floorf((c.x*iw*0.5f + 0.5f)*width*sub + 0.5f);
+        t.Y[i] = (int)floorf((c.y*iw*0.5f + 0.5f)*height*sub + 0.5f);
+        t.z[i] = c.z*iw*0.5f + 0.5f;
+        t.invW[i] = iw; }
+
+    long long area = (long long)(t.X[1]-t.X[0])*(t.Y[2]-t.Y[0])
+                   - (long long)(t.X[2]-t.X[0])*(t.Y[1]-t.Y[0]);
+    if (area == 0)
+        return;
+
+    // The light volume pass culls back (clockwise) faces.  The G-buffer
+    // pass draws both windings, so make everything counter-clockwise.
+    if (area < 0) {
+        if (pass == emLightPass)
+            return;
+        std::swap(t.v[1], t.v[2]);
+        std::swap(t.X[1], t.X[2]);
+        std::swap(t.Y[1], t.Y[2]);
+        std::swap(t.z[1], t.z[2]);
+        std::swap(t.invW[1], t.invW[2]);
+        area = -area; }
+    t.area = area;
+
+    // Pixel centers (at half a pixel) inside the subpixel bounding box
+    const int half = sub/2;
+    int minXs = std::min(t.X[0], std::min(t.X[1], t.X[2]));
+    int maxXs = std::max(t.X[0], std::max(t.X[1], t.X[2]));
+    int minYs = std::min(t.Y[0], std::min(t.Y[1], t.Y[2]));
+    int maxYs = std::max(t.Y[0], std::max(t.Y[1], t.Y[2]));
+    t.minX = std::max(0, (minXs - half + sub - 1) >> emSubBits);
+    t.minY = std::max(0, (minYs - half + sub - 1) >> emSubBits);
+    t.maxX = std::min(width-1, (maxXs - half) >> emSubBits);
+    t.maxY = std::min(height-1, (maxYs - half) >> emSubBits);
+    if (t.minX > t.maxX || t.minY > t.maxY)
+        return;
+
+    // Edge i runs from vertex i+1 to vertex i+2, and is positive on
+    // the side of vertex i.  Pixels exactly on an edge belong to the
+    // triangle only if it is a top or left edge, which is folded into
+    // the constant term so the inside test is simply E >= 0.
+    for (int i=0;  i<3;  i++) {
+        int a = (i+1)%3, b = (i+2)%3;
+        t.A[i] = t.Y[a] - t.Y[b];
+        t.B[i] = t.X[b] - t.X[a];
+        t.C[i] = (long long)t.X[a]*t.Y[b] - (long long)t.Y[a]*t.X[b];
+        bool topLeft = t.A[i] > 0 || (t.A[i] == 0 && t.B[i] < 0);
+        if (!topLeft)
+            t.C[i] -= 1; }
+
+    job.tris.push_back(t);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Sutherland-Hodgman clipping of a triangle against the clip volume,
+// followed by a fan triangulation of the resulting polygon.
+void Emulator::ClipTriangle(EmJob& job, const int draw,
+                            const EmVertex* v0, const EmVertex* v1, const EmVertex* v2)
+{
+    EmVertex poly[2][3+numClipPlanes];
+    int n = 3;
+    poly[0][0] = *v0;  poly[0][1] = *v1;  poly[0][2] = *v2;
+
+    int in = 0;
+    for (int p=0;  p<numClipPlanes && n>=3;  p++) {
+        EmVertex* src = poly[in];
+        EmVertex* dst = poly[1-in];
+        int m = 0;
+        for (int i=0;  i<n;  i++) {
+            const EmVertex& a = src[i];
+            const EmVertex& b = src[(i+1)%n];
+            float da = PlaneDist(a.clip, p);
+            float db = PlaneDist(b.clip, p);
+            if (da >= 0.0f)
+                dst[m++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+                dst[m++] = Lerp(a, b, da/(da-db)); }
+        n = m;
+        in = 1-in; }
+
+    if (n < 3)
+        return;
+
+    // The deque keeps earlier vertices in place as it grows.
+    const int base = (int)job.clipVerts.size();
+    for (int i=0;  i<n;  i++)
+        job.clipVerts.push_back(poly[in][i]);
+    for (int i=1;  i+1<n;  i++)
+        SetupTriangle(job, draw, &job.clipVerts[base], &job.clipVerts[base+i], &job.clipVerts[base+i+1]);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Set up one job's triangles and sort them into per tile bins.
+void Emulator::SetupStage(EmJob& job)
+{
+    const EmDraw& d = draws[job.draw];
+    const std::vector<glm::ivec3>& Tri = d.object->shape->Tri;
+    job.tris.clear();
+    job.clipVerts.clear();
+
+    for (int i=job.first;  i<job.last;  i++) {
+        const EmVertex* v0 = &d.verts[Tri[i][0]];
+        const EmVertex* v1 = &d.verts[Tri[i][1]];
+        const EmVertex* v2 = &d.verts[Tri[i][2]];
+        int c0 = OutCode(v0->clip), c1 = OutCode(v1->clip), c2 = OutCode(v2->clip);
+        if (c0 & c1 & c2)
+            continue;           // Entirely outside one plane
+        if (c0 | c1 | c2)
+            ClipTriangle(job, job.draw, v0, v1, v2);
+        else
+            SetupTriangle(job, job.draw, v0, v1, v2); }
+
+    // Counting sort of (triangle, tile) pairs by tile
+    const int numTiles = tilesX*tilesY;
+    job.tileStart.assign(numTiles+1, 0);
+    for (int i=0;  i<job.tris.size();  i++) {
+        const EmTriangle& t = job.tris[i];
+        for (int ty=t.minY/emTileSize;  ty<=t.maxY/emTileSize;  ty++)
+            for (int tx=t.minX/emTileSize;  tx<=t.maxX/emTileSize;  tx++)
+                job.tileStart[ty*tilesX + tx + 1]++; }
+    for (int i=0;  i<numTiles;  i++)
+        job.tileStart[i+1] += job.tileStart[i];
+
+    job.tileTris.resize(job.tileStart[numTiles]);
+    std::vector<int> fill(job.tileStart.begin(), job.tileStart.end()-1);
+    for (int i=0;  i<job.tris.size();  i++) {
+        const EmTriangle& t = job.tris[i];
+        for (int ty=t.minY/emTileSize;  ty<=t.maxY/emTileSize;  ty++)
+            for (int tx=t.minX/emTileSize;  tx<=t.maxX/emTileSize;  tx++)
+                job.tileTris[fill[ty*tilesX + tx]++] = i; }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Rasterize one triangle within the pixel rectangle [x0,x1]x[y0,y1]
+// of a tile.  The G-buffer pass depth tests each pixel and writes the
+// values of GBuffer.frag;  the light volume pass marks the pixel as
+// covered by the triangle's light.
+void Emulator::RasterTriangle(const EmTriangle& t, const int x0, const int y0, const int x1, const int y1)
+{
+    const int sub = 1<<emSubBits;
+    const long long sx = ((long long)x0 << emSubBits) + sub/2;
+    const long long sy = ((long long)y0 << emSubBits) + sub/2;
+    const long long w = x1-x0, h = y1-y0;
+
+    // Edges that do not cross the rectangle are either trivially
+    // passed (and replaced by a constant 0) or reject the triangle.
+    // The rest have values bounded by the rectangle size, and are
+    // stepped in 32 bits.
+    int e[3], stepX[3], stepY[3];
+    long long E[3];
+    for (int i=0;  i<3;  i++) {
+        E[i] = t.A[i]*sx + t.B[i]*sy + t.C[i];
+        long long ex = t.A[i]*sub*w, ey = t.B[i]*sub*h;
+        long long lo = E[i] + std::min(0LL, ex) + std::min(0LL, ey);
+        long long hi = E[i] + std::max(0LL, ex) + std::max(0LL, ey);
+        if (hi < 0)
+            return;
+        if (lo >= 0) {
+            e[i] = stepX[i] = stepY[i] = 0; }
+        else {
+            e[i] = (int)E[i];
+            stepX[i] = (int)(t.A[i]*sub);
+            stepY[i] = (int)(t.B[i]*sub); } }
+
+    // Interpolation planes, relative to the rectangle's first pixel
+    const double invArea = 1.0/(double)t.area;
+    const float b1 = (float)(E[1]*invArea), b2 = (float)(E[2]*invArea);
+    const float db1dy = (float)(t.B[1]*sub*invArea), db2dy = (float)(t.B[2]*sub*invArea);
+    EmSetup s;
+    s.db1dx = (float)(t.A[1]*sub*invArea);
+    s.db2dx = (float)(t.A[2]*sub*invArea);
+    s.z0 = t.z[0];     s.dz1 = t.z[1]-t.z[0];        s.dz2 = t.z[2]-t.z[0];
+    s.w0 = t.invW[0];  s.dw1 = t.invW[1]-t.invW[0];  s.dw2 = t.invW[2]-t.invW[0];
+    for (int k=0;  k<emVaryings;  k++) {
+        float a0 = t.v[0]->var[k]*t.invW[0];
+        s.a0[k] = a0;
+        s.da1[k] = t.v[1]->var[k]*t.invW[1] - a0;
+        s.da2[k] = t.v[2]->var[k]*t.invW[2] - a0; }
+
+    const EmDraw& d = draws[t.draw];
+    const glm::vec3& Kd = d.object->diffuseColor;
+    const glm::vec3& Ks = d.object->specularColor;
+    const float alpha = d.object->shininess;
+    const unsigned int lightBit = d.light >= 0 ? 1u << (d.light - lightBase) : 0;
+
+    const int n = x1-x0+1;
+    EmBlockValues values;
+    for (int y=y0;  y<=y1;  y++) {
+        unsigned long long mask = kernels->CoverRow(e, stepX, n);
+        const float rb1 = b1 + (y-y0)*db1dy, rb2 = b2 + (y-y0)*db2dy;
+        const int row = y*width + x0;
+
+        if (pass == emLightPass) {
+            for (int x=0;  x<n && (mask >> x);  x++)
+                if ((mask >> x) & 1)
+                    lightMask[row + x] |= lightBit; }
+        else {
+            for (int bx=0;  bx<n && (mask >> bx);  bx+=emBlock) {
+                unsigned int bits = (unsigned int)(mask >> bx) & ((1<<emBlock)-1);
+                if (!bits)
+                    continue;
+                kernels->InterpolateBlock(s, rb1 + bx*s.db1dx, rb2 + bx*s.db2dx, values);
+
+                for (int l=0;  l<emBlock;  l++) {
+                    if (!(bits & (1<<l)))
+                        continue;
+                    const int p = row + bx + l;
+                    if (values.z[l] < depth[p]) {
+                        depth[p] = values.z[l];
+                        for (int k=0;  k<6;  k++)
+                            gbuffer[gPosX+k][p] = values.var[k][l];
+                        for (int c=0;  c<3;  c++) {
+                            gbuffer[gKdR+c][p] = Kd[c];
+                            gbuffer[gKsR+c][p] = Ks[c]; }
+                        gbuffer[gAlpha][p] = alpha; } } } }
+
+        for (int i=0;  i<3;  i++)
+            e[i] = (int)((unsigned int)e[i] + (unsigned int)stepY[i]); }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Rasterize every triangle binned into a tile, visiting the jobs from
+// jobFirst to jobLast (and so the triangles) in submission order.
+void Emulator::RasterTile(const int tile)
+{
+    const int tx0 = (tile % tilesX)*emTileSize;
+    const int ty0 = (tile / tilesX)*emTileSize;
+    const int tx1 = std::min(tx0+emTileSize, width) - 1;
+    const int ty1 = std::min(ty0+emTileSize, height) - 1;
+
+    for (int j=jobFirst;  j<jobLast;  j++) {
+        const EmJob& job = jobs[j];
+        for (int k=job.tileStart[tile];  k<job.tileStart[tile+1];  k++) {
+            const EmTriangle& t = job.tris[job.tileTris[k]];
+            RasterTriangle(t, std::max(t.minX, tx0), std::max(t.minY, ty0),
+                              std::min(t.maxX, tx1), std::min(t.maxY, ty1)); } }
+}
+
+////////////////////////////////////////////////////////////////////////
+// The deferred lighting of one tile:  Lighting.frag, then the added
+// LocalLights.frag contribution of each light whose front faces cover
+// the pixel.  Pixels are processed a block at a time, directly from
+// the structure of arrays G-buffer planes.  Only the first group of
+// lights starts from Lighting.frag;  the others add to the color.
+void Emulator::LightTile(const int tile)
+{
+    const int tx0 = (tile % tilesX)*emTileSize;
+    const int ty0 = (tile / tilesX)*emTileSize;
+    const int tx1 = std::min(tx0+emTileSize, width) - 1;
+    const int ty1 = std::min(ty0+emTileSize, height) - 1;
+
+    const float* g[emGPlanes];
+    float out[3][emBlock];
+    for (int y=ty0;  y<=ty1;  y++) {
+        for (int x=tx0;  x<=tx1;  x+=emBlock) {
+            const int p = y*width + x;
+            const int n = std::min(emBlock, tx1-x+1);
+            for (int k=0;  k<emGPlanes;  k++)
+                g[k] = &gbuffer[k][p];
+
+            // The pixels nothing was drawn on keep the clear color
+            unsigned int drawn = 0;
+            for (int l=0;  l<n;  l++)
+                if (depth[p+l] < 1.0f)
+                    drawn |= 1u << l;
+
+            // Lighting.frag, including its debug displays of the G-buffer
+            for (int c=0;  c<3;  c++)
+                for (int l=0;  l<emBlock;  l++)
+                    if (lightBase > 0)
+                        out[c][l] = l < n ? color[p+l][c] : 0.0f;
+                    else switch (drawID) {
+                    case 1: out[c][l] = g[gPosX+c][l]/10.0f;  break;
+                    case 2: {
+                        const float v = g[gNrmX+c][l];
+                        out[c][l] = toggle == 0 ? v : (toggle == 1 ? -v : fabsf(v));
+                        break; }
+                    case 3: out[c][l] = g[gKdR+c][l];  break;
+                    case 4: out[c][l] = g[gKsR+c][l];  break;
+                    default: out[c][l] = 0.0f; }
+            if (lightBase == 0 && (drawID < 1 || drawID > 4))
+                BRDFBlock(kernels, g, globalLight, eyePos, drawn, out);
+
+            // LocalLights.frag, for each light covering any pixel of the block
+            unsigned int any = 0;
+            for (int l=0;  l<n;  l++)
+                any |= lightMask[p+l];
+            while (any) {
+                int i = 0;
+                while (!((any >> i) & 1))
+                    i++;
+                any &= ~(1u << i);
+                unsigned int lanes = 0;
+                for (int l=0;  l<n;  l++)
+                    if ((lightMask[p+l] >> i) & 1)
+                        lanes |= 1u << l;
+                BRDFBlock(kernels, g, lights[lightBase + i], eyePos, lanes & drawn, out); }
+
+            for (int l=0;  l<n;  l++)
+                color[p+l] = (drawn >> l) & 1 ? glm::vec4(out[0][l], out[1][l], out[2][l], 1.0f)
+                                              : clearColor; } }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Rasterize an object hierarchy in one of the two passes:  the
+// vertex, setup and raster stages.
+void Emulator::RunPass(const Object* root, const EmPass p)
+{
+    pass = p;
+
+    // Vertex stage
+    drawCount = 0;
+    Gather(root, glm::mat4());
+    VertexStage();
+
+    // Setup and binning stage
+    int numJobs = 0;
+    for (int d=0;  d<drawCount;  d++) {
+        const int n = (int)draws[d].object->shape->Tri.size();
+        triangleCount += n;
+        for (int first=0;  first<n;  first+=emJobTris) {
+            if (numJobs == jobs.size())
+                jobs.push_back(EmJob());
+            EmJob& job = jobs[numJobs++];
+            job.draw = d;
+            job.first = first;
+            job.last = std::min(first+emJobTris, n); } }
+    jobs.resize(numJobs);
+    Workers().ParallelFor(numJobs, [&](int j) { SetupStage(jobs[j]); });
+
+    for (int j=0;  j<numJobs;  j++)
+        binnedCount += (int)jobs[j].tris.size();
+
+    // Raster stage, for the G-buffer.  (The light volumes are
+    // rasterized a group at a time by DrawScene.)
+    if (pass == emGBufferPass) {
+        jobFirst = 0;
+        jobLast = numJobs;
+        Workers().ParallelFor(tilesX*tilesY, [&](int tile) { RasterTile(tile); }); }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Render the scene's object and light hierarchies into the color and
+// depth arrays, using the transformations and lighting values the
+// scene computed for this frame.
+void Emulator::DrawScene(Scene& scene)
+{
+    if (scene.width != width || scene.height != height)
+        Resize(scene.width, scene.height);
+    if (width <= 0 || height <= 0)
+        return;
+
+    WorldProj = scene.WorldProj;
+    WorldView = scene.WorldView;
+    WorldInverse = scene.WorldInverse;
+    eyePos = (WorldInverse*glm::vec4(0, 0, 0, 1)).xyz();
+    drawID = scene.drawID;
+    toggle = scene.flipToggle;
+
+    // The lighting pass only sets the global light's uniforms, leaving isLight false.
+    globalLight.pos = scene.lightPos;
+    globalLight.val = scene.lightVal;
+    globalLight.amb = scene.lightAmb;
+    globalLight.range = 0.0f;
+    globalLight.isLight = false;
+
+    // Clear the G-buffer as glClear does
+    for (int k=0;  k<emGPlanes;  k++)
+        std::fill(gbuffer[k].begin(), gbuffer[k].end(), k == gAlpha ? clearColor.w : clearColor[k%3]);
+    std::fill(depth.begin(), depth.end(), 1.0f);
+    lights.clear();
+
+    triangleCount = 0;
+    binnedCount = 0;
+    RunPass(scene.objectRoot, emGBufferPass);
+    RunPass(scene.lightsRoot, emLightPass);
+
+    // Raster and lighting stages of the light volumes, emMaxLights
+    // lights (the bits of lightMask) at a time.  The draws, and so the
+    // jobs, are in the order of their lights.  There is always a first
+    // group, for Lighting.frag.
+    int j = 0;
+    for (lightBase=0;  lightBase == 0 || j < jobs.size();  lightBase+=emMaxLights) {
+        jobFirst = j;
+        while (j < jobs.size() && draws[jobs[j].draw].light < lightBase + emMaxLights)
+            j++;
+        jobLast = j;
+        std::fill(lightMask.begin(), lightMask.end(), 0u);
+        Workers().ParallelFor(tilesX*tilesY, [&](int tile) { RasterTile(tile); });
+        Workers().ParallelFor(tilesX*tilesY, [&](int tile) { LightTile(tile); }); }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Compare the output (clamped to [0,1] as the default framebuffer
+// does) with an image read back from OpenGL.
+EmCompare Emulator::Compare(const std::vector<float>& rgba, const float tolerance)
+{
+    EmCompare r = {width*height, 0, 0.0f, 0.0f};
+    if (r.pixels == 0 || (int)rgba.size() < 4*r.pixels)
+        return r;
+
+    double total = 0.0;
+    for (int p=0;  p<r.pixels;  p++) {
+        float worst = 0.0f;
+        for (int c=0;  c<3;  c++) {
+            float v = color[p][c];
+            v = v > 0.0f ? (v < 1.0f ? v : 1.0f) : 0.0f;   // NaN becomes 0
+            worst = std::max(worst, fabsf(v - rgba[4*p+c])); }
+        if (worst > tolerance)
+            r.differing++;
+        r.maxError = std::max(r.maxError, worst);
+        total += worst; }
+    r.meanError = (float)(total/r.pixels);
+    return r;
+}
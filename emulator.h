@@ -1,3 +1,174 @@
+////////////////////////////////////////////////////////////////////////
+// A software emulation of the graphics pipeline, used to render the
+// Object hierarchy on machines without a GPU.  It follows the same
+// deferred shading passes as Scene::DrawScene:
+//
+//   * G-buffer pass:  The objectRoot hierarchy is rasterized into
+//     planes of the values GBuffer.frag encodes (world position,
+//     normal, Kd, and Ks/shininess), stored as structure of arrays at
+//     full precision, rather than packed as in FBO::CreateGBuffer.
+//   * Light volume pass:  The front faces of the lightsRoot spheres
+//     are rasterized (without depth test) into a per pixel mask of
+//     the local lights covering it, as the LocalLights pass does.
+//   * Lighting:  Lighting.frag and LocalLights.frag are evaluated for
+//     every pixel, with BRDF() of BRDF.frag, a block of pixels at a
+//     time by the SIMD kernels of raster.h.
+//
+// The mask has a bit per light, so the volumes are rasterized and lit
+// emMaxLights lights at a time, each group adding to the colors.
+//
+// Each rasterization pass has three stages:
+//
+//   * Vertex:  Each shape's vertices are transformed by the same
+//     matrices the GBuffer.vert shader uses.
+//   * Setup:   Triangles are clipped, snapped to a subpixel grid, and
+//     binned into the screen tiles their bounding box touches.
+//   * Raster:  Each tile is rasterized independently of the others,
+//     using the SIMD kernels of raster.h.
+//
+// All stages run in parallel on the shared WorkerPool.  The result is
+// left in the color and depth arrays, bottom row first (as OpenGL
+// expects for glTexSubImage2D and glReadPixels).
+////////////////////////////////////////////////////////////////////////
 
+#ifndef _EMULATOR
+#define _EMULATOR
 
-// This file is intentionally blank
+#include <vector>
+#include <deque>
+
+#include "raster.h"
+
+class Object;
+class Scene;
+
+const int emTileSize = 64;      // Tile width and height in pixels
+const int emSubBits = 4;        // Subpixel precision bits of snapped vertices
+const int emJobTris = 4096;     // Triangles per setup/binning job
+const int emMaxLights = 32;     // Local lights per group (bits of the light mask)
+
+// G-buffer planes, of the values GBuffer.frag encodes
+enum EmGPlane {
+    gPosX, gPosY, gPosZ,        // worldPos (recovered from depth on the GPU)
+    gNrmX, gNrmY, gNrmZ,        // normalVec
+    gKdR, gKdG, gKdB,           // diffuse
+    gKsR, gKsG, gKsB, gAlpha,   // specular, shininess
+    emGPlanes };
+
+enum EmPass { emGBufferPass, emLightPass };
+
+// A transformed vertex:  gl_Position and the vertex shader's outputs.
+struct EmVertex
+{
+    glm::vec4 clip;
+    float var[emVaryings];
+};
+
+// A clipped, snapped triangle, ready for rasterization.
+struct EmTriangle
+{
+    const EmVertex* v[3];
+    int draw;                   // Index into Emulator::draws
+    int X[3], Y[3];             // Screen position in subpixels (1/16th pixel)
+    float z[3];                 // Window depth in [0,1]
+    float invW[3];              // 1/w for perspective correct interpolation
+    long long A[3], B[3], C[3]; // Edge functions; edge i is opposite vertex i
+    long long area;             // Twice the area, in subpixels squared
+    int minX, minY, maxX, maxY; // Pixel bounding box (inclusive), clamped to screen
+};
+
+// One object to be drawn, with its accumulated model transformation.
+struct EmDraw
+{
+    const Object* object;
+    glm::mat4 modelTr, normalTr;
+    int light;                  // Index into Emulator::lights in the light volume pass
+    std::vector<EmVertex> verts;
+};
+
+// A local light, with the values Object::Block gives BRDF.frag,
+// or the scene's global light (isLight false).
+struct EmLight
+{
+    glm::vec3 pos, val, amb;
+    float range;
+    bool isLight;
+};
+
+// Results of comparing the emulator's output with OpenGL's
+struct EmCompare
+{
+    int pixels, differing;
+    float maxError, meanError;
+};
+
+// A range of triangles of one draw, set up and binned together.
+// Each job keeps its own bins, so that the rasterizer can visit the
+// triangles of a tile in submission order without any locking.
+struct EmJob
+{
+    int draw, first, last;
+    std::vector<EmTriangle> tris;
+    std::deque<EmVertex> clipVerts;    // New vertices made by clipping
+    std::vector<int> tileStart;         // Per tile start into tileTris (numTiles+1)
+    std::vector<int> tileTris;          // Triangle indices sorted by tile
+};
+
+class Emulator
+{
+public:
+    int width, height;
+    int tilesX, tilesY;
+
+    // Output buffers, bottom row first.
+    std::vector<glm::vec4> color;
+    std::vector<float> depth;
+
+    // G-buffer planes and local light coverage, same layout
+    std::vector<float> gbuffer[emGPlanes];
+    std::vector<unsigned int> lightMask;
+
+    // Per frame state
+    glm::mat4 WorldProj, WorldView, WorldInverse;
+    glm::vec3 eyePos;
+    glm::vec4 clearColor;
+    EmLight globalLight;
+    std::vector<EmLight> lights;
+    int drawID, toggle;         // Lighting.frag's ID and Toggle debug uniforms
+    EmPass pass;
+    std::vector<EmDraw> draws;
+    std::vector<EmJob> jobs;
+    int jobFirst, jobLast;      // The jobs RasterTile rasterizes
+    int lightBase;              // The first light of the group in lightMask
+
+    // Inner loops, chosen to suit the CPU
+    const EmKernels* kernels;
+
+    // Statistics from the last frame
+    int drawCount, triangleCount, binnedCount;
+
+    Emulator();
+
+    void Resize(const int w, const int h);
+    void DrawScene(Scene& scene);
+
+    // Compare against an RGBA float image of the same size (such as
+    // glReadPixels of the GL output), counting pixels that differ by
+    // more than the tolerance in any channel.
+    EmCompare Compare(const std::vector<float>& rgba, const float tolerance);
+
+private:
+    void RunPass(const Object* root, const EmPass p);
+    void Gather(const Object* obj, const glm::mat4& objectTr);
+    void VertexStage();
+    void SetupStage(EmJob& job);
+    void SetupTriangle(EmJob& job, const int draw,
+                       const EmVertex* v0, const EmVertex* v1, const EmVertex* v2);
+    void ClipTriangle(EmJob& job, const int draw,
+                      const EmVertex* v0, const EmVertex* v1, const EmVertex* v2);
+    void RasterTile(const int tile);
+    void RasterTriangle(const EmTriangle& t, const int x0, const int y0, const int x1, const int y1);
+    void LightTile(const int tile);
+};
+
+#endif
@@ -10,6 +10,11 @@
 #include <glbinding/Binding.h>
 using namespace gl;
 
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "shader.h"
 #include "fbo.h"
 
 void FBO::CreateFBO(const int w, const int h)
@@ -21,13 +26,12 @@ void FBO::CreateFBO(const int w, const int h)
     glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fboID);
 
     // Create a render buffer, and attach it to FBO's depth attachment
-    unsigned int depthBuffer;
-    glGenRenderbuffersEXT(1, &depthBuffer);
-    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, depthBuffer);
+    glGenRenderbuffersEXT(1, &depthID);
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, depthID);
     glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT,
                              width, height);
     glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
-                                 GL_RENDERBUFFER_EXT, depthBuffer);
+                                 GL_RENDERBUFFER_EXT, depthID);
 
     // Create a texture and attach FBO's color 0 attachment.  The
     // GL_RGBA32F and GL_RGBA constants set this texture to be 32 bit
@@ -55,81 +59,59 @@ void FBO::CreateFBO(const int w, const int h)
     glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
 }
 
-void FBO::CreateGBuffer(const int w, const int h)
+// Release the objects made by CreateFBO (before recreating it at a new size).
+void FBO::DeleteFBO()
 {
-    width = w;
-    height = h;
-
-    glGenFramebuffersEXT(1, &fboID);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fboID);
-
-    // world pos
-    glGenTextures(1, &posID);
-    glBindTexture(GL_TEXTURE_2D, posID);
-    glTexImage2D(GL_TEXTURE_2D, 0, (int)GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (int)GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, (int)GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (int)GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (int)GL_LINEAR);
-
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
-        GL_TEXTURE_2D, posID, 0);
-
-    // normal
-    glGenTextures(1, &normalID);
-    glBindTexture(GL_TEXTURE_2D, normalID);
-    glTexImage2D(GL_TEXTURE_2D, 0, (int)GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (int)GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, (int)GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (int)GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (int)GL_LINEAR);
-
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT1_EXT,
-        GL_TEXTURE_2D, normalID, 0);
+    glDeleteTextures(1, &textureID);
+    glDeleteRenderbuffersEXT(1, &depthID);
+    glDeleteFramebuffersEXT(1, &fboID);
+}
 
-    // diffuse
-    glGenTextures(1, &diffuseID);
-    glBindTexture(GL_TEXTURE_2D, diffuseID);
-    glTexImage2D(GL_TEXTURE_2D, 0, (int)GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+// Make a G-buffer target's texture, and attach it to the bound FBO.
+// Its texels are only read at their own pixels, so it is not filtered.
+static unsigned int GBufferTarget(const GLenum internalFormat, const GLenum format, const GLenum type,
+                                  const GLenum attachment, const int width, const int height)
+{
+    unsigned int id;
+    glGenTextures(1, &id);
+    glBindTexture(GL_TEXTURE_2D, id);
+    glTexImage2D(GL_TEXTURE_2D, 0, (int)internalFormat, width, height, 0, format, type, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (int)GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, (int)GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (int)GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (int)GL_LINEAR);
-
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT2_EXT,
-        GL_TEXTURE_2D, diffuseID, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (int)GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (int)GL_NEAREST);
 
-    // specular
-    glGenTextures(1, &specularID);
-    glBindTexture(GL_TEXTURE_2D, specularID);
-    glTexImage2D(GL_TEXTURE_2D, 0, (int)GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, attachment, GL_TEXTURE_2D, id, 0);
+    return id;
+}
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (int)GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, (int)GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (int)GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (int)GL_LINEAR);
+// The G-buffer is 16 bytes per pixel, depth included:
+//   depth:     32 bit float, from which the lighting passes recover the
+//              world position (with FrameBlock's ViewProjInverse)
+//   color 0:   the normal, octahedrally encoded in two 16 bit channels
+//   color 1:   Kd in 8 bit sRGB (written with GL_FRAMEBUFFER_SRGB on)
+//   color 2:   Ks in 8 bits, and the shininess/255 in alpha
+void FBO::CreateGBuffer(const int w, const int h)
+{
+    width = w;
+    height = h;
 
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT3_EXT,
-        GL_TEXTURE_2D, specularID, 0);
+    glGenFramebuffersEXT(1, &fboID);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fboID);
 
-    GLenum attachment[4] = { GL_COLOR_ATTACHMENT0_EXT,GL_COLOR_ATTACHMENT1_EXT, GL_COLOR_ATTACHMENT2_EXT, GL_COLOR_ATTACHMENT3_EXT };
-    glDrawBuffers(4, attachment);
+    depthID = GBufferTarget(GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT,
+                            GL_DEPTH_ATTACHMENT_EXT, width, height);
+    normalID = GBufferTarget(GL_RG16, GL_RG, GL_UNSIGNED_SHORT,
+                             GL_COLOR_ATTACHMENT0_EXT, width, height);
+    diffuseID = GBufferTarget(GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE,
+                              GL_COLOR_ATTACHMENT1_EXT, width, height);
+    specularID = GBufferTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE,
+                               GL_COLOR_ATTACHMENT2_EXT, width, height);
 
-    // Create a render buffer, and attach it to FBO's depth attachment
-    unsigned int depthBuffer;
-    glGenRenderbuffersEXT(1, &depthBuffer);
-    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, depthBuffer);
-    glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT,
-        width, height);
-    glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
-        GL_RENDERBUFFER_EXT, depthBuffer);
+    GLenum attachment[3] = { GL_COLOR_ATTACHMENT0_EXT, GL_COLOR_ATTACHMENT1_EXT, GL_COLOR_ATTACHMENT2_EXT };
+    glDrawBuffers(3, attachment);
 
     // Check for completeness/correctness
     int status = (int)glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
@@ -143,13 +125,13 @@ void FBO::CreateGBuffer(const int w, const int h)
 void FBO::BindFBO() { glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fboID); }
 void FBO::UnbindFBO() { glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0); }
 
-void FBO::BindTexture(const int unit, const int programId, const std::string& name)
+void FBO::BindTexture(const int unit, ShaderProgram* program, const std::string& name)
 {
     glActiveTexture((gl::GLenum)((int)GL_TEXTURE0 + unit));
 
     switch (unit) {
     case 0:
-        currID = posID;
+        currID = depthID;
         break;
     case 1:
         currID = normalID;
@@ -165,8 +147,7 @@ void FBO::BindTexture(const int unit, const int programId, const std::string& na
     }
 
     glBindTexture(GL_TEXTURE_2D, currID);
-    int loc = glGetUniformLocation(programId, name.c_str());
-    glUniform1i(loc, unit);
+    program->Set(name, unit);
 }
 
 void FBO::UnbindTexture(const int unit)
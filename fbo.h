@@ -6,14 +6,16 @@
 // texture.
 ////////////////////////////////////////////////////////////////////////
 
+class ShaderProgram;
+
 class FBO {
 public:
     unsigned int fboID;
     unsigned int textureID;
     unsigned int currID;
+    unsigned int depthID;       // A render buffer, or the G-buffer's depth texture
 
-    // 4 IDs
-    unsigned int posID;
+    // The G-buffer's color targets (see CreateGBuffer)
     unsigned int normalID;
     unsigned int diffuseID;
     unsigned int specularID;
@@ -21,6 +23,7 @@ public:
     int width, height;  // Size of the texture.
 
     void CreateFBO(const int w, const int h);
+    void DeleteFBO();
     
     // G-Buffer
     void CreateGBuffer(const int w, const int h);
@@ -31,8 +34,10 @@ public:
     // Unbind this FBO from the graphics pipeline;  graphics goes to screen by default.
     void UnbindFBO();
 
-    // Bind this FBO's texture to a texture unit.
-    void BindTexture(const int unit, const int programId, const std::string& name);
+    // Bind this FBO's texture to a texture unit, and set the program's
+    // sampler of that name to it.  For the G-buffer, units 0 to 3 are
+    // its depth, normal, diffuse and specular textures.
+    void BindTexture(const int unit, ShaderProgram* program, const std::string& name);
 
     // Unbind this FBO's texture from a texture unit.
     void UnbindTexture(const int unit);
@@ -29,6 +29,8 @@ int main(int argc, char** argv)
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, 0);
+    glfwWindowHint(GLFW_DEPTH_BITS, 24);
+    glfwWindowHint(GLFW_STENCIL_BITS, 8);      // For the lights' stencil volumes
     scene.window = glfwCreateWindow(750,750, "Graphics Framework", NULL, NULL);
     if (!scene.window)  { glfwTerminate();  exit(-1); }
 
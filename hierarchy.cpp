@@ -0,0 +1,121 @@
+////////////////////////////////////////////////////////////////////////
+// A flattened copy of an Object hierarchy.  See hierarchy.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+
+#include "framework.h"
+#include "object.h"
+#include "occlusion.h"
+#include "instancing.h"
+#include "bvh.h"
+#include "hierarchy.h"
+#include "renderqueue.h"
+
+#include <glu.h>                // For gluErrorString
+#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line hierarchy.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+// Append a node for obj, then its subtree
+void FlatHierarchy::Add(Object* obj, const int parentNode, const int parentSlot)
+{
+    const int n = (int)object.size();
+    object.push_back(obj);
+    parent.push_back(parentNode);
+    slot.push_back(parentSlot);
+    end.push_back(0);
+    local.push_back(parentNode < 0 ? glm::mat4() : object[parentNode]->instances[parentSlot].second);
+    childCount.push_back((int)obj->instances.size());
+
+    for (int i=0;  i<obj->instances.size();  i++)
+        Add(obj->instances[i].first, n, i);
+    end[n] = (int)object.size();
+}
+
+void FlatHierarchy::Build(Object* _root)
+{
+    root = _root;
+    object.clear();
+    parent.clear();
+    slot.clear();
+    end.clear();
+    local.clear();
+    childCount.clear();
+    Add(root, -1, 0);
+
+    // Every node is computed, in order, so parents come first
+    const int count = (int)object.size();
+    world.resize(count);
+    normal.resize(count);
+    changed.assign(count, true);
+    world[0] = glm::mat4();
+    normal[0] = glm::mat3();
+    for (int n=1;  n<count;  n++) {
+        const Object* p = object[parent[n]];
+        world[n] = world[parent[n]]*local[n]*p->animTr;
+        normal[n] = glm::inverse(glm::mat3(world[n])); }
+    for (int n=0;  n<count;  n++)
+        object[n]->dirty = false;
+    updatedCount = count;
+    version++;
+}
+
+// A node changes if its parent node did, or its parent's object is
+// dirty (whose animTr or instances, and so the node's local
+// transformation, may have changed).
+void FlatHierarchy::Update()
+{
+    const int count = (int)object.size();
+    for (int n=0;  n<count;  n++)
+        if (object[n]->dirty && object[n]->instances.size() != childCount[n]) {
+            Build(root);
+            return; }
+
+    updatedCount = 0;
+    changed[0] = false;
+    for (int n=1;  n<count;  n++) {
+        const int p = parent[n];
+        const Object* pobj = object[p];
+        changed[n] = changed[p] || pobj->dirty;
+        if (!changed[n])
+            continue;
+        if (pobj->dirty)
+            local[n] = pobj->instances[slot[n]].second;
+        world[n] = world[p]*local[n]*pobj->animTr;
+        normal[n] = glm::inverse(glm::mat3(world[n]));
+        updatedCount++; }
+
+    for (int n=0;  n<count;  n++)
+        object[n]->dirty = false;
+}
+
+void FlatHierarchy::Collect(RenderQueue& queue, const RenderPass pass, ShaderProgram* program,
+                            const glm::mat4& viewTr, OcclusionCuller* culler, InstanceBatcher* batcher,
+                            const BoundingVolumes* bounds)
+{
+    // Queue the objects to draw.  An object found hidden, or outside
+    // the frustum, is not queued.  (The culler is asked about every
+    // object visited, to keep its count.)
+    if (batcher)
+        batcher->Clear();
+    const int count = (int)object.size();
+    int n = 0;
+    while (n < count) {
+        Object* obj = object[n];
+        const bool visible = (!culler || culler->Visible(obj)) && (!bounds || bounds->InFrustum(n));
+        if (visible && obj->shape && obj->drawMe) {
+            const float depth = -(viewTr*world[n]*glm::vec4(obj->shape->center, 1.0)).z;
+            if (batcher && obj->shape->Instanceable())
+                batcher->Add(obj, world[n], normal[n], depth);
+            else
+                queue.AddNode(pass, program, this, n, depth); }
+
+        n = obj->drawMe ? n+1 : end[n]; }
+
+    // Then each batch, as one packet at its nearest instance's depth
+    if (batcher) {
+        batcher->Upload();
+        for (int b=0;  b<batcher->BatchCount();  b++)
+            if (batcher->BatchSize(b) > 0)
+                queue.AddBatch(pass, program, batcher, b, batcher->BatchDepth(b)); }
+    CHECKERROR;
+}
@@ -0,0 +1,86 @@
+////////////////////////////////////////////////////////////////////////
+// A flattened copy of an Object hierarchy, with each node's world
+// transformation computed once and kept until it changes.
+//
+// Build walks the hierarchy once, depth first, and makes a node for
+// every place an Object is reached (an Object added in several places,
+// such as a frame's board, is several nodes).  The nodes are stored in
+// that order in parallel arrays:  each node's parent comes before it,
+// and its descendants follow it up to end[node], so a subtree can be
+// skipped by jumping there.
+//
+// A node's world transformation is its parent's world transformation,
+// times its local transformation (its pair in the parent's instances),
+// times the parent's animTr.  Objects mark themselves dirty when their
+// animTr or children change (see Object::SetAnimTr and Object::add),
+// and Update recomputes the world and normal transformations of only
+// the subtrees below dirty objects.  Collect then reads them in order,
+// with no recursion and no matrix products or inverses, and queues
+// the objects to draw in a RenderQueue.
+//
+// Each Object must be in only one FlatHierarchy, since Update clears
+// the dirty flags of the objects it visits.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _HIERARCHY
+#define _HIERARCHY
+
+#include <vector>
+
+#include "renderqueue.h"
+
+class Object;
+class ShaderProgram;
+class OcclusionCuller;
+class InstanceBatcher;
+class BoundingVolumes;
+
+class FlatHierarchy
+{
+    Object* root;
+
+    std::vector<Object*> object;
+    std::vector<int> parent;            // -1 for the root
+    std::vector<int> slot;              // Index in the parent's instances
+    std::vector<int> end;               // One past the last descendant
+    std::vector<glm::mat4> local;
+    std::vector<glm::mat4> world;
+    std::vector<glm::mat3> normal;      // Inverse of world's 3x3, for normals
+    std::vector<int> childCount;        // Size of the object's instances when built
+    std::vector<bool> changed;          // Recomputed in this Update
+
+    void Add(Object* obj, const int parentNode, const int parentSlot);
+
+public:
+    // Nodes recomputed by the last Update, and Builds so far
+    int updatedCount, version;
+
+    FlatHierarchy() : root(NULL), updatedCount(0), version(0) {}
+
+    // Flatten the hierarchy below (and including) root
+    void Build(Object* _root);
+
+    // Recompute the transformations below dirty objects (rebuilding
+    // if any object's children were added to)
+    void Update();
+
+    // Queue the nodes for a pass, in order, skipping the subtrees of
+    // objects with drawMe off.  Objects the culler (if any) finds
+    // hidden are skipped, but their children are still queued.  With a
+    // batcher, objects of instanceable shapes are added to it instead,
+    // and each of its batches is queued once uploaded.  Depths are
+    // measured along viewTr's -z.  Objects outside the frustum, by the
+    // bounds (if any) last culled, are skipped like hidden ones.
+    void Collect(RenderQueue& queue, const RenderPass pass, ShaderProgram* program,
+                 const glm::mat4& viewTr, OcclusionCuller* culler=NULL,
+                 InstanceBatcher* batcher=NULL, const BoundingVolumes* bounds=NULL);
+
+    int NodeCount() const { return (int)object.size(); }
+    Object* NodeObject(const int n) const { return object[n]; }
+    const glm::mat4& WorldTr(const int n) const { return world[n]; }
+    const glm::mat3& NormalTr(const int n) const { return normal[n]; }
+    bool Changed(const int n) const { return changed[n]; }
+    int SubtreeEnd(const int n) const { return end[n]; }
+};
+
+#endif
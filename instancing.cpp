@@ -0,0 +1,235 @@
+////////////////////////////////////////////////////////////////////////
+// Hardware instancing of the scene graph's objects.  See instancing.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stddef.h>             // For offsetof
+#include <algorithm>
+#include <string>
+
+#include "framework.h"
+#include "object.h"
+#include "instancing.h"
+
+#include <glu.h>                // For gluErrorString
+#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line instancing.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+// Locations of the attributes, the matrices taking one per column
+enum { ibTr = ibFirstAttribute, ibNormalTr = ibTr+4, ibDiffuse = ibNormalTr+3,
+       ibSpecular, ibLight, ibEnd };
+
+void BindInstanceAttributes(const int programId)
+{
+    glBindAttribLocation(programId, ibTr, "instanceTr");
+    glBindAttribLocation(programId, ibNormalTr, "instanceNormalTr");
+    glBindAttribLocation(programId, ibDiffuse, "instanceDiffuse");
+    glBindAttribLocation(programId, ibSpecular, "instanceSpecular");
+    glBindAttribLocation(programId, ibLight, "instanceLight");
+}
+
+// Point the bound VAO's instance attributes at the bound array buffer,
+// from the given instance on
+static void InstanceAttributes(const int first)
+{
+    const GLsizei stride = sizeof(InstanceData);
+    const size_t base = (size_t)first*stride;
+    for (int c=0;  c<4;  c++)
+        glVertexAttribPointer(ibTr+c, 4, GL_FLOAT, GL_FALSE, stride,
+                              (const void*)(base + offsetof(InstanceData, modelTr) + c*sizeof(glm::vec4)));
+    for (int c=0;  c<3;  c++)
+        glVertexAttribPointer(ibNormalTr+c, 3, GL_FLOAT, GL_FALSE, stride,
+                              (const void*)(base + offsetof(InstanceData, normalTr) + c*sizeof(glm::vec3)));
+    glVertexAttribPointer(ibDiffuse, 3, GL_FLOAT, GL_FALSE, stride,
+                          (const void*)(base + offsetof(InstanceData, diffuse)));
+    glVertexAttribPointer(ibSpecular, 4, GL_FLOAT, GL_FALSE, stride,
+                          (const void*)(base + offsetof(InstanceData, specular)));
+    glVertexAttribPointer(ibLight, 4, GL_FLOAT, GL_FALSE, stride,
+                          (const void*)(base + offsetof(InstanceData, light)));
+    for (int a=ibTr;  a<ibEnd;  a++) {
+        glEnableVertexAttribArray(a);
+        glVertexAttribDivisor(a, 1); }
+}
+
+bool MultiDrawIndirectSupported()
+{
+    static int supported = -1;
+    if (supported < 0) {
+        GLint major = 0, minor = 0, count = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        supported = major > 4 || (major == 4 && minor >= 3);
+        if (!supported) {
+            bool multiDraw = false, baseInstance = false;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for (int i=0;  i<count;  i++) {
+                const std::string name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+                multiDraw |= name == "GL_ARB_multi_draw_indirect";
+                baseInstance |= name == "GL_ARB_base_instance"; }
+            supported = multiDraw && baseInstance; }
+        printf("Multi-draw indirect %s\n", supported ? "supported" : "not supported");
+        CHECKERROR; }
+    return supported != 0;
+}
+
+InstanceBatcher::InstanceBatcher()
+    : buffer(0), bufferSize(0), indirectBuffer(0), multiDraw(false),
+      drawCount(0), instanceCount(0), multiDrawCount(0)
+{}
+
+void InstanceBatcher::Clear()
+{
+    for (int b=0;  b<batches.size();  b++) {
+        batches[b].instances.clear();
+        batches[b].depths.clear(); }
+}
+
+void InstanceBatcher::Add(const Object* obj, const glm::mat4& objectTr, const glm::mat3& normalTr,
+                          const float depth)
+{
+    std::map<Shape*,int>::iterator b = batchOf.find(obj->shape);
+    if (b == batchOf.end()) {
+        b = batchOf.insert(std::make_pair(obj->shape, (int)batches.size())).first;
+        batches.push_back(Batch());
+        batches.back().shape = obj->shape;
+        batches.back().first = 0; }
+
+    InstanceData inst;
+    inst.modelTr = objectTr;
+    inst.normalTr = normalTr;
+    inst.diffuse = obj->diffuseColor;
+    inst.specular = glm::vec4(obj->specularColor, obj->shininess);
+    inst.light = obj->isLight ? glm::vec4(obj->position, obj->range) : glm::vec4(0.0);
+    batches[b->second].instances.push_back(inst);
+    batches[b->second].depths.push_back(depth);
+}
+
+float InstanceBatcher::BatchDepth(const int b) const
+{
+    const Batch& batch = batches[b];
+    return batch.order.empty() ? 0.0f : batch.depths[batch.order[0]];
+}
+
+// All the batches' instances go into the buffer at once.  Mapping it
+// with GL_MAP_INVALIDATE_BUFFER_BIT orphans it, so the previous draws
+// can go on reading the old contents.  Within a batch the instances
+// are rasterized in order, so they are written nearest first.
+void InstanceBatcher::Upload()
+{
+    drawCount = instanceCount = multiDrawCount = 0;
+    for (int b=0;  b<batches.size();  b++) {
+        Batch& batch = batches[b];
+        const int n = (int)batch.instances.size();
+        batch.order.resize(n);
+        for (int i=0;  i<n;  i++)
+            batch.order[i] = i;
+        const std::vector<float>& depths = batch.depths;
+        std::sort(batch.order.begin(), batch.order.end(),
+                  [&](const int a, const int c) { return depths[a] < depths[c]; });
+        batch.first = instanceCount;
+        instanceCount += n;
+        if (n > 0)
+            drawCount++; }
+    if (instanceCount == 0)
+        return;
+
+    CHECKERROR;
+    if (!buffer)
+        glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    const size_t bytes = (size_t)instanceCount*sizeof(InstanceData);
+    if (bytes > bufferSize) {
+        if (bufferSize == 0)
+            bufferSize = ibInitialInstances*sizeof(InstanceData);
+        while (bufferSize < bytes)
+            bufferSize *= 2;
+        glBufferData(GL_ARRAY_BUFFER, bufferSize, NULL, GL_STREAM_DRAW); }
+    InstanceData* dst = (InstanceData*)glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes,
+                                                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    for (int b=0;  b<batches.size();  b++)
+        for (int i=0;  i<batches[b].order.size();  i++)
+            *dst++ = batches[b].instances[batches[b].order[i]];
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    CHECKERROR;
+}
+
+void InstanceBatcher::DrawBatch(ShaderProgram* program, const int b)
+{
+    Shape* shape = batches[b].shape;
+    const int n = (int)batches[b].instances.size();
+    if (n == 0)
+        return;
+
+    // How the shape's vertices are to be decoded (see VertexFormat)
+    program->Set(shInstanced, true);
+    program->Set(shPackedVertices, shape->format != vfFloat);
+    program->Set(shPosOffset, shape->posOffset);
+    program->Set(shPosScale, shape->posScale);
+
+    BindVAO(shape->vaoID);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    InstanceAttributes(batches[b].first);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    shape->DrawInstances(n);
+    CHECKERROR;
+}
+
+// The 16-bit commands go first, then the 32-bit ones, and each index
+// type is one call.  The commands are orphaned with each run, like the
+// instances.
+void InstanceBatcher::DrawBatches(ShaderProgram* program, const std::vector<int>& list)
+{
+    if (!multiDraw || list.size() < 2 || !MultiDrawIndirectSupported()) {
+        for (int i=0;  i<list.size();  i++)
+            DrawBatch(program, list[i]);
+        return; }
+
+    commands.clear();
+    int shortCount = 0;
+    for (int t=0;  t<2;  t++) {
+        const int size = t == 0 ? sizeof(unsigned short) : sizeof(unsigned int);
+        for (int i=0;  i<list.size();  i++) {
+            const Batch& batch = batches[list[i]];
+            const Shape* shape = batch.shape;
+            if (shape->indexSize != size || batch.instances.empty())
+                continue;
+            for (int r=0;  r<shape->ranges.size();  r++) {
+                DrawCommand cmd;
+                cmd.count = 3*shape->ranges[r].count;
+                cmd.instanceCount = (unsigned int)batch.instances.size();
+                cmd.firstIndex = (unsigned int)(shape->indexOffset/size) + 3*shape->ranges[r].first;
+                cmd.baseVertex = shape->ranges[r].baseVertex;
+                cmd.baseInstance = batch.first;
+                commands.push_back(cmd); } }
+        if (t == 0)
+            shortCount = (int)commands.size(); }
+    if (commands.empty())
+        return;
+
+    // How the shapes' vertices are to be decoded (see VertexFormat)
+    Shape* shape = batches[list[0]].shape;
+    program->Set(shInstanced, true);
+    program->Set(shPackedVertices, shape->format != vfFloat);
+    program->Set(shPosOffset, shape->posOffset);
+    program->Set(shPosScale, shape->posScale);
+
+    BindVAO(shape->vaoID);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    InstanceAttributes(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    if (!indirectBuffer)
+        glGenBuffers(1, &indirectBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size()*sizeof(DrawCommand), &commands[0], GL_STREAM_DRAW);
+    if (shortCount > 0) {
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, (const void*)0, shortCount, 0);
+        multiDrawCount++; }
+    if (shortCount < commands.size()) {
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                                    (const void*)(shortCount*sizeof(DrawCommand)),
+                                    (GLsizei)commands.size() - shortCount, 0);
+        multiDrawCount++; }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    CHECKERROR;
+}
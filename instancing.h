@@ -0,0 +1,127 @@
+////////////////////////////////////////////////////////////////////////
+// Hardware instancing of the scene graph's objects.
+//
+// Instead of drawing each Object as the traversal reaches it (setting
+// its colors and transformations as uniforms), FlatHierarchy::Collect
+// can hand it to an InstanceBatcher, which groups the objects by Shape.
+// Upload then writes every object's transformation, normal
+// transformation, colors and (for local lights) light values into one
+// instance buffer, nearest first within each batch, and DrawBatch
+// draws a shape's objects with a single
+// glDrawElementsInstancedBaseVertex.  So the hundred spheres of
+// SphereOfSpheres, the four boards of a picture frame, and all the
+// light volumes are each one draw.
+//
+// The per-instance values are vertex attributes, with a divisor of
+// one, at locations ibFirstAttribute and on (see
+// BindInstanceAttributes), and shaders take them instead of their
+// uniforms when the "instanced" uniform is set.  GL 3.3 has no base
+// instance, so the attributes are pointed at each batch's place in the
+// buffer before it is drawn.
+//
+// Where the context has glMultiDrawElementsIndirect (GL 4.3, or
+// GL_ARB_multi_draw_indirect), DrawBatches instead writes one indirect
+// command per batch (per index range), whose base instance is the
+// batch's place in the instance buffer, and draws all the batches it
+// is given with one call per index type.  The instance buffer is then
+// the per-draw data, read through the attributes, so the GLSL 330
+// shaders are unchanged.  The render queue hands it each run of
+// batches sharing a VAO and vertex decoding, which for the G-buffer
+// pass is nearly the whole scene.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _INSTANCING
+#define _INSTANCING
+
+#include <vector>
+#include <map>
+
+#include "shapes.h"
+
+class Object;
+class ShaderProgram;
+
+const int ibFirstAttribute = 4;     // Location of the first instance attribute
+const int ibInitialInstances = 256; // Instances the buffer first holds
+
+// One instance's attributes, as laid out in the instance buffer
+struct InstanceData
+{
+    glm::mat4 modelTr;          // instanceTr
+    glm::mat3 normalTr;         // instanceNormalTr:  inverse of modelTr's 3x3
+    glm::vec3 diffuse;          // instanceDiffuse
+    glm::vec4 specular;         // instanceSpecular:  specular color and shininess
+    glm::vec4 light;            // instanceLight:  a local light's position and range
+};
+
+// Bind the instance attributes' names to their locations.  Call before
+// linking a program that is drawn with an InstanceBatcher.
+void BindInstanceAttributes(const int programId);
+
+// Whether the context has glMultiDrawElementsIndirect with base
+// instances (checked once, with a context current)
+bool MultiDrawIndirectSupported();
+
+// A glMultiDrawElementsIndirect command, as laid out in the buffer
+struct DrawCommand
+{
+    unsigned int count, instanceCount, firstIndex;
+    int baseVertex;
+    unsigned int baseInstance;
+};
+
+class InstanceBatcher
+{
+    struct Batch
+    {
+        Shape* shape;
+        std::vector<InstanceData> instances;
+        std::vector<float> depths;      // View depth of each instance
+        std::vector<int> order;         // Instances sorted nearest first
+        int first;                      // Index of the first instance in the buffer
+    };
+    std::vector<Batch> batches;
+    std::map<Shape*,int> batchOf;       // Index in batches of each shape's batch
+
+    unsigned int buffer;
+    size_t bufferSize;                  // In bytes
+
+    unsigned int indirectBuffer;
+    std::vector<DrawCommand> commands;
+
+public:
+    // Draw runs of batches with glMultiDrawElementsIndirect, if supported
+    bool multiDraw;
+
+    // Statistics of the last Upload, and the multi-draw calls since
+    int drawCount, instanceCount, multiDrawCount;
+
+    InstanceBatcher();
+
+    // Empty every batch
+    void Clear();
+
+    // Queue an object's shape to be drawn with a transformation (and
+    // the inverse of its 3x3), at a depth along the view direction
+    void Add(const Object* obj, const glm::mat4& objectTr, const glm::mat3& normalTr,
+             const float depth=0.0f);
+
+    // Write all the queued instances to the instance buffer
+    void Upload();
+
+    int BatchCount() const { return (int)batches.size(); }
+    Shape* BatchShape(const int b) const { return batches[b].shape; }
+    int BatchSize(const int b) const { return (int)batches[b].instances.size(); }
+    float BatchDepth(const int b) const;  // Depth of the nearest instance
+
+    // Draw an uploaded batch, with a program whose instance attributes
+    // are bound
+    void DrawBatch(ShaderProgram* program, const int b);
+
+    // Draw uploaded batches, all of one VAO and vertex decoding.  Only
+    // instance batches go through MDI;  RenderQueue::Submit draws
+    // single nodes with a DrawShape call each.
+    void DrawBatches(ShaderProgram* program, const std::vector<int>& list);
+};
+
+#endif
@@ -0,0 +1,266 @@
+////////////////////////////////////////////////////////////////////////
+// Triangle and vertex reordering for the GPU's caches.  See meshopt.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <algorithm>
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "meshopt.h"
+
+// A FIFO cache holds a vertex if fewer than moCacheSize others have
+// been transformed since it was.
+void MeshCacheStats(const std::vector<glm::ivec3>& Tri, float& acmr, float& atvr)
+{
+    int vertexCount = 0;
+    for (int t=0;  t<Tri.size();  t++)
+        for (int c=0;  c<3;  c++)
+            vertexCount = std::max(vertexCount, Tri[t][c]+1);
+
+    std::vector<int> stamp(vertexCount, -moCacheSize-1);
+    int misses = 0, used = 0;
+    for (int t=0;  t<Tri.size();  t++)
+        for (int c=0;  c<3;  c++) {
+            const int v = Tri[t][c];
+            if (stamp[v] < -moCacheSize)
+                used++;
+            if (misses - stamp[v] > moCacheSize-1) {
+                stamp[v] = misses;
+                misses++; } }
+
+    acmr = Tri.size() > 0 ? float(misses)/Tri.size() : 0.0f;
+    atvr = used > 0 ? float(misses)/used : 0.0f;
+}
+
+std::vector<MeshCacheReport>& CacheReports()
+{
+    static std::vector<MeshCacheReport> reports;
+    return reports;
+}
+
+// Tipsify's triangle order, and where each cluster in it begins.  The
+// time stamps count vertices entering the cache, so a vertex is still
+// cached if stamp-time[v] <= moCacheSize.
+static void Tipsify(const std::vector<glm::ivec3>& Tri, const int vertexCount,
+                    std::vector<int>& order, std::vector<int>& clusters)
+{
+    const int n = (int)Tri.size();
+
+    // The triangles around each vertex, and how many are not yet drawn
+    std::vector<int> first(vertexCount+1, 0), around(3*n);
+    for (int t=0;  t<n;  t++)
+        for (int c=0;  c<3;  c++)
+            first[Tri[t][c]+1]++;
+    for (int v=0;  v<vertexCount;  v++)
+        first[v+1] += first[v];
+    std::vector<int> live(vertexCount), fill(first.begin(), first.end()-1);
+    for (int t=0;  t<n;  t++)
+        for (int c=0;  c<3;  c++)
+            around[fill[Tri[t][c]]++] = t;
+    for (int v=0;  v<vertexCount;  v++)
+        live[v] = first[v+1] - first[v];
+
+    std::vector<int> time(vertexCount, 0);
+    std::vector<bool> emitted(n, false);
+    std::vector<int> deadEnd, candidates;
+    int stamp = moCacheSize+1;
+    int scan = 0;
+
+    order.clear();
+    clusters.assign(1, 0);
+    int fan = 0;
+    while (fan < vertexCount && live[fan] == 0)
+        fan++;
+    while (fan >= 0 && fan < vertexCount) {
+        // Draw the remaining triangles around the fanning vertex
+        candidates.clear();
+        for (int k=first[fan];  k<first[fan+1];  k++) {
+            const int t = around[k];
+            if (emitted[t])
+                continue;
+            emitted[t] = true;
+            order.push_back(t);
+            for (int c=0;  c<3;  c++) {
+                const int v = Tri[t][c];
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (stamp - time[v] > moCacheSize)
+                    time[v] = stamp++; } }
+
+        // The next fanning vertex is the one just used that is oldest
+        // in the cache and still will be after its remaining triangles
+        int next = -1, best = -1;
+        for (int i=0;  i<candidates.size();  i++) {
+            const int v = candidates[i];
+            if (live[v] == 0)
+                continue;
+            int priority = 0;
+            if (stamp - time[v] + 2*live[v] <= moCacheSize)
+                priority = stamp - time[v];
+            if (priority > best) {
+                best = priority;
+                next = v; } }
+
+        // At a dead end, back up to a recent vertex with triangles
+        // left, or else to the first such vertex.  Either starts a new
+        // cluster, if the current one is big enough.
+        if (next < 0) {
+            while (next < 0 && !deadEnd.empty()) {
+                if (live[deadEnd.back()] > 0)
+                    next = deadEnd.back();
+                deadEnd.pop_back(); }
+            while (next < 0 && scan < vertexCount) {
+                if (live[scan] > 0)
+                    next = scan;
+                scan++; }
+            if ((int)order.size() - clusters.back() >= moMinCluster)
+                clusters.push_back((int)order.size()); }
+        fan = next; }
+
+    if (clusters.back() == (int)order.size())
+        clusters.pop_back();
+}
+
+// Sort the clusters so those facing away from the center of all of
+// them are drawn first:  by the distance of a cluster's center out
+// from that center, along the cluster's average normal.  The vertex
+// normals are used if there are any, as they say which side is the
+// outside.  The order holds triangles numbered from first.
+static void SortClusters(const std::vector<glm::vec4>& Pnt, const std::vector<glm::vec3>& Nrm,
+                         const std::vector<glm::ivec3>& Tri,
+                         std::vector<int>& order, const std::vector<int>& clusters, const int first)
+{
+    const int nc = (int)clusters.size();
+    std::vector<glm::vec3> center(nc, glm::vec3(0.0)), normal(nc, glm::vec3(0.0));
+    std::vector<float> area(nc, 0.0f);
+    glm::vec3 meshCenter(0.0);
+    float meshArea = 0.0f;
+    for (int k=0;  k<nc;  k++) {
+        const int end = k+1 < nc ? clusters[k+1] : (int)order.size();
+        for (int i=clusters[k];  i<end;  i++) {
+            const glm::ivec3& tri = Tri[first + order[i]];
+            const glm::vec3 a = Pnt[tri[0]].xyz(), b = Pnt[tri[1]].xyz(), c = Pnt[tri[2]].xyz();
+            const glm::vec3 cross = glm::cross(b-a, c-a);
+            const float A = 0.5f*glm::length(cross);
+            center[k] += A*(a+b+c)/3.0f;
+            area[k] += A;
+            if (Nrm.size() > 0)
+                normal[k] += A*(Nrm[tri[0]] + Nrm[tri[1]] + Nrm[tri[2]]);
+            else
+                normal[k] += cross; }
+        meshCenter += center[k];
+        meshArea += area[k];
+        if (area[k] > 0.0f)
+            center[k] /= area[k]; }
+    if (meshArea > 0.0f)
+        meshCenter /= meshArea;
+
+    std::vector<float> key(nc, 0.0f);
+    std::vector<int> sorted(nc);
+    for (int k=0;  k<nc;  k++) {
+        const float l = glm::length(normal[k]);
+        if (l > 0.0f)
+            key[k] = glm::dot(center[k]-meshCenter, normal[k]/l);
+        sorted[k] = k; }
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [&](const int a, const int b) { return key[a] > key[b]; });
+
+    std::vector<int> reordered;
+    reordered.reserve(order.size());
+    for (int s=0;  s<nc;  s++) {
+        const int k = sorted[s];
+        const int end = k+1 < nc ? clusters[k+1] : (int)order.size();
+        reordered.insert(reordered.end(), order.begin()+clusters[k], order.begin()+end); }
+    order.swap(reordered);
+}
+
+template<class T> static void Permute(std::vector<T>& a, const std::vector<int>& remap)
+{
+    if (a.size() != remap.size())
+        return;
+    std::vector<T> b(a.size());
+    for (int v=0;  v<a.size();  v++)
+        b[remap[v]] = a[v];
+    a.swap(b);
+}
+
+void OptimizeMesh(std::vector<glm::vec4>& Pnt,
+                  std::vector<glm::vec3>& Nrm,
+                  std::vector<glm::vec2>& Tex,
+                  std::vector<glm::vec3>& Tan,
+                  std::vector<glm::ivec3>& Tri,
+                  const bool overdraw)
+{
+    if (Tri.empty())
+        return;
+    const int vertexCount = (int)Pnt.size();
+
+    // Reorder the triangles a batch at a time, each batch a run (in
+    // the original order) whose vertices span fewer than
+    // moBatchVertices.  The vertices each batch uses first are then
+    // numbered together, so a triangle reaches back at most into the
+    // previous batch's vertices, and the mesh still splits into 16 bit
+    // index ranges.
+    std::vector<int> order;
+    std::vector<glm::ivec3> local;
+    std::vector<int> localOrder, clusters;
+    int begin = 0;
+    while (begin < Tri.size()) {
+        int lo = Tri[begin][0], hi = lo, end = begin;
+        for ( ;  end < Tri.size();  end++) {
+            const int tlo = std::min(lo, std::min(Tri[end][0], std::min(Tri[end][1], Tri[end][2])));
+            const int thi = std::max(hi, std::max(Tri[end][0], std::max(Tri[end][1], Tri[end][2])));
+            if (end > begin && thi-tlo >= moBatchVertices)
+                break;
+            lo = tlo;
+            hi = thi; }
+
+        local.resize(end-begin);
+        for (int t=begin;  t<end;  t++)
+            local[t-begin] = Tri[t] - glm::ivec3(lo);
+        Tipsify(local, hi-lo+1, localOrder, clusters);
+        if (overdraw && clusters.size() > 1)
+            SortClusters(Pnt, Nrm, Tri, localOrder, clusters, begin);
+        for (int i=0;  i<localOrder.size();  i++)
+            order.push_back(begin + localOrder[i]);
+        begin = end; }
+
+    std::vector<glm::ivec3> reordered(Tri.size());
+    for (int i=0;  i<order.size();  i++)
+        reordered[i] = Tri[order[i]];
+    Tri.swap(reordered);
+
+    // Number the vertices in order of first use
+    std::vector<int> remap(vertexCount, -1);
+    int next = 0;
+    for (int t=0;  t<Tri.size();  t++)
+        for (int c=0;  c<3;  c++)
+            if (remap[Tri[t][c]] < 0)
+                remap[Tri[t][c]] = next++;
+    for (int v=0;  v<vertexCount;  v++)
+        if (remap[v] < 0)
+            remap[v] = next++;
+
+    for (int t=0;  t<Tri.size();  t++)
+        for (int c=0;  c<3;  c++)
+            Tri[t][c] = remap[Tri[t][c]];
+    Permute(Pnt, remap);
+    Permute(Nrm, remap);
+    Permute(Tex, remap);
+    Permute(Tan, remap);
+}
+
+void OptimizeTriangles(std::vector<glm::ivec3>& Tri, const int vertexCount)
+{
+    std::vector<int> order, clusters;
+    Tipsify(Tri, vertexCount, order, clusters);
+
+    std::vector<glm::ivec3> reordered(Tri.size());
+    for (int i=0;  i<order.size();  i++)
+        reordered[i] = Tri[order[i]];
+    Tri.swap(reordered);
+}
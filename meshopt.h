@@ -0,0 +1,58 @@
+////////////////////////////////////////////////////////////////////////
+// Triangle and vertex reordering for the GPU's caches, applied to
+// every Shape by MakeVAO, and (triangles only) to the terrain chunks'
+// shared index lists.
+//
+// Triangles are reordered with Tipsify (Sander, Nehab and Barczak,
+// "Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw", 2007):  it fans around one vertex at a time, choosing the
+// next vertex among those just used that will still be in the
+// post-transform cache.  Where it has to jump (a dead end), a new
+// cluster begins, and the clusters may then be sorted so that those
+// facing out from the mesh's center are drawn first, which reduces
+// overdraw from any view.  Finally the vertices are renumbered in the
+// order the triangles first use them, for locality of vertex fetch.
+//
+// The results are measured by the average cache miss ratio (ACMR,
+// vertices transformed per triangle) and the average transform to
+// vertex ratio (ATVR, vertices transformed per vertex) of a FIFO
+// cache of moCacheSize entries.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _MESHOPT
+#define _MESHOPT
+
+#include <string>
+#include <vector>
+
+const int moCacheSize = 16;     // Post-transform cache entries assumed
+const int moMinCluster = 64;    // Fewest triangles in a cluster sorted for overdraw
+const int moBatchVertices = 32768;  // Widest span of vertices reordered together
+
+// ACMR and ATVR of drawing the triangles in order
+void MeshCacheStats(const std::vector<glm::ivec3>& Tri, float& acmr, float& atvr);
+
+// Each reordered mesh's ACMR and ATVR before and after, for the menu
+struct MeshCacheReport
+{
+    std::string name;
+    int triangles;
+    float acmr[2], atvr[2];
+};
+std::vector<MeshCacheReport>& CacheReports();
+
+// Reorder the triangles for the vertex cache (and, if overdraw, their
+// clusters for overdraw), then the vertices in order of first use.
+// Nrm, Tex and Tan are permuted with Pnt if they are not empty.
+// Vertices no triangle uses are kept, at the end.
+void OptimizeMesh(std::vector<glm::vec4>& Pnt,
+                  std::vector<glm::vec3>& Nrm,
+                  std::vector<glm::vec2>& Tex,
+                  std::vector<glm::vec3>& Tan,
+                  std::vector<glm::ivec3>& Tri,
+                  const bool overdraw);
+
+// Reorder only the triangles, for index lists that share vertices
+void OptimizeTriangles(std::vector<glm::ivec3>& Tri, const int vertexCount);
+
+#endif
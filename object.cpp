@@ -6,7 +6,7 @@
 // in a hierarchical fashion under the control of parent's
 // transformations.
 //
-// Methods consist of a constructor, and a Draw procedure, and an
+// Methods consist of a constructor, a DrawShape procedure, and an
 // append for building hierarchies of objects.
 
 #include "math.h"
@@ -24,6 +24,7 @@ using namespace gl;
 #include "framework.h"
 #include "shapes.h"
 #include "transform.h"
+#include "ubo.h"
 
 #include <glu.h>                // For gluErrorString
 #define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line object.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
@@ -31,44 +32,47 @@ using namespace gl;
 Object::Object(Shape* _shape, const int _objectId,
                const glm::vec3 _diffuseColor, const glm::vec3 _specularColor, const float _shininess)
     : diffuseColor(_diffuseColor), specularColor(_specularColor), shininess(_shininess),
-      shape(_shape), objectId(_objectId), drawMe(true)
-     
+      shape(_shape), objectId(_objectId), drawMe(true), occluder(false), dirty(true), isLight(false)
+
 {}
 
-void Object::Draw(ShaderProgram* program, glm::mat4& objectTr)
+// @@ The object specific parameters used by the shader are collected
+// here, into the object's uniform block (ObjectBlock in ubo.h, and in
+// the shaders).  Scene specific parameters are set in the DrawScene
+// procedure in scene.cpp, and in its FrameBlock.
+void Object::Block(ObjectBlock& block, const glm::mat4& objectTr, const glm::mat3& normalTr) const
 {
-    CHECKERROR;
-    // @@ The object specific parameters (uniform variables) used by
-    // the shader are set here.  Scene specific parameters are set in
-    // the DrawScene procedure in scene.cpp
+    // This object's model transformation, and the inverse of its 3x3,
+    // needed for transforming normals (computed by
+    // FlatHierarchy::Update).  In std140, a mat3's columns are padded
+    // to vec4s.
+    block.ModelTr = objectTr;
+    for (int c=0;  c<3;  c++)
+        block.NormalTr[c] = glm::vec4(normalTr[c], 0.0f);
+
+    // The surface values Kd, Ks, and alpha
+    block.diffuse = diffuseColor;
+    block.specular = specularColor;
+    block.shininess = shininess;
+
+    // Which object is being drawn, so the shader can make object
+    // specific decisions
+    block.objectId = objectId;
+}
 
+void Object::DrawShape(ShaderProgram* program)
+{
+    CHECKERROR;
     // @@ Textures, being uniform sampler2d variables in the shader,
-    // are also set here.  Call texture->Bind in texture.cpp to do so.
-    
-    // Inform the shader of the surface values Kd, Ks, and alpha.
-    int loc = glGetUniformLocation(program->programId, "diffuse");
-    glUniform3fv(loc, 1, &diffuseColor[0]);
-
-    loc = glGetUniformLocation(program->programId, "specular");
-    glUniform3fv(loc, 1, &specularColor[0]);
+    // are set here.  Call texture->Bind in texture.cpp to do so.
 
-    loc = glGetUniformLocation(program->programId, "shininess");
-    glUniform1f(loc, shininess);
-
-    // Inform the shader of which object is being drawn so it can make
-    // object specific decisions.
-    loc = glGetUniformLocation(program->programId, "objectId");
-    glUniform1i(loc, objectId);
-
-    // Inform the shader of this object's model transformation.  The
-    // inverse of the model transformation, needed for transforming
-    // normals, is calculated and passed to the shader here.
-    loc = glGetUniformLocation(program->programId, "ModelTr");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(objectTr));
-    
-    glm::mat4 inv = glm::inverse(objectTr);
-    loc = glGetUniformLocation(program->programId, "NormalTr");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(inv));
+    // How the shape's vertices are to be decoded (see VertexFormat).
+    // (Values unchanged since the last object are not sent again.)
+    if (shape) {
+        program->Set(shInstanced, false);
+        program->Set(shPackedVertices, shape->format != vfFloat);
+        program->Set(shPosOffset, shape->posOffset);
+        program->Set(shPosScale, shape->posScale); }
 
     // If this object has an associated texture, this is the place to
     // load the texture into a texture-unit of your choice and inform
@@ -77,16 +81,11 @@ void Object::Draw(ShaderProgram* program, glm::mat4& objectTr)
 
     // Uniforms for local lights
     if (isLight) {
-        loc = glGetUniformLocation(program->programId, "isLight");
-        glUniform1i(loc, isLight);
-        loc = glGetUniformLocation(program->programId, "lightPos");
-        glUniform3fv(loc, 1, &(position[0]));
-        loc = glGetUniformLocation(program->programId, "lightVal");
-        glUniform3fv(loc, 1, &(diffuseColor[0]));
-        loc = glGetUniformLocation(program->programId, "lightAmb");
-        glUniform3fv(loc, 1, &(specularColor[0]));
-        loc = glGetUniformLocation(program->programId, "lightRange");
-        glUniform1f(loc, range);
+        program->Set(shIsLight, isLight);
+        program->Set(shLightPos, position);
+        program->Set(shLightVal, diffuseColor);
+        program->Set(shLightAmb, specularColor);
+        program->Set(shLightRange, range);
     }
 
     // Draw this object
@@ -95,17 +94,4 @@ void Object::Draw(ShaderProgram* program, glm::mat4& objectTr)
         if (drawMe) 
             shape->DrawVAO();
     CHECKERROR;
-
-
-    CHECKERROR;
-    // Recursively draw each sub-objects, each with its own transformation.
-    if (drawMe)
-        for (int i=0;  i<instances.size();  i++) {
-            CHECKERROR;
-            glm::mat4 itr = objectTr*instances[i].second*animTr;
-            CHECKERROR;
-            instances[i].first->Draw(program, itr);
-            CHECKERROR; }
-    
-    CHECKERROR;
 }
@@ -6,8 +6,10 @@
 // in a hierarchical fashion under the control of parent's
 // transformations.
 //
-// Methods consist of a constructor, and a Draw procedure, and an
-// append for building hierarchies of objects.
+// Methods consist of a constructor, a DrawShape procedure, and an
+// append for building hierarchies of objects.  Hierarchies are drawn
+// through a FlatHierarchy (hierarchy.h), which keeps their world
+// transformations.
 
 #ifndef _OBJECT
 #define _OBJECT
@@ -18,6 +20,7 @@
 
 class Shader;
 class Object;
+struct ObjectBlock;
 
 typedef std::pair<Object*,glm::mat4> INSTANCE;
 
@@ -26,9 +29,11 @@ class Object
 {
  public:
     Shape* shape;               // Polygons 
-    glm::mat4 animTr;                // This model's animation transformation
+    glm::mat4 animTr;                // This model's animation transformation (set with SetAnimTr)
     int objectId;               // Object id to be sent to the shader
     bool drawMe;                // Toggle specifies if this object (and children) are drawn.
+    bool occluder;              // Rasterized into the occlusion culler's depth buffer
+    bool dirty;                 // animTr or instances changed since the FlatHierarchy's Update
 
     bool isLight;
     glm::vec3 position;
@@ -46,11 +51,17 @@ class Object
     // If this object is to be drawn with a texture, this is a good
     // place to store the texture id (a small positive integer).  The
     // texture id should be set in Scene::InitializeScene and used in
-    // Object::Draw.
+    // Object::DrawShape.
     
-    void Draw(ShaderProgram* program, glm::mat4& objectTr);
+    // Fill in the object's uniform block (see ubo.h) for a model
+    // transformation and the inverse of its 3x3, for normals
+    void Block(ObjectBlock& block, const glm::mat4& objectTr, const glm::mat3& normalTr) const;
+
+    // Draw the shape, with the object's block already bound
+    void DrawShape(ShaderProgram* program);
 
-    void add(Object* m, glm::mat4 tr=glm::mat4()) { instances.push_back(std::make_pair(m,tr)); }
+    void SetAnimTr(const glm::mat4& tr) { animTr = tr;  dirty = true; }
+    void add(Object* m, glm::mat4 tr=glm::mat4()) { instances.push_back(std::make_pair(m,tr));  dirty = true; }
 };
 
 #endif
@@ -0,0 +1,290 @@
+////////////////////////////////////////////////////////////////////////
+// Hierarchical-Z occlusion culling for FlatHierarchy::Collect.  See occlusion.h.
+//
+// The occluders are rasterized conservatively:  a pixel is written
+// only if its triangle covers all of it, with the farthest depth the
+// triangle reaches within the pixel, so an occluder never hides
+// something it does not cover at full resolution.  Triangles crossing the near plane are
+// left out of the depth buffer, and boxes crossing it are never
+// culled, so no clipping is needed.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <algorithm>
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "framework.h"
+#include "object.h"
+#include "occlusion.h"
+#include "hierarchy.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OC_SSE
+#include <emmintrin.h>
+#endif
+
+// Transform points by a matrix;  SSE does one point per instruction.
+static void TransformPoints(const glm::mat4& m, const glm::vec4* in, glm::vec4* out, const int n)
+{
+#ifdef OC_SSE
+    const __m128 c0 = _mm_loadu_ps(&m[0][0]), c1 = _mm_loadu_ps(&m[1][0]);
+    const __m128 c2 = _mm_loadu_ps(&m[2][0]), c3 = _mm_loadu_ps(&m[3][0]);
+    for (int i=0;  i<n;  i++) {
+        const __m128 x = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(in[i].x)), _mm_mul_ps(c1, _mm_set1_ps(in[i].y)));
+        const __m128 y = _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(in[i].z)), _mm_mul_ps(c3, _mm_set1_ps(in[i].w)));
+        _mm_storeu_ps(&out[i][0], _mm_add_ps(x, y)); }
+#else
+    for (int i=0;  i<n;  i++)
+        out[i] = m*in[i];
+#endif
+}
+
+OcclusionCuller::OcclusionCuller()
+    : pending(false), quit(false), visit(0), testedCount(0), culledCount(0)
+{
+    for (int l=0;  l<ocLevels;  l++)
+        hiz[l].resize((ocWidth>>l)*(ocHeight>>l));
+    thread = std::thread(&OcclusionCuller::Thread, this);
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true; }
+    wake.notify_all();
+    thread.join();
+}
+
+////////////////////////////////////////////////////////////////////////
+// Record the objects, with their world transformations, in the same
+// order as FlatHierarchy::Collect visits them.
+void OcclusionCuller::Gather(const FlatHierarchy& hierarchy)
+{
+    int n = 0;
+    while (n < hierarchy.NodeCount()) {
+        const Object* obj = hierarchy.NodeObject(n);
+        OcInstance inst;
+        inst.object = obj;
+        inst.shape = obj->drawMe && obj->shape && obj->shape->Tri.size() > 0 ? obj->shape : NULL;
+        inst.modelTr = hierarchy.WorldTr(n);
+        inst.occluder = obj->occluder;
+        inst.visible = true;
+        work.push_back(inst);
+
+        n = obj->drawMe ? n+1 : hierarchy.SubtreeEnd(n); }
+}
+
+void OcclusionCuller::Start(Scene& scene)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return !pending; }); }
+
+    // The thread is idle, so its inputs can be replaced without locking.
+    work.clear();
+    Gather(*scene.objectNodes);
+    viewProj = scene.WorldProj*scene.WorldView;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = true; }
+    wake.notify_all();
+}
+
+void OcclusionCuller::Finish()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return !pending; });
+
+    // Results are only good for the frame after the one they were
+    // computed for;  without a fresh set, nothing is culled.
+    current.swap(work);
+    work.clear();
+    visit = 0;
+
+    testedCount = culledCount = 0;
+    for (int i=0;  i<current.size();  i++)
+        if (current[i].shape) {
+            testedCount++;
+            if (!current[i].visible)
+                culledCount++; }
+}
+
+bool OcclusionCuller::Visible(const Object* obj)
+{
+    const int i = visit++;
+    if (i >= current.size() || current[i].object != obj)
+        return true;
+    return current[i].visible;
+}
+
+void OcclusionCuller::Thread()
+{
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return quit || pending; });
+            if (quit) return; }
+
+        std::fill(hiz[0].begin(), hiz[0].end(), 1.0f);
+        for (int i=0;  i<work.size();  i++)
+            if (work[i].shape && work[i].occluder)
+                Rasterize(work[i]);
+        BuildLevels();
+
+        for (int i=0;  i<work.size();  i++)
+            if (work[i].shape)
+                work[i].visible = Test(work[i]);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = false;
+        done.notify_all(); }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Rasterize an occluder into level 0, keeping the nearest depth.
+void OcclusionCuller::Rasterize(const OcInstance& inst)
+{
+    const Shape* shape = inst.shape;
+    clip.resize(shape->Pnt.size());
+    TransformPoints(viewProj*inst.modelTr, &shape->Pnt[0], &clip[0], (int)clip.size());
+
+    std::vector<float>& depth = hiz[0];
+    for (int t=0;  t<shape->Tri.size();  t++) {
+        const glm::vec4& a = clip[shape->Tri[t][0]];
+        const glm::vec4& b = clip[shape->Tri[t][1]];
+        const glm::vec4& c = clip[shape->Tri[t][2]];
+        if (a.z < -a.w || b.z < -b.w || c.z < -c.w)
+            continue;           // Crosses the near plane
+        if ((a.x > a.w && b.x > b.w && c.x > c.w) || (a.x < -a.w && b.x < -b.w && c.x < -c.w) ||
+            (a.y > a.w && b.y > b.w && c.y > c.w) || (a.y < -a.w && b.y < -b.w && c.y < -c.w))
+            continue;           // Off screen
+
+        glm::vec3 p[3];
+        const glm::vec4* v[3] = {&a, &b, &c};
+        for (int i=0;  i<3;  i++) {
+            const float iw = 1.0f/v[i]->w;
+            p[i] = glm::vec3((v[i]->x*iw*0.5f + 0.5f)*ocWidth,
+                             (v[i]->y*iw*0.5f + 0.5f)*ocHeight,
+                             v[i]->z*iw*0.5f + 0.5f); }
+
+        const float area = (p[1].x-p[0].x)*(p[2].y-p[0].y) - (p[2].x-p[0].x)*(p[1].y-p[0].y);
+        if (fabsf(area) < 1e-8f)
+            continue;
+
+        // Pixel centers inside the bounding box
+        const int minX = std::max(0, (int)ceilf(std::min(p[0].x, std::min(p[1].x, p[2].x)) - 0.5f));
+        const int maxX = std::min(ocWidth-1, (int)floorf(std::max(p[0].x, std::max(p[1].x, p[2].x)) - 0.5f));
+        const int minY = std::max(0, (int)ceilf(std::min(p[0].y, std::min(p[1].y, p[2].y)) - 0.5f));
+        const int maxY = std::min(ocHeight-1, (int)floorf(std::max(p[0].y, std::max(p[1].y, p[2].y)) - 0.5f));
+        if (minX > maxX || minY > maxY)
+            continue;
+
+        // Edge functions, positive inside for either winding, each
+        // moved in by half a pixel so that at a pixel's center it is
+        // its value at the pixel's worst corner.  Then the depth plane
+        // plus its largest change within half a pixel.
+        const float s = area > 0.0f ? 1.0f : -1.0f;
+        float A[3], B[3], C[3];
+        for (int i=0;  i<3;  i++) {
+            const glm::vec3& p0 = p[(i+1)%3];
+            const glm::vec3& p1 = p[(i+2)%3];
+            A[i] = s*(p0.y - p1.y);
+            B[i] = s*(p1.x - p0.x);
+            C[i] = s*(p0.x*p1.y - p0.y*p1.x) - 0.5f*(fabsf(A[i]) + fabsf(B[i])); }
+        const float dzdx = ((p[1].z-p[0].z)*(p[2].y-p[0].y) - (p[2].z-p[0].z)*(p[1].y-p[0].y))/area;
+        const float dzdy = ((p[2].z-p[0].z)*(p[1].x-p[0].x) - (p[1].z-p[0].z)*(p[2].x-p[0].x))/area;
+        const float slope = 0.5f*(fabsf(dzdx) + fabsf(dzdy));
+        const float maxZ = std::max(p[0].z, std::max(p[1].z, p[2].z));
+
+        for (int y=minY;  y<=maxY;  y++) {
+            const float py = y + 0.5f;
+            for (int x=minX;  x<=maxX;  x++) {
+                const float px = x + 0.5f;
+                if (A[0]*px + B[0]*py + C[0] < 0.0f || A[1]*px + B[1]*py + C[1] < 0.0f ||
+                    A[2]*px + B[2]*py + C[2] < 0.0f)
+                    continue;
+                const float z = std::min(maxZ, p[0].z + dzdx*(px-p[0].x) + dzdy*(py-p[0].y) + slope);
+                float& d = depth[y*ocWidth + x];
+                d = std::min(d, z); } } }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Reduce each level into the next, keeping the farthest depth.
+void OcclusionCuller::BuildLevels()
+{
+    for (int l=1;  l<ocLevels;  l++) {
+        const int w = ocWidth>>l, h = ocHeight>>l, sw = ocWidth>>(l-1);
+        const float* src = &hiz[l-1][0];
+        float* dst = &hiz[l][0];
+        for (int y=0;  y<h;  y++) {
+            const float* r0 = src + 2*y*sw;
+            const float* r1 = r0 + sw;
+            int x = 0;
+#ifdef OC_SSE
+            for (;  x+4<=w;  x+=4) {
+                const __m128 a = _mm_max_ps(_mm_loadu_ps(r0 + 2*x), _mm_loadu_ps(r1 + 2*x));
+                const __m128 b = _mm_max_ps(_mm_loadu_ps(r0 + 2*x + 4), _mm_loadu_ps(r1 + 2*x + 4));
+                const __m128 even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+                const __m128 odd = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+                _mm_storeu_ps(dst + y*w + x, _mm_max_ps(even, odd)); }
+#endif
+            for (;  x<w;  x++)
+                dst[y*w + x] = std::max(std::max(r0[2*x], r0[2*x+1]), std::max(r1[2*x], r1[2*x+1])); } }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Test an object's bounding box:  true if any part of it may be seen.
+bool OcclusionCuller::Test(const OcInstance& inst)
+{
+    const glm::vec3& lo = inst.shape->minP;
+    const glm::vec3& hi = inst.shape->maxP;
+    glm::vec4 corners[8], c[8];
+    for (int i=0;  i<8;  i++)
+        corners[i] = glm::vec4(i&1 ? hi.x : lo.x, i&2 ? hi.y : lo.y, i&4 ? hi.z : lo.z, 1.0f);
+    TransformPoints(viewProj*inst.modelTr, corners, c, 8);
+
+    float minX = 1e30f, maxX = -1e30f, minY = 1e30f, maxY = -1e30f, minZ = 1e30f;
+    for (int i=0;  i<8;  i++) {
+        if (c[i].z < -c[i].w || c[i].w <= 0.0f)
+            return true;        // Crosses the near plane
+        const float iw = 1.0f/c[i].w;
+        const float x = (c[i].x*iw*0.5f + 0.5f)*ocWidth;
+        const float y = (c[i].y*iw*0.5f + 0.5f)*ocHeight;
+        minX = std::min(minX, x);  maxX = std::max(maxX, x);
+        minY = std::min(minY, y);  maxY = std::max(maxY, y);
+        minZ = std::min(minZ, c[i].z*iw*0.5f + 0.5f); }
+
+    // Off screen objects are left to the GPU;  culling them on a frame
+    // old view would make them pop in at the screen edges.
+    if (maxX < 0.0f || minX >= ocWidth || maxY < 0.0f || minY >= ocHeight)
+        return true;
+    int x0 = std::max(0, (int)minX), x1 = std::min(ocWidth-1, (int)maxX);
+    int y0 = std::max(0, (int)minY), y1 = std::min(ocHeight-1, (int)maxY);
+
+    // The first level at which the rectangle is at most ocTestTexels wide
+    int l = 0;
+    while (l < ocLevels-1 && ((x1>>l) - (x0>>l) >= ocTestTexels || (y1>>l) - (y0>>l) >= ocTestTexels))
+        l++;
+    x0 >>= l;  x1 >>= l;  y0 >>= l;  y1 >>= l;
+
+    const int w = ocWidth>>l;
+    const float* level = &hiz[l][0];
+    for (int y=y0;  y<=y1;  y++) {
+        const float* row = level + y*w;
+        int x = x0;
+#ifdef OC_SSE
+        const __m128 z = _mm_set1_ps(minZ);
+        for (;  x+4<=x1+1;  x+=4)
+            if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), z)))
+                return true;
+#endif
+        for (;  x<=x1;  x++)
+            if (row[x] >= minZ)
+                return true; }
+    return false;
+}
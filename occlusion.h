@@ -0,0 +1,91 @@
+////////////////////////////////////////////////////////////////////////
+// Hierarchical-Z occlusion culling for FlatHierarchy::Collect.
+//
+// Large occluders (Objects with the occluder flag, such as the room
+// and the terrain) are rasterized into a small CPU depth buffer, which
+// is then reduced to a chain of levels, each texel holding the
+// farthest depth of the four below it.  Each drawn object's bounding
+// box (its Shape's minP/maxP, transformed) is tested against the level
+// at which its screen rectangle spans only a few texels:  if the box's
+// nearest depth is behind all of them, the object is hidden.
+//
+// The culling runs on a thread of its own, one frame ahead:  Start
+// takes a snapshot of the hierarchy and the frame's transformations
+// once the G-buffer pass is submitted, and the results are used by
+// the next frame's FlatHierarchy::Collect.  Objects are matched by
+// their order in the traversal, so a change to the hierarchy (such as
+// a drawMe toggle) only leaves the affected objects unculled for a
+// frame.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _OCCLUSION
+#define _OCCLUSION
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class Object;
+class Shape;
+class Scene;
+class FlatHierarchy;
+
+const int ocWidth = 256;        // Depth buffer resolution
+const int ocHeight = 128;
+const int ocLevels = 8;         // Levels down to 2x1
+const int ocTestTexels = 4;     // Widest rectangle tested, in texels of the chosen level
+
+// One object visited by FlatHierarchy::Collect
+struct OcInstance
+{
+    const Object* object;
+    const Shape* shape;         // NULL if nothing is drawn (no shape, or drawMe off)
+    glm::mat4 modelTr;
+    bool occluder;
+    bool visible;
+};
+
+class OcclusionCuller
+{
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    bool pending, quit;
+
+    // The frame being culled by the thread
+    std::vector<OcInstance> work;
+    glm::mat4 viewProj;
+    std::vector<float> hiz[ocLevels];
+    std::vector<glm::vec4> clip;
+
+    // Results in use by Visible
+    std::vector<OcInstance> current;
+    int visit;
+
+    void Thread();
+    void Gather(const FlatHierarchy& hierarchy);
+    void Rasterize(const OcInstance& inst);
+    void BuildLevels();
+    bool Test(const OcInstance& inst);
+
+public:
+    // Statistics of the results in use
+    int testedCount, culledCount;
+
+    OcclusionCuller();
+    ~OcclusionCuller();
+
+    // Snapshot the scene's object hierarchy and transformations, and
+    // start culling them on the thread.
+    void Start(Scene& scene);
+
+    // Wait for the culling begun by Start (if any), and make its
+    // results the ones used by Visible for the coming traversal.
+    void Finish();
+
+    // Called by FlatHierarchy::Collect for every object, in order.
+    bool Visible(const Object* obj);
+};
+
+#endif
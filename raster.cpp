@@ -0,0 +1,585 @@
+////////////////////////////////////////////////////////////////////////
+// The inner loops of the software pipeline (emulator.cpp):  edge
+// function coverage and perspective correct interpolation, in scalar,
+// SSE2 and AVX2 versions.  See raster.h.
+//
+// The scalar versions are the reference.  The integer arithmetic of
+// CoverRow wraps identically in all versions (it is done unsigned in
+// the scalar code), and the float arithmetic of InterpolateBlock is
+// done in the same order, with no fused multiply-adds.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdio.h>
+#include <string.h>
+
+#include "raster.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define EM_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// MSVC allows AVX2 intrinsics anywhere;  GCC and clang need the
+// function to be marked for that instruction set.
+#if defined(EM_X86) && defined(__GNUC__)
+#define EM_TARGET_AVX2 __attribute__((target("avx2")))
+#define EM_TARGET_SSE2 __attribute__((target("sse2")))
+#else
+#define EM_TARGET_AVX2
+#define EM_TARGET_SSE2
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// Scalar reference versions
+
+static unsigned long long CoverRowScalar(const int* e, const int* step, const int n)
+{
+    unsigned long long mask = 0;
+    for (int x=0;  x<n;  x++) {
+        unsigned int e0 = (unsigned int)e[0] + (unsigned int)x*(unsigned int)step[0];
+        unsigned int e1 = (unsigned int)e[1] + (unsigned int)x*(unsigned int)step[1];
+        unsigned int e2 = (unsigned int)e[2] + (unsigned int)x*(unsigned int)step[2];
+        if ((int)(e0 | e1 | e2) >= 0)
+            mask |= 1ull << x; }
+    return mask;
+}
+
+static void InterpolateBlockScalar(const EmSetup& s, const float b1, const float b2, EmBlockValues& out)
+{
+    for (int l=0;  l<emBlock;  l++) {
+        float c1 = b1 + (float)l*s.db1dx;
+        float c2 = b2 + (float)l*s.db2dx;
+        out.z[l] = s.z0 + c1*s.dz1 + c2*s.dz2;
+        float r = 1.0f/(s.w0 + c1*s.dw1 + c2*s.dw2);
+        for (int k=0;  k<emVaryings;  k++)
+            out.var[k][l] = (s.a0[k] + c1*s.da1[k] + c2*s.da2[k])*r; }
+}
+
+
+// The lighting's constants.  pow(x,a) is exp2(a*log2(x)):  log2 of
+// the mantissa m is the series 2/ln2*(t + t^3/3 + ...) in
+// t = (m-1)/(m+1), and exp2 of the fraction f is the Taylor series
+// of e^(f ln2), each to within about 1e-6.
+static const float PI = 3.14159f;
+static const float lnC1 = 2.8853901f, lnC3 = 0.9617967f, lnC5 = 0.5770780f,
+                   lnC7 = 0.4121986f, lnC9 = 0.3205989f;
+static const float exC1 = 0.6931472f, exC2 = 0.2402265f, exC3 = 0.05550411f,
+                   exC4 = 0.009618129f, exC5 = 0.001333356f, exC6 = 0.0001540353f,
+                   exC7 = 0.00001525273f;
+
+// log2 of x >= 0 (of 0, -127)
+static inline float Log2Scalar(const float x)
+{
+    unsigned int bits;
+    memcpy(&bits, &x, sizeof(bits));
+    bits &= 0x7FFFFFFF;
+    const float e = (float)((int)(bits >> 23) - 127);
+    bits = (bits & 0x007FFFFF) | 0x3F800000;
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+    const float t = (m - 1.0f)/(m + 1.0f);
+    const float t2 = t*t;
+    return e + ((((lnC9*t2 + lnC7)*t2 + lnC5)*t2 + lnC3)*t2 + lnC1)*t;
+}
+
+// 2^y, for y down to -126
+static inline float Exp2Scalar(float y)
+{
+    y = y > -126.0f ? y : -126.0f;
+    int n = (int)y;
+    float nf = (float)n;
+    if (nf > y) {
+        n -= 1;
+        nf -= 1.0f; }
+    const float f = y - nf;
+    const float p = ((((((exC7*f + exC6)*f + exC5)*f + exC4)*f + exC3)*f + exC2)*f + exC1)*f + 1.0f;
+    const unsigned int bits = (unsigned int)(n + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return p*scale;
+}
+
+// The G term of BRDF.frag, for the cosine of L or V with N.  Note the
+// operator precedence of the shader's rational approximation is kept.
+static inline float GTermScalar(const float alpha, const float c)
+{
+    const float a = sqrtf(alpha*0.5f + 1.0f)/(sqrtf(1.0f - c*c)/c);
+    const float poly = 3.535f*a + 2.181f*a*a/(1.0f + 2.276f*a + 2.577f*a*a);
+    const float G = a != 0.0f && a < 1.6f ? poly : 1.0f;
+    return 1.0f < G ? 1.0f : G;
+}
+
+// The other versions follow this one operation for operation, with
+// masks for its conditions (written here as the SIMD min and max
+// instructions choose).
+static void LightBlockScalar(const EmGBufferBlock& g, const EmLightValues& light,
+                             const unsigned int lanes, float out[3][emBlock])
+{
+    const float range2 = light.range*light.range;
+    for (int l=0;  l<emBlock;  l++) {
+        const float px = g.pos[0][l], py = g.pos[1][l], pz = g.pos[2][l];
+
+        float Lx = light.pos[0] - px, Ly = light.pos[1] - py, Lz = light.pos[2] - pz;
+        const float dist = sqrtf(Lx*Lx + Ly*Ly + Lz*Lz);
+        Lx /= dist;  Ly /= dist;  Lz /= dist;
+
+        float Vx = light.eye[0] - px, Vy = light.eye[1] - py, Vz = light.eye[2] - pz;
+        const float vlen = sqrtf(Vx*Vx + Vy*Vy + Vz*Vz);
+        Vx /= vlen;  Vy /= vlen;  Vz /= vlen;
+
+        float Hx = Lx + Vx, Hy = Ly + Vy, Hz = Lz + Vz;
+        const float hlen = sqrtf(Hx*Hx + Hy*Hy + Hz*Hz);
+        Hx /= hlen;  Hy /= hlen;  Hz /= hlen;
+
+        float Nx = g.nrm[0][l], Ny = g.nrm[1][l], Nz = g.nrm[2][l];
+        const float nlen = sqrtf(Nx*Nx + Ny*Ny + Nz*Nz);
+        Nx /= nlen;  Ny /= nlen;  Nz /= nlen;
+
+        const bool attenuated = light.local && dist <= light.range && dist > 0.001f;
+        const float attenuation = attenuated ? 1.0f/(dist*dist) - 1.0f/range2 : 1.0f;
+
+        float LdotN = Lx*Nx + Ly*Ny + Lz*Nz;
+        LdotN = 0.0f > LdotN ? 0.0f : LdotN;
+        float HdotN = Hx*Nx + Hy*Ny + Hz*Nz;
+        HdotN = 0.0f > HdotN ? 0.0f : HdotN;
+        const float VdotN = Vx*Nx + Vy*Ny + Vz*Nz;
+        const float t = 1.0f - (Lx*Hx + Ly*Hy + Lz*Hz);
+        const float fresnel = t*t*t*t*t;
+
+        const float alpha = g.alpha[l];
+        const float D = (alpha + 2.0f)/(2.0f*PI)*Exp2Scalar(alpha*Log2Scalar(HdotN));
+        const float GD = GTermScalar(alpha, LdotN)*GTermScalar(alpha, VdotN)*D;
+        const float denom = 4.0f*LdotN*VdotN;
+
+        // As LocalLights.frag, a local light lights only what is in range
+        const bool on = ((lanes >> l) & 1) && !(light.local && dist > light.range);
+        for (int c=0;  c<3;  c++) {
+            const float Kd = g.kd[c][l], Ks = g.ks[c][l];
+            const float F = Ks + (1.0f - Ks)*fresnel;
+            const float brdf = Kd/PI + F*GD/denom;
+            const float value = light.amb[c]*Kd + light.val[c]*attenuation*LdotN*brdf;
+            out[c][l] += on ? value : 0.0f; } }
+}
+
+#ifdef EM_X86
+
+////////////////////////////////////////////////////////////////////////
+// SSE2 versions:  two 4 wide halves per block.
+
+EM_TARGET_SSE2
+static unsigned long long CoverRowSSE2(const int* e, const int* step, const int n)
+{
+    __m128i v[3], s4[3];
+    for (int i=0;  i<3;  i++) {
+        unsigned int b = e[i], d = step[i];
+        v[i] = _mm_setr_epi32((int)b, (int)(b+d), (int)(b+2*d), (int)(b+3*d));
+        s4[i] = _mm_set1_epi32((int)(4*d)); }
+
+    unsigned long long mask = 0;
+    for (int x=0;  x<n;  x+=4) {
+        __m128i all = _mm_or_si128(_mm_or_si128(v[0], v[1]), v[2]);
+        unsigned int m = ~_mm_movemask_ps(_mm_castsi128_ps(all)) & 0xF;
+        mask |= (unsigned long long)m << x;
+        for (int i=0;  i<3;  i++)
+            v[i] = _mm_add_epi32(v[i], s4[i]); }
+
+    if (n < 64)
+        mask &= (1ull << n) - 1;
+    return mask;
+}
+
+EM_TARGET_SSE2
+static void InterpolateBlockSSE2(const EmSetup& s, const float b1, const float b2, EmBlockValues& out)
+{
+    for (int h=0;  h<emBlock;  h+=4) {
+        __m128 lane = _mm_setr_ps((float)h, (float)(h+1), (float)(h+2), (float)(h+3));
+        __m128 c1 = _mm_add_ps(_mm_set1_ps(b1), _mm_mul_ps(lane, _mm_set1_ps(s.db1dx)));
+        __m128 c2 = _mm_add_ps(_mm_set1_ps(b2), _mm_mul_ps(lane, _mm_set1_ps(s.db2dx)));
+
+        __m128 z = _mm_add_ps(_mm_add_ps(_mm_set1_ps(s.z0), _mm_mul_ps(c1, _mm_set1_ps(s.dz1))),
+                              _mm_mul_ps(c2, _mm_set1_ps(s.dz2)));
+        _mm_storeu_ps(&out.z[h], z);
+
+        __m128 w = _mm_add_ps(_mm_add_ps(_mm_set1_ps(s.w0), _mm_mul_ps(c1, _mm_set1_ps(s.dw1))),
+                              _mm_mul_ps(c2, _mm_set1_ps(s.dw2)));
+        __m128 r = _mm_div_ps(_mm_set1_ps(1.0f), w);
+
+        for (int k=0;  k<emVaryings;  k++) {
+            __m128 a = _mm_add_ps(_mm_add_ps(_mm_set1_ps(s.a0[k]), _mm_mul_ps(c1, _mm_set1_ps(s.da1[k]))),
+                                  _mm_mul_ps(c2, _mm_set1_ps(s.da2[k])));
+            _mm_storeu_ps(&out.var[k][h], _mm_mul_ps(a, r)); } }
+}
+
+// The lighting kernel's helpers, four lanes at a time
+EM_TARGET_SSE2
+static inline __m128 Select(const __m128 mask, const __m128 a, const __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+EM_TARGET_SSE2
+static inline __m128 Log2SSE2(const __m128 x)
+{
+    __m128i bits = _mm_and_si128(_mm_castps_si128(x), _mm_set1_epi32(0x7FFFFFFF));
+    const __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+    bits = _mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000));
+    const __m128 m = _mm_castsi128_ps(bits);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 t = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+    const __m128 t2 = _mm_mul_ps(t, t);
+    __m128 p = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(lnC9), t2), _mm_set1_ps(lnC7));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(lnC5));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(lnC3));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(lnC1));
+    return _mm_add_ps(e, _mm_mul_ps(p, t));
+}
+
+EM_TARGET_SSE2
+static inline __m128 Exp2SSE2(__m128 y)
+{
+    y = _mm_max_ps(y, _mm_set1_ps(-126.0f));
+    __m128i n = _mm_cvttps_epi32(y);
+    __m128 nf = _mm_cvtepi32_ps(n);
+    const __m128 over = _mm_cmpgt_ps(nf, y);
+    n = _mm_add_epi32(n, _mm_castps_si128(over));
+    nf = _mm_sub_ps(nf, _mm_and_ps(over, _mm_set1_ps(1.0f)));
+    const __m128 f = _mm_sub_ps(y, nf);
+    __m128 p = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(exC7), f), _mm_set1_ps(exC6));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(exC5));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(exC4));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(exC3));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(exC2));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(exC1));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+    const __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23));
+    return _mm_mul_ps(p, scale);
+}
+
+EM_TARGET_SSE2
+static inline __m128 GTermSSE2(const __m128 alpha, const __m128 c)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 a = _mm_div_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(alpha, _mm_set1_ps(0.5f)), one)),
+                                _mm_div_ps(_mm_sqrt_ps(_mm_sub_ps(one, _mm_mul_ps(c, c))), c));
+    const __m128 num = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(2.181f), a), a);
+    const __m128 den = _mm_add_ps(_mm_add_ps(one, _mm_mul_ps(_mm_set1_ps(2.276f), a)),
+                                  _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(2.577f), a), a));
+    const __m128 poly = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(3.535f), a), _mm_div_ps(num, den));
+    const __m128 use = _mm_and_ps(_mm_cmpneq_ps(a, _mm_setzero_ps()), _mm_cmplt_ps(a, _mm_set1_ps(1.6f)));
+    return _mm_min_ps(one, Select(use, poly, one));
+}
+
+EM_TARGET_SSE2
+static inline __m128 Dot3SSE2(const __m128 ax, const __m128 ay, const __m128 az,
+                              const __m128 bx, const __m128 by, const __m128 bz)
+{
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+}
+
+EM_TARGET_SSE2
+static void LightBlockSSE2(const EmGBufferBlock& g, const EmLightValues& light,
+                           const unsigned int lanes, float out[3][emBlock])
+{
+    const __m128 one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+    const __m128 range = _mm_set1_ps(light.range);
+    const __m128 invRange2 = _mm_set1_ps(1.0f/(light.range*light.range));
+    const __m128i laneBits = _mm_setr_epi32(1, 2, 4, 8);
+    for (int h=0;  h<emBlock;  h+=4) {
+        const __m128 px = _mm_loadu_ps(g.pos[0]+h), py = _mm_loadu_ps(g.pos[1]+h), pz = _mm_loadu_ps(g.pos[2]+h);
+
+        __m128 Lx = _mm_sub_ps(_mm_set1_ps(light.pos[0]), px);
+        __m128 Ly = _mm_sub_ps(_mm_set1_ps(light.pos[1]), py);
+        __m128 Lz = _mm_sub_ps(_mm_set1_ps(light.pos[2]), pz);
+        const __m128 dist = _mm_sqrt_ps(Dot3SSE2(Lx, Ly, Lz, Lx, Ly, Lz));
+        Lx = _mm_div_ps(Lx, dist);  Ly = _mm_div_ps(Ly, dist);  Lz = _mm_div_ps(Lz, dist);
+
+        __m128 Vx = _mm_sub_ps(_mm_set1_ps(light.eye[0]), px);
+        __m128 Vy = _mm_sub_ps(_mm_set1_ps(light.eye[1]), py);
+        __m128 Vz = _mm_sub_ps(_mm_set1_ps(light.eye[2]), pz);
+        const __m128 vlen = _mm_sqrt_ps(Dot3SSE2(Vx, Vy, Vz, Vx, Vy, Vz));
+        Vx = _mm_div_ps(Vx, vlen);  Vy = _mm_div_ps(Vy, vlen);  Vz = _mm_div_ps(Vz, vlen);
+
+        __m128 Hx = _mm_add_ps(Lx, Vx), Hy = _mm_add_ps(Ly, Vy), Hz = _mm_add_ps(Lz, Vz);
+        const __m128 hlen = _mm_sqrt_ps(Dot3SSE2(Hx, Hy, Hz, Hx, Hy, Hz));
+        Hx = _mm_div_ps(Hx, hlen);  Hy = _mm_div_ps(Hy, hlen);  Hz = _mm_div_ps(Hz, hlen);
+
+        __m128 Nx = _mm_loadu_ps(g.nrm[0]+h), Ny = _mm_loadu_ps(g.nrm[1]+h), Nz = _mm_loadu_ps(g.nrm[2]+h);
+        const __m128 nlen = _mm_sqrt_ps(Dot3SSE2(Nx, Ny, Nz, Nx, Ny, Nz));
+        Nx = _mm_div_ps(Nx, nlen);  Ny = _mm_div_ps(Ny, nlen);  Nz = _mm_div_ps(Nz, nlen);
+
+        const __m128 inRange = _mm_cmple_ps(dist, range);
+        const __m128 apart = _mm_cmpgt_ps(dist, _mm_set1_ps(0.001f));
+        const __m128 attenuated = light.local ? _mm_and_ps(inRange, apart) : zero;
+        const __m128 falloff = _mm_sub_ps(_mm_div_ps(one, _mm_mul_ps(dist, dist)), invRange2);
+        const __m128 attenuation = Select(attenuated, falloff, one);
+
+        const __m128 LdotN = _mm_max_ps(zero, Dot3SSE2(Lx, Ly, Lz, Nx, Ny, Nz));
+        const __m128 HdotN = _mm_max_ps(zero, Dot3SSE2(Hx, Hy, Hz, Nx, Ny, Nz));
+        const __m128 VdotN = Dot3SSE2(Vx, Vy, Vz, Nx, Ny, Nz);
+        const __m128 t = _mm_sub_ps(one, Dot3SSE2(Lx, Ly, Lz, Hx, Hy, Hz));
+        const __m128 fresnel = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, t), t), t), t);
+
+        const __m128 alpha = _mm_loadu_ps(g.alpha+h);
+        const __m128 D = _mm_mul_ps(_mm_div_ps(_mm_add_ps(alpha, _mm_set1_ps(2.0f)), _mm_set1_ps(2.0f*PI)),
+                                    Exp2SSE2(_mm_mul_ps(alpha, Log2SSE2(HdotN))));
+        const __m128 GD = _mm_mul_ps(_mm_mul_ps(GTermSSE2(alpha, LdotN), GTermSSE2(alpha, VdotN)), D);
+        const __m128 denom = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(4.0f), LdotN), VdotN);
+
+        const __m128 beyond = light.local ? _mm_cmpgt_ps(dist, range) : zero;
+        const __m128i bits = _mm_and_si128(_mm_set1_epi32((int)(lanes >> h)), laneBits);
+        const __m128 on = _mm_andnot_ps(beyond, _mm_castsi128_ps(_mm_cmpeq_epi32(bits, laneBits)));
+        for (int c=0;  c<3;  c++) {
+            const __m128 Kd = _mm_loadu_ps(g.kd[c]+h), Ks = _mm_loadu_ps(g.ks[c]+h);
+            const __m128 F = _mm_add_ps(Ks, _mm_mul_ps(_mm_sub_ps(one, Ks), fresnel));
+            const __m128 brdf = _mm_add_ps(_mm_div_ps(Kd, _mm_set1_ps(PI)), _mm_div_ps(_mm_mul_ps(F, GD), denom));
+            const __m128 lit = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(light.val[c]), attenuation), LdotN);
+            const __m128 value = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(light.amb[c]), Kd), _mm_mul_ps(lit, brdf));
+            _mm_storeu_ps(out[c]+h, _mm_add_ps(_mm_loadu_ps(out[c]+h), _mm_and_ps(on, value))); } }
+}
+
+////////////////////////////////////////////////////////////////////////
+// AVX2 versions:  one 8 wide register per block.
+
+EM_TARGET_AVX2
+static unsigned long long CoverRowAVX2(const int* e, const int* step, const int n)
+{
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i v[3], s8[3];
+    for (int i=0;  i<3;  i++) {
+        v[i] = _mm256_add_epi32(_mm256_set1_epi32(e[i]),
+                                _mm256_mullo_epi32(lane, _mm256_set1_epi32(step[i])));
+        s8[i] = _mm256_set1_epi32((int)(8*(unsigned int)step[i])); }
+
+    unsigned long long mask = 0;
+    for (int x=0;  x<n;  x+=8) {
+        __m256i all = _mm256_or_si256(_mm256_or_si256(v[0], v[1]), v[2]);
+        unsigned int m = ~_mm256_movemask_ps(_mm256_castsi256_ps(all)) & 0xFF;
+        mask |= (unsigned long long)m << x;
+        for (int i=0;  i<3;  i++)
+            v[i] = _mm256_add_epi32(v[i], s8[i]); }
+
+    if (n < 64)
+        mask &= (1ull << n) - 1;
+    return mask;
+}
+
+EM_TARGET_AVX2
+static void InterpolateBlockAVX2(const EmSetup& s, const float b1, const float b2, EmBlockValues& out)
+{
+    const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 c1 = _mm256_add_ps(_mm256_set1_ps(b1), _mm256_mul_ps(lane, _mm256_set1_ps(s.db1dx)));
+    __m256 c2 = _mm256_add_ps(_mm256_set1_ps(b2), _mm256_mul_ps(lane, _mm256_set1_ps(s.db2dx)));
+
+    __m256 z = _mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(s.z0), _mm256_mul_ps(c1, _mm256_set1_ps(s.dz1))),
+                             _mm256_mul_ps(c2, _mm256_set1_ps(s.dz2)));
+    _mm256_storeu_ps(out.z, z);
+
+    __m256 w = _mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(s.w0), _mm256_mul_ps(c1, _mm256_set1_ps(s.dw1))),
+                             _mm256_mul_ps(c2, _mm256_set1_ps(s.dw2)));
+    __m256 r = _mm256_div_ps(_mm256_set1_ps(1.0f), w);
+
+    for (int k=0;  k<emVaryings;  k++) {
+        __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(s.a0[k]), _mm256_mul_ps(c1, _mm256_set1_ps(s.da1[k]))),
+                                 _mm256_mul_ps(c2, _mm256_set1_ps(s.da2[k])));
+        _mm256_storeu_ps(out.var[k], _mm256_mul_ps(a, r)); }
+}
+
+// The lighting kernel's helpers, eight lanes at a time
+EM_TARGET_AVX2
+static inline __m256 Select(const __m256 mask, const __m256 a, const __m256 b)
+{
+    return _mm256_or_ps(_mm256_and_ps(mask, a), _mm256_andnot_ps(mask, b));
+}
+
+EM_TARGET_AVX2
+static inline __m256 Log2AVX2(const __m256 x)
+{
+    __m256i bits = _mm256_and_si256(_mm256_castps_si256(x), _mm256_set1_epi32(0x7FFFFFFF));
+    const __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+    bits = _mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F800000));
+    const __m256 m = _mm256_castsi256_ps(bits);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 t = _mm256_div_ps(_mm256_sub_ps(m, one), _mm256_add_ps(m, one));
+    const __m256 t2 = _mm256_mul_ps(t, t);
+    __m256 p = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(lnC9), t2), _mm256_set1_ps(lnC7));
+    p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(lnC5));
+    p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(lnC3));
+    p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(lnC1));
+    return _mm256_add_ps(e, _mm256_mul_ps(p, t));
+}
+
+EM_TARGET_AVX2
+static inline __m256 Exp2AVX2(__m256 y)
+{
+    y = _mm256_max_ps(y, _mm256_set1_ps(-126.0f));
+    __m256i n = _mm256_cvttps_epi32(y);
+    __m256 nf = _mm256_cvtepi32_ps(n);
+    const __m256 over = _mm256_cmp_ps(nf, y, _CMP_GT_OQ);
+    n = _mm256_add_epi32(n, _mm256_castps_si256(over));
+    nf = _mm256_sub_ps(nf, _mm256_and_ps(over, _mm256_set1_ps(1.0f)));
+    const __m256 f = _mm256_sub_ps(y, nf);
+    __m256 p = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(exC7), f), _mm256_set1_ps(exC6));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(exC5));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(exC4));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(exC3));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(exC2));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(exC1));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.0f));
+    const __m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(127)), 23));
+    return _mm256_mul_ps(p, scale);
+}
+
+EM_TARGET_AVX2
+static inline __m256 GTermAVX2(const __m256 alpha, const __m256 c)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 a = _mm256_div_ps(_mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(alpha, _mm256_set1_ps(0.5f)), one)),
+                                   _mm256_div_ps(_mm256_sqrt_ps(_mm256_sub_ps(one, _mm256_mul_ps(c, c))), c));
+    const __m256 num = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(2.181f), a), a);
+    const __m256 den = _mm256_add_ps(_mm256_add_ps(one, _mm256_mul_ps(_mm256_set1_ps(2.276f), a)),
+                                     _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(2.577f), a), a));
+    const __m256 poly = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(3.535f), a), _mm256_div_ps(num, den));
+    const __m256 use = _mm256_and_ps(_mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_NEQ_UQ),
+                                     _mm256_cmp_ps(a, _mm256_set1_ps(1.6f), _CMP_LT_OQ));
+    return _mm256_min_ps(one, Select(use, poly, one));
+}
+
+EM_TARGET_AVX2
+static inline __m256 Dot3AVX2(const __m256 ax, const __m256 ay, const __m256 az,
+                              const __m256 bx, const __m256 by, const __m256 bz)
+{
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)), _mm256_mul_ps(az, bz));
+}
+
+EM_TARGET_AVX2
+static void LightBlockAVX2(const EmGBufferBlock& g, const EmLightValues& light,
+                           const unsigned int lanes, float out[3][emBlock])
+{
+    const __m256 one = _mm256_set1_ps(1.0f), zero = _mm256_setzero_ps();
+    const __m256 range = _mm256_set1_ps(light.range);
+    const __m256 invRange2 = _mm256_set1_ps(1.0f/(light.range*light.range));
+    const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    for (int h=0;  h<emBlock;  h+=8) {
+        const __m256 px = _mm256_loadu_ps(g.pos[0]+h), py = _mm256_loadu_ps(g.pos[1]+h);
+        const __m256 pz = _mm256_loadu_ps(g.pos[2]+h);
+
+        __m256 Lx = _mm256_sub_ps(_mm256_set1_ps(light.pos[0]), px);
+        __m256 Ly = _mm256_sub_ps(_mm256_set1_ps(light.pos[1]), py);
+        __m256 Lz = _mm256_sub_ps(_mm256_set1_ps(light.pos[2]), pz);
+        const __m256 dist = _mm256_sqrt_ps(Dot3AVX2(Lx, Ly, Lz, Lx, Ly, Lz));
+        Lx = _mm256_div_ps(Lx, dist);  Ly = _mm256_div_ps(Ly, dist);  Lz = _mm256_div_ps(Lz, dist);
+
+        __m256 Vx = _mm256_sub_ps(_mm256_set1_ps(light.eye[0]), px);
+        __m256 Vy = _mm256_sub_ps(_mm256_set1_ps(light.eye[1]), py);
+        __m256 Vz = _mm256_sub_ps(_mm256_set1_ps(light.eye[2]), pz);
+        const __m256 vlen = _mm256_sqrt_ps(Dot3AVX2(Vx, Vy, Vz, Vx, Vy, Vz));
+        Vx = _mm256_div_ps(Vx, vlen);  Vy = _mm256_div_ps(Vy, vlen);  Vz = _mm256_div_ps(Vz, vlen);
+
+        __m256 Hx = _mm256_add_ps(Lx, Vx), Hy = _mm256_add_ps(Ly, Vy), Hz = _mm256_add_ps(Lz, Vz);
+        const __m256 hlen = _mm256_sqrt_ps(Dot3AVX2(Hx, Hy, Hz, Hx, Hy, Hz));
+        Hx = _mm256_div_ps(Hx, hlen);  Hy = _mm256_div_ps(Hy, hlen);  Hz = _mm256_div_ps(Hz, hlen);
+
+        __m256 Nx = _mm256_loadu_ps(g.nrm[0]+h), Ny = _mm256_loadu_ps(g.nrm[1]+h);
+        __m256 Nz = _mm256_loadu_ps(g.nrm[2]+h);
+        const __m256 nlen = _mm256_sqrt_ps(Dot3AVX2(Nx, Ny, Nz, Nx, Ny, Nz));
+        Nx = _mm256_div_ps(Nx, nlen);  Ny = _mm256_div_ps(Ny, nlen);  Nz = _mm256_div_ps(Nz, nlen);
+
+        const __m256 inRange = _mm256_cmp_ps(dist, range, _CMP_LE_OQ);
+        const __m256 apart = _mm256_cmp_ps(dist, _mm256_set1_ps(0.001f), _CMP_GT_OQ);
+        const __m256 attenuated = light.local ? _mm256_and_ps(inRange, apart) : zero;
+        const __m256 falloff = _mm256_sub_ps(_mm256_div_ps(one, _mm256_mul_ps(dist, dist)), invRange2);
+        const __m256 attenuation = Select(attenuated, falloff, one);
+
+        const __m256 LdotN = _mm256_max_ps(zero, Dot3AVX2(Lx, Ly, Lz, Nx, Ny, Nz));
+        const __m256 HdotN = _mm256_max_ps(zero, Dot3AVX2(Hx, Hy, Hz, Nx, Ny, Nz));
+        const __m256 VdotN = Dot3AVX2(Vx, Vy, Vz, Nx, Ny, Nz);
+        const __m256 t = _mm256_sub_ps(one, Dot3AVX2(Lx, Ly, Lz, Hx, Hy, Hz));
+        const __m256 fresnel = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t), t), t);
+
+        const __m256 alpha = _mm256_loadu_ps(g.alpha+h);
+        const __m256 D = _mm256_mul_ps(_mm256_div_ps(_mm256_add_ps(alpha, _mm256_set1_ps(2.0f)), _mm256_set1_ps(2.0f*PI)),
+                                    Exp2AVX2(_mm256_mul_ps(alpha, Log2AVX2(HdotN))));
+        const __m256 GD = _mm256_mul_ps(_mm256_mul_ps(GTermAVX2(alpha, LdotN), GTermAVX2(alpha, VdotN)), D);
+        const __m256 denom = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(4.0f), LdotN), VdotN);
+
+        const __m256 beyond = light.local ? _mm256_cmp_ps(dist, range, _CMP_GT_OQ) : zero;
+        const __m256i bits = _mm256_and_si256(_mm256_set1_epi32((int)(lanes >> h)), laneBits);
+        const __m256 on = _mm256_andnot_ps(beyond, _mm256_castsi256_ps(_mm256_cmpeq_epi32(bits, laneBits)));
+        for (int c=0;  c<3;  c++) {
+            const __m256 Kd = _mm256_loadu_ps(g.kd[c]+h), Ks = _mm256_loadu_ps(g.ks[c]+h);
+            const __m256 F = _mm256_add_ps(Ks, _mm256_mul_ps(_mm256_sub_ps(one, Ks), fresnel));
+            const __m256 brdf = _mm256_add_ps(_mm256_div_ps(Kd, _mm256_set1_ps(PI)),
+                                              _mm256_div_ps(_mm256_mul_ps(F, GD), denom));
+            const __m256 lit = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(light.val[c]), attenuation), LdotN);
+            const __m256 value = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(light.amb[c]), Kd), _mm256_mul_ps(lit, brdf));
+            _mm256_storeu_ps(out[c]+h, _mm256_add_ps(_mm256_loadu_ps(out[c]+h), _mm256_and_ps(on, value))); } }
+}
+
+////////////////////////////////////////////////////////////////////////
+// CPU feature detection
+
+static void CpuId(int info[4], const int leaf, const int sub)
+{
+#if defined(_MSC_VER)
+    __cpuidex(info, leaf, sub);
+#else
+    __cpuid_count(leaf, sub, info[0], info[1], info[2], info[3]);
+#endif
+}
+
+static unsigned long long XGetBV()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned int a, d;
+    __asm__ volatile("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return ((unsigned long long)d << 32) | a;
+#endif
+}
+
+EmSimdLevel EmDetectSimd()
+{
+    int info[4];
+    CpuId(info, 0, 0);
+    const int maxLeaf = info[0];
+
+    CpuId(info, 1, 0);
+    const bool sse2 = (info[3] & (1<<26)) != 0;
+    const bool osxsave = (info[2] & (1<<27)) != 0;
+    const bool avx = (info[2] & (1<<28)) != 0;
+    if (!sse2)
+        return emScalar;
+
+    // AVX2 also needs the OS to save the upper halves of the ymm registers.
+    if (maxLeaf >= 7 && osxsave && avx && (XGetBV() & 6) == 6) {
+        CpuId(info, 7, 0);
+        if (info[1] & (1<<5))
+            return emAVX2; }
+    return emSSE2;
+}
+
+#else
+
+EmSimdLevel EmDetectSimd() { return emScalar; }
+
+#endif
+
+const EmKernels& EmGetKernels(const EmSimdLevel level)
+{
+    static const EmKernels kernels[] = {
+        {"scalar", CoverRowScalar, InterpolateBlockScalar, LightBlockScalar},
+#ifdef EM_X86
+        {"SSE2",   CoverRowSSE2,   InterpolateBlockSSE2,   LightBlockSSE2},
+        {"AVX2",   CoverRowAVX2,   InterpolateBlockAVX2,   LightBlockAVX2},
+#endif
+    };
+    const int count = sizeof(kernels)/sizeof(kernels[0]);
+    return kernels[level < count ? level : 0];
+}
@@ -0,0 +1,90 @@
+////////////////////////////////////////////////////////////////////////
+// The inner loops of the software pipeline (emulator.cpp):  edge
+// function coverage, perspective correct interpolation and lighting,
+// in scalar, SSE2 and AVX2 versions.  The best version the CPU
+// supports is chosen at run time.
+//
+// Coverage is computed with 32 bit integer edge functions, stepped
+// incrementally along a row, so every version produces exactly the
+// same coverage bits.  Interpolation and lighting are done in float,
+// eight pixels at a time, with the varyings and G-buffer values laid
+// out as structure of arrays.  The lighting's pow() is approximated
+// (with exp2 and log2 polynomials), the same way in every version.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _RASTER
+#define _RASTER
+
+// Values interpolated across a triangle: worldPos(3), normal(3), texcoord(2), tangent(3)
+const int emVaryings = 11;
+
+// Pixels per interpolation block
+const int emBlock = 8;
+
+// A triangle's interpolation planes, relative to its first vertex.
+// The barycentric coordinates b1 and b2 of vertices 1 and 2 are
+// affine in screen space.  Depth is interpolated linearly, and the
+// varyings (pre-divided by w) perspective correctly.
+struct EmSetup
+{
+    float db1dx, db2dx;         // Change in b1,b2 per pixel in x
+    float z0, dz1, dz2;         // z  = z0 + b1*dz1 + b2*dz2
+    float w0, dw1, dw2;         // 1/w
+    float a0[emVaryings], da1[emVaryings], da2[emVaryings];  // var/w
+};
+
+// Interpolated values for one block of pixels
+struct EmBlockValues
+{
+    float z[emBlock];
+    float var[emVaryings][emBlock];
+};
+
+// The G-buffer values of a block of pixels, each pointing at the
+// block's first pixel in its plane
+struct EmGBufferBlock
+{
+    const float* pos[3];
+    const float* nrm[3];
+    const float* kd[3];
+    const float* ks[3];
+    const float* alpha;
+};
+
+// A light, with the values BRDF() of BRDF.frag is given, and the eye
+struct EmLightValues
+{
+    float pos[3], val[3], amb[3];
+    float range;
+    bool local;                 // Attenuated, and lighting only what is in range
+    float eye[3];
+};
+
+struct EmKernels
+{
+    const char* name;
+
+    // Coverage of n (at most 64) consecutive pixels of a row, one bit
+    // per pixel.  e holds the three edge values at the first pixel,
+    // step their change per pixel.  A pixel is covered when all three
+    // are non-negative.
+    unsigned long long (*CoverRow)(const int* e, const int* step, const int n);
+
+    // Depth and varyings for the emBlock pixels starting at barycentrics (b1,b2).
+    void (*InterpolateBlock)(const EmSetup& s, const float b1, const float b2, EmBlockValues& out);
+
+    // BRDF() of BRDF.frag for one light and a block of pixels, added
+    // into the lanes of out selected by the bits of lanes.
+    void (*LightBlock)(const EmGBufferBlock& g, const EmLightValues& light,
+                       const unsigned int lanes, float out[3][emBlock]);
+};
+
+enum EmSimdLevel { emScalar=0, emSSE2=1, emAVX2=2 };
+
+// Highest level supported by this CPU and operating system.
+EmSimdLevel EmDetectSimd();
+
+// Kernels for a given level (which must be supported).
+const EmKernels& EmGetKernels(const EmSimdLevel level);
+
+#endif
@@ -0,0 +1,174 @@
+////////////////////////////////////////////////////////////////////////
+// A render queue of state-sorted draws.  See renderqueue.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <string.h>
+#include <algorithm>
+
+#include "framework.h"
+#include "object.h"
+#include "instancing.h"
+#include "hierarchy.h"
+#include "ubo.h"
+#include "renderqueue.h"
+
+#include <glu.h>                // For gluErrorString
+#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line renderqueue.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+RenderQueue::RenderQueue() : sorted(true)
+{
+    for (int p=0;  p<rqPassCount;  p++)
+        packetCount[p] = programChanges[p] = vaoChanges[p] = materialChanges[p] = 0;
+}
+
+void RenderQueue::Clear()
+{
+    packets.clear();
+    sorted = true;
+}
+
+int RenderQueue::MaterialOf(const Shape* shape)
+{
+    std::map<const Shape*,int>::iterator m = materialOf.find(shape);
+    if (m != materialOf.end())
+        return m->second;
+
+    Material mat;
+    mat.packed = shape->format != vfFloat;
+    mat.posOffset = shape->posOffset;
+    mat.posScale = shape->posScale;
+    int i = 0;
+    while (i < materials.size() && !(materials[i].packed == mat.packed
+                                     && materials[i].posOffset == mat.posOffset
+                                     && materials[i].posScale == mat.posScale))
+        i++;
+    if (i == materials.size())
+        materials.push_back(mat);
+    materialOf[shape] = i;
+    return i;
+}
+
+// Each field is masked to its width, so a program or VAO number past
+// it only costs sorting them less well (Submit compares the state
+// itself before drawing batches together).  A non-negative float's bits,
+// read as an integer, are in the same order as the float.
+unsigned long long RenderQueue::Key(const RenderPass pass, const ShaderProgram* program,
+                                    const Shape* shape, const float depth)
+{
+    unsigned int depthBits = 0;
+    if (pass == rqGBufferPass) {
+        const float d = std::max(depth, 0.0f);
+        memcpy(&depthBits, &d, sizeof(d));
+        depthBits >>= 32 - rqDepthBits; }
+
+    unsigned long long key = (unsigned long long)pass & ((1<<rqPassBits)-1);
+    key = (key<<rqProgramBits) | (program->programId & ((1<<rqProgramBits)-1));
+    key = (key<<rqVaoBits) | (shape->vaoID & ((1<<rqVaoBits)-1));
+    key = (key<<rqMaterialBits) | (MaterialOf(shape) & ((1<<rqMaterialBits)-1));
+    key = (key<<rqDepthBits) | depthBits;
+    return key;
+}
+
+void RenderQueue::AddNode(const RenderPass pass, ShaderProgram* program, const FlatHierarchy* nodes,
+                          const int node, const float depth)
+{
+    Packet p;
+    p.key = Key(pass, program, nodes->NodeObject(node)->shape, depth);
+    p.sequence = (int)packets.size();
+    p.program = program;
+    p.nodes = nodes;
+    p.batcher = NULL;
+    p.index = node;
+    packets.push_back(p);
+    sorted = false;
+}
+
+void RenderQueue::AddBatch(const RenderPass pass, ShaderProgram* program, InstanceBatcher* batcher,
+                           const int batch, const float depth)
+{
+    Packet p;
+    p.key = Key(pass, program, batcher->BatchShape(batch), depth);
+    p.sequence = (int)packets.size();
+    p.program = program;
+    p.nodes = NULL;
+    p.batcher = batcher;
+    p.index = batch;
+    packets.push_back(p);
+    sorted = false;
+}
+
+void RenderQueue::Submit(const RenderPass pass)
+{
+    if (!sorted) {
+        std::sort(packets.begin(), packets.end(), [&](const Packet& a, const Packet& b) {
+                return a.key != b.key ? a.key < b.key : a.sequence < b.sequence; });
+        sorted = true; }
+
+    // The pass's packets are the run of keys with its pass bits
+    const int shift = rqProgramBits + rqVaoBits + rqMaterialBits + rqDepthBits;
+    int begin = 0;
+    while (begin < packets.size() && (int)(packets[begin].key>>shift) < pass)
+        begin++;
+    int end = begin;
+    while (end < packets.size() && (int)(packets[end].key>>shift) == pass)
+        end++;
+
+    // Write the objects' blocks with one map.  There is always at least
+    // one block, so the binding point is backed even if every draw is
+    // instanced.
+    int blockCount = 0;
+    blockOf.resize(packets.size());
+    for (int i=begin;  i<end;  i++)
+        blockOf[i] = packets[i].nodes ? blockCount++ : -1;
+
+    UniformRing& ring = ObjectRing();
+    size_t offset, stride;
+    char* blocks = (char*)ring.Map(std::max(blockCount, 1), sizeof(ObjectBlock), offset, stride);
+    for (int i=begin;  i<end;  i++) {
+        const Packet& p = packets[i];
+        if (p.nodes)
+            p.nodes->NodeObject(p.index)->Block(*(ObjectBlock*)(blocks + blockOf[i]*stride),
+                                                 p.nodes->WorldTr(p.index), p.nodes->NormalTr(p.index)); }
+    ring.Unmap();
+    ring.Bind(ubObjectBinding, offset, sizeof(ObjectBlock));
+    CHECKERROR;
+
+    const int materialShift = rqDepthBits;
+    const int vaoShift = materialShift + rqMaterialBits;
+    packetCount[pass] = end - begin;
+    programChanges[pass] = vaoChanges[pass] = materialChanges[pass] = 0;
+    ShaderProgram* program = NULL;
+    for (int i=begin;  i<end;  i++) {
+        const Packet& p = packets[i];
+        if (p.program != program) {
+            p.program->UseShader();
+            program = p.program;
+            programChanges[pass]++; }
+        if (i == begin || (p.key>>vaoShift) != (packets[i-1].key>>vaoShift))
+            vaoChanges[pass]++;
+        if (i == begin || (p.key>>materialShift) != (packets[i-1].key>>materialShift))
+            materialChanges[pass]++;
+
+        if (p.nodes) {
+            if (blockOf[i] > 0)
+                ring.Bind(ubObjectBinding, offset + blockOf[i]*stride, sizeof(ObjectBlock));
+            p.nodes->NodeObject(p.index)->DrawShape(program); }
+        else {
+            // The run of batches from here with the same state is drawn
+            // together (see InstanceBatcher::DrawBatches).  The key's
+            // fields are masked, so the state itself is compared.
+            const Shape* shape = p.batcher->BatchShape(p.index);
+            const int material = MaterialOf(shape);
+            run.clear();
+            run.push_back(p.index);
+            while (i+1 < end && !packets[i+1].nodes && packets[i+1].batcher == p.batcher
+                   && packets[i+1].program == program
+                   && (packets[i+1].key>>materialShift) == (p.key>>materialShift)) {
+                const Shape* next = p.batcher->BatchShape(packets[i+1].index);
+                if (next->vaoID != shape->vaoID || MaterialOf(next) != material)
+                    break;
+                run.push_back(packets[++i].index); }
+            p.batcher->DrawBatches(program, run); }
+        CHECKERROR; }
+}
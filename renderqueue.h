@@ -0,0 +1,100 @@
+////////////////////////////////////////////////////////////////////////
+// A render queue:  the draws of a frame, collected from the flattened
+// hierarchies, sorted by their state, and submitted in that order.
+//
+// Each packet is one object (a node of a FlatHierarchy) or one
+// InstanceBatcher batch, with the pass and program that draw it.  Its
+// 64-bit sort key holds, from the most significant bits down:
+//
+//    pass (4) | program (8) | VAO (12) | material (12) | depth (28)
+//
+// so that a pass's draws are contiguous, then a program is used once,
+// then each VAO is bound once, and then each material is set once.
+// Here the material is the only state a draw sets besides its VAO:
+// the shape's vertex decoding (see VertexFormat), as its colors are in
+// its ObjectBlock.  Shapes decoded alike share a material number, so
+// most of the scene is one run, sorted only by depth.  The depth (of
+// the object's center along the view direction, with its float bits
+// kept in order) is set only for the G-buffer pass, so objects are
+// drawn front to back and hide what is behind them before it is
+// shaded.  The light volumes are blended, so their order is left to
+// the state.
+//
+// Submit draws one pass's packets:  it writes the objects' ObjectBlocks
+// into the ObjectRing in the sorted order with one map (see ubo.h), and
+// uses a program only when the program changes.  Consecutive batches
+// of the same state are drawn together, with one multi-draw where the
+// context has it.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _RENDERQUEUE
+#define _RENDERQUEUE
+
+#include <vector>
+#include <map>
+
+class Shape;
+class ShaderProgram;
+class FlatHierarchy;
+class InstanceBatcher;
+
+enum RenderPass { rqGBufferPass, rqLightStencilPass, rqLocalLightsPass, rqPassCount };
+
+const int rqPassBits = 4;
+const int rqProgramBits = 8;
+const int rqVaoBits = 12;
+const int rqMaterialBits = 12;
+const int rqDepthBits = 28;
+
+class RenderQueue
+{
+    struct Packet
+    {
+        unsigned long long key;
+        int sequence;                   // Order added, to break ties
+        ShaderProgram* program;
+        const FlatHierarchy* nodes;     // The node's hierarchy, or NULL for a batch
+        InstanceBatcher* batcher;
+        int index;                      // The node, or the batch
+    };
+    std::vector<Packet> packets;
+    std::vector<int> blockOf;           // Index of each packet's ObjectBlock
+    std::vector<int> run;               // Batches drawn together
+
+    // The distinct vertex decodings, and the material number of each
+    // shape seen
+    struct Material
+    {
+        bool packed;
+        glm::vec3 posOffset, posScale;
+    };
+    std::vector<Material> materials;
+    std::map<const Shape*,int> materialOf;
+
+    bool sorted;
+
+    int MaterialOf(const Shape* shape);
+    unsigned long long Key(const RenderPass pass, const ShaderProgram* program,
+                           const Shape* shape, const float depth);
+
+public:
+    // Statistics of each pass's last Submit
+    int packetCount[rqPassCount], programChanges[rqPassCount];
+    int vaoChanges[rqPassCount], materialChanges[rqPassCount];
+
+    RenderQueue();
+
+    // Empty the queue, for the next frame
+    void Clear();
+
+    // Queue a node of a hierarchy, or an uploaded batch of a batcher
+    void AddNode(const RenderPass pass, ShaderProgram* program, const FlatHierarchy* nodes,
+                 const int node, const float depth);
+    void AddBatch(const RenderPass pass, ShaderProgram* program, InstanceBatcher* batcher,
+                  const int batch, const float depth);
+
+    // Draw the queued packets of one pass, in the order of their keys
+    void Submit(const RenderPass pass);
+};
+
+#endif
@@ -12,10 +12,11 @@
 // others are set by the framework in response to user mouse/keyboard
 // interactions.  All of them can be used to draw the scene.
 
-const bool fullPolyCount = true; // Use false when emulating the graphics pipeline in software
+const bool fullPolyCount = true; // Use false for a reduced scene (the software pipeline in emulator.cpp handles either)
 
 #include "math.h"
 #include <iostream>
+#include <random>
 #include <stdlib.h>
 
 #include <glbinding/gl/gl.h>
@@ -34,6 +35,16 @@ using namespace gl;
 #include "object.h"
 #include "texture.h"
 #include "transform.h"
+#include "emulator.h"
+#include "occlusion.h"
+#include "instancing.h"
+#include "hierarchy.h"
+#include "renderqueue.h"
+#include "bvh.h"
+#include "clusters.h"
+#include "ubo.h"
+#include "terrain.h"
+#include "meshopt.h"
 
 const float PI = 3.14159f;
 const float rad = PI/180.0f;    // Convert degrees to radians
@@ -46,6 +57,7 @@ const float grndFreq = 0.03;    // Number of hills per (approx) 50m
 const float grndPersistence = 0.03; // Terrain roughness: Slight:0.01  rough:0.05
 const float grndLow = -3.0;         // Lowest extent below sea level
 const float grndHigh = 5.0;        // Highest extent above sea level
+const float grndSpacing = 0.5;     // Grid spacing of the ground nearest the eye
 
 ////////////////////////////////////////////////////////////////////////
 // This macro makes it easy to sprinkle checks for OpenGL errors
@@ -154,14 +166,17 @@ void Scene::InitializeScene()
     // Create the lighting shader program from source code files.
     // @@ Initialize additional shaders if necessary
     gbufferProgram = new ShaderProgram();
-    gbufferProgram->AddShader("shaders\\GBuffer.vert", GL_VERTEX_SHADER);
-    gbufferProgram->AddShader("shaders\\GBuffer.frag", GL_FRAGMENT_SHADER);
+    gbufferProgram->AddShader("shaders\\GBuffer.vert",    GL_VERTEX_SHADER);
+    gbufferProgram->AddShader("shaders\\GBuffer.frag",    GL_FRAGMENT_SHADER);
+    gbufferProgram->AddShader("shaders\\Octahedral.vert", GL_VERTEX_SHADER);
 
     glBindAttribLocation(gbufferProgram->programId, 0, "vertex");
     glBindAttribLocation(gbufferProgram->programId, 1, "vertexNormal");
     glBindAttribLocation(gbufferProgram->programId, 2, "vertexTexture");
     glBindAttribLocation(gbufferProgram->programId, 3, "vertexTangent");
+    BindInstanceAttributes(gbufferProgram->programId);
     gbufferProgram->LinkProgram();
+    BindUniformBlocks(gbufferProgram->programId);
 
     lightingProgram = new ShaderProgram();
     lightingProgram->AddShader("shaders\\Lighting.vert", GL_VERTEX_SHADER);
@@ -172,32 +187,58 @@ void Scene::InitializeScene()
 
     glBindAttribLocation(lightingProgram->programId, 0, "vertex");
     lightingProgram->LinkProgram();
+    BindUniformBlocks(lightingProgram->programId);
 
     localLightsProgram = new ShaderProgram();
     localLightsProgram->AddShader("shaders\\LocalLights.vert", GL_VERTEX_SHADER);
     localLightsProgram->AddShader("shaders\\LocalLights.frag", GL_FRAGMENT_SHADER);
     localLightsProgram->AddShader("shaders\\BRDF.vert",        GL_VERTEX_SHADER);
     localLightsProgram->AddShader("shaders\\BRDF.frag",        GL_FRAGMENT_SHADER);
+    localLightsProgram->AddShader("shaders\\Octahedral.vert",  GL_VERTEX_SHADER);
 
     glBindAttribLocation(localLightsProgram->programId, 0, "vertex");
     glBindAttribLocation(localLightsProgram->programId, 1, "vertexNormal");
+    BindInstanceAttributes(localLightsProgram->programId);
     localLightsProgram->LinkProgram();
+    BindUniformBlocks(localLightsProgram->programId);
+
+    lightStencilProgram = new ShaderProgram();
+    lightStencilProgram->AddShader("shaders\\LocalLights.vert",  GL_VERTEX_SHADER);
+    lightStencilProgram->AddShader("shaders\\LightStencil.frag", GL_FRAGMENT_SHADER);
+    lightStencilProgram->AddShader("shaders\\BRDF.vert",         GL_VERTEX_SHADER);
+    lightStencilProgram->AddShader("shaders\\Octahedral.vert",   GL_VERTEX_SHADER);
+
+    glBindAttribLocation(lightStencilProgram->programId, 0, "vertex");
+    glBindAttribLocation(lightStencilProgram->programId, 1, "vertexNormal");
+    BindInstanceAttributes(lightStencilProgram->programId);
+    lightStencilProgram->LinkProgram();
+    BindUniformBlocks(lightStencilProgram->programId);
+
+    clusteredProgram = new ShaderProgram();
+    clusteredProgram->AddShader("shaders\\Lighting.vert",  GL_VERTEX_SHADER);
+    clusteredProgram->AddShader("shaders\\Clustered.frag", GL_FRAGMENT_SHADER);
+    clusteredProgram->AddShader("shaders\\BRDF.vert",      GL_VERTEX_SHADER);
+    clusteredProgram->AddShader("shaders\\BRDF.frag",      GL_FRAGMENT_SHADER);
+
+    glBindAttribLocation(clusteredProgram->programId, 0, "vertex");
+    clusteredProgram->LinkProgram();
+    BindUniformBlocks(clusteredProgram->programId);
 
 
 
     
     // Create all the Polygon shapes
-    proceduralground = new ProceduralGround(grndSize, 400,
+    proceduralground = new ChunkedGround(grndSize, grndSpacing,
                                      grndOctaves, grndFreq, grndPersistence,
                                      grndLow, grndHigh);
     
-    Shape* TeapotPolygons =  new Teapot(fullPolyCount?12:2);
+    Shape* TeapotPolygons =  new Teapot(fullPolyCount?12:2, vfPacked);
     Shape* BoxPolygons = new Box();
     Shape* SpherePolygons = new Sphere(32);
     Shape* RoomPolygons = new Ply("room.ply");
     Shape* FloorPolygons = new Plane(10.0, 10);
     Shape* QuadPolygons = new Quad();
-    Shape* SeaPolygons = new Plane(2000.0, 50);
+    Shape* SeaPolygons = new Plane(2000.0, 50, vfPacked);
     Shape* GroundPolygons = proceduralground;
 
     // Various colors used in the subsequent models
@@ -237,18 +278,25 @@ void Scene::InitializeScene()
     rightFrame = FramedPicture(Identity, rPicId, BoxPolygons, QuadPolygons); 
     spheres    = SphereOfSpheres(SpherePolygons);
 
+    // The large objects that hide others, for occlusion culling
+    room->occluder = true;
+    ground->occluder = true;
+
     lightsRoot = new Object(NULL, nullId);
     localLight1 = new Object(SpherePolygons, nullId, glm::vec3(24.0, 0.0, 0.0), lightAmb, 1);
     localLight1->position = glm::vec3(-2.0, 0.0, 2.0);
     localLight1->range = 4.0;
+    localLight1->isLight = true;
 
     localLight2 = new Object(SpherePolygons, nullId, glm::vec3(64.0, 64.0, 64.0), lightAmb, 1);
     localLight2->position = glm::vec3(0.1, 0.0, 5.0);
     localLight2->range = 6.0;
+    localLight2->isLight = true;
 
     localLight3 = new Object(SpherePolygons, nullId, glm::vec3(0.0, 0.0, 16.0), lightAmb, 1);
     localLight3->position = glm::vec3(2.0, 0.0, 2.0);
     localLight3->range = 4.0;
+    localLight3->isLight = true;
 
 #if REFL
     spheres->drawMe = true;
@@ -295,6 +343,15 @@ void Scene::InitializeScene()
                                  * Scale(localLight2->range, localLight2->range, localLight2->range));
     lightsRoot->add(localLight3, Translate(localLight3->position.x, localLight3->position.y, localLight3->position.z)
                                  * Scale(localLight3->range, localLight3->range, localLight3->range));
+
+    // The hierarchies are drawn from flattened copies
+    objectNodes = new FlatHierarchy();
+    objectNodes->Build(objectRoot);
+    lightNodes = new FlatHierarchy();
+    lightNodes->Build(lightsRoot);
+    frustumCull = true;
+    objectBounds = new BoundingVolumes();
+    objectBounds->Build(*objectNodes);
     CHECKERROR;
 
     // Options menu stuff
@@ -311,9 +368,46 @@ void Scene::InitializeScene()
     flipToggle = 0;
     debugToggle = false;
     screen = new Screen();
+
+    emulate = false;
+    emulator = new Emulator();
+    emulatorOutput = NULL;
+    validateEmulator = false;
+
+    occlusionCull = true;
+    occlusion = new OcclusionCuller();
+
+    instancing = true;
+    multiDraw = true;
+    objectBatches = new InstanceBatcher();
+    lightBatches = new InstanceBatcher();
+    renderQueue = new RenderQueue();
+
+    clustered = true;
+    stencilLights = true;
+    clusters = new LightClusters();
     
 }
 
+////////////////////////////////////////////////////////////////////////
+// Add lights like localLight1 at random places around the room, to
+// load the local lights passes.
+void Scene::AddLocalLights(const int count)
+{
+    static std::mt19937 RNGen(562);
+    static std::uniform_real_distribution<float> myrandomf(0.0f, 1.0f);
+    for (int i=0;  i<count;  i++) {
+        const float range = 1.0f + 3.0f*myrandomf(RNGen);
+        Object* light = new Object(localLight1->shape, nullId,
+                                   8.0f*HSV2RGB(myrandomf(RNGen), 1.0f, 1.0f), glm::vec3(0.0), 1);
+        light->position = glm::vec3(40.0f*myrandomf(RNGen) - 20.0f, 40.0f*myrandomf(RNGen) - 20.0f,
+                                    0.5f + 3.0f*myrandomf(RNGen));
+        light->range = range;
+        light->isLight = true;
+        lightsRoot->add(light, Translate(light->position.x, light->position.y, light->position.z)
+                               * Scale(range, range, range)); }
+}
+
 void Scene::DrawMenu()
 {
     ImGui_ImplOpenGL3_NewFrame();
@@ -327,6 +421,24 @@ void Scene::DrawMenu()
             if (ImGui::MenuItem("Draw walls", "", room->drawMe))       {room->drawMe ^= true; }
             if (ImGui::MenuItem("Draw ground/sea", "", ground->drawMe)){ground->drawMe ^= true;
                 							sea->drawMe = ground->drawMe;}
+            ImGui::Text("Terrain chunks %d drawn, %d kept, update %.2f ms", proceduralground->SelectedCount(),
+                        proceduralground->ChunkCount(), proceduralground->updateTime);
+            ImGui::Text("Transforms %d of %d updated", objectNodes->updatedCount, objectNodes->NodeCount());
+            const std::vector<MeshCacheReport>& reports = CacheReports();
+            double triangles = 0.0, before = 0.0, after = 0.0;
+            for (int r=0;  r<reports.size();  r++) {
+                triangles += reports[r].triangles;
+                before += reports[r].acmr[0]*reports[r].triangles;
+                after += reports[r].acmr[1]*reports[r].triangles; }
+            if (triangles > 0.0)
+                ImGui::Text("Vertex cache ACMR %.3f -> %.3f", before/triangles, after/triangles);
+            if (ImGui::TreeNode("Vertex cache per mesh")) {
+                for (int r=0;  r<reports.size();  r++)
+                    ImGui::Text("%s, %d tris:  ACMR %.3f -> %.3f,  ATVR %.3f -> %.3f",
+                                reports[r].name.c_str(), reports[r].triangles,
+                                reports[r].acmr[0], reports[r].acmr[1],
+                                reports[r].atvr[0], reports[r].atvr[1]);
+                ImGui::TreePop(); }
             ImGui::EndMenu(); }
                 	
         // This menu demonstrates how to provide the user a choice
@@ -346,6 +458,32 @@ void Scene::DrawMenu()
             ImGui::Checkbox("Local light2", &(localLight2->drawMe));
             ImGui::Checkbox("Local light3", &(localLight3->drawMe));       
             ImGui::Checkbox("Show Range", &debugToggle);       
+            ImGui::Checkbox("Clustered lights", &clustered);
+            if (!clustered)
+                ImGui::Checkbox("Stencil light volumes", &stencilLights);
+            if (clustered)
+                ImGui::Text("%d lights, %d in the busiest cluster", clusters->lightCount, clusters->maxPerCluster);
+            if (ImGui::MenuItem("Add 100 local lights")) { AddLocalLights(100); }
+            ImGui::Checkbox("Software pipeline", &emulate);
+            if (ImGui::MenuItem("Validate software pipeline")) { validateEmulator = true; }
+            ImGui::Checkbox("Frustum culling", &frustumCull);
+            if (frustumCull)
+                ImGui::Text("Frustum culled %d objects, %d triangles (%d boxes refit)",
+                            objectBounds->culledCount, objectBounds->culledTriangles, objectBounds->refitCount);
+            ImGui::Checkbox("Occlusion culling", &occlusionCull);
+            if (occlusionCull)
+                ImGui::Text("Occlusion culled %d of %d", occlusion->culledCount, occlusion->testedCount);
+            ImGui::Checkbox("Instancing", &instancing);
+            if (instancing)
+                ImGui::Text("Instanced %d objects in %d draws", objectBatches->instanceCount,
+                            objectBatches->drawCount);
+            if (instancing && MultiDrawIndirectSupported()) {
+                ImGui::Checkbox("Multi-draw indirect", &multiDraw);
+                if (multiDraw)
+                    ImGui::Text("G-buffer batches in %d multi-draws", objectBatches->multiDrawCount); }
+            ImGui::Text("G-buffer %d draws, %d VAO and %d material changes",
+                        renderQueue->packetCount[rqGBufferPass], renderQueue->vaoChanges[rqGBufferPass],
+                        renderQueue->materialChanges[rqGBufferPass]);
             ImGui::EndMenu(); }
         
         ImGui::EndMainMenuBar(); }
@@ -369,7 +507,7 @@ void Scene::BuildTransforms()
     if (key == GLFW_KEY_A)
         eye -= dist*glm::vec3(cos(spin*rad), -sin(spin*rad), 0.0);
 
-    eye[2] = proceduralground->HeightAt(eye[0], eye[1]) + 2.0;
+    eye[2] = proceduralground->MeshHeightAt(eye[0], eye[1]) + 2.0;
 
     CHECKERROR;
 
@@ -405,15 +543,55 @@ void Scene::DrawScene()
     // Update position of any continuously animating objects
     double atime = 360.0*glfwGetTime()/36;
     for (std::vector<Object*>::iterator m=animated.begin();  m<animated.end();  m++)
-        (*m)->animTr = Rotate(2, atime);
+        (*m)->SetAnimTr(Rotate(2, atime));
+    objectNodes->Update();
+    lightNodes->Update();
 
     BuildTransforms();
 
     // The lighting algorithm needs the inverse of the WorldView matrix
     WorldInverse = glm::inverse(WorldView);
 
+    // Find the objects in view
+    objectBounds->Refit(*objectNodes);
+    if (frustumCull)
+        objectBounds->Cull(WorldProj*WorldView);
+
+    // Bring the terrain's chunks up to date around the eye.  The
+    // occlusion culler reads the ground's triangles on its thread, so
+    // it is finished with first.
+    occlusion->Finish();
+    proceduralground->Update((WorldInverse*glm::vec4(0,0,0,1)).xyz());
+
     CHECKERROR;
-    int loc, programId;
+
+    ///////////////////////
+    // Software pipeline //
+    ///////////////////////
+
+    if (emulate) {
+        emulator->DrawScene(*this);
+
+        // Upload the emulator's output into an FBO's texture and copy it to the screen
+        if (!emulatorOutput || emulatorOutput->width != width || emulatorOutput->height != height) {
+            if (emulatorOutput)
+                emulatorOutput->DeleteFBO();
+            else
+                emulatorOutput = new FBO();
+            emulatorOutput->CreateFBO(width, height); }
+
+        glBindTexture(GL_TEXTURE_2D, emulatorOutput->textureID);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, &emulator->color[0]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, emulatorOutput->fboID);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        CHECKERROR;
+        return; }
+
+    ShaderProgram* program;
 
     ///////////////////
     // G-Buffer pass //
@@ -427,10 +605,11 @@ void Scene::DrawScene()
 
     // Choose the shader
     gbufferProgram->UseShader();
-    programId = gbufferProgram->programId;
+    program = gbufferProgram;
 
-    // bind FBO
+    // bind FBO, with Kd converted to its sRGB target
     G_Buffer->BindFBO();
+    glEnable(GL_FRAMEBUFFER_SRGB);
     CHECKERROR;
 
     // Set the viewport, and clear the screen
@@ -438,21 +617,46 @@ void Scene::DrawScene()
     glClearColor(0.5, 0.5, 0.5, 1.0);
     glClear(GL_COLOR_BUFFER_BIT| GL_DEPTH_BUFFER_BIT);
 
-    // Uniforms
-    loc = glGetUniformLocation(programId, "WorldProj");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldProj));
-    loc = glGetUniformLocation(programId, "WorldView");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldView));
-    loc = glGetUniformLocation(programId, "WorldInverse");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldInverse));
+    // The frame's uniforms, for all three passes
+    FrameBlock frameBlock;
+    frameBlock.WorldProj = WorldProj;
+    frameBlock.WorldView = WorldView;
+    frameBlock.WorldInverse = WorldInverse;
+    frameBlock.ViewProjInverse = glm::inverse(WorldProj*WorldView);
+    frameBlock.width = width;
+    frameBlock.height = height;
+    SetFrameBlock(frameBlock);
     CHECKERROR;
 
-    // Draw all objects
-    objectRoot->Draw(gbufferProgram, Identity);
+    // Queue the draws of both passes:  all objects, except those found
+    // hidden during the last frame, and all light volumes unless the
+    // lights are clustered.  (The software pipeline draws the volumes,
+    // so they are drawn for a frame it validates.)
+    const bool useClusters = clustered && !validateEmulator;
+    const bool useStencil = stencilLights && !validateEmulator;
+    renderQueue->Clear();
+    objectBatches->multiDraw = multiDraw;
+    objectNodes->Collect(*renderQueue, rqGBufferPass, gbufferProgram, WorldView,
+                         occlusionCull ? occlusion : NULL, instancing ? objectBatches : NULL,
+                         frustumCull ? objectBounds : NULL);
+    if (!useClusters && useStencil)
+        lightNodes->Collect(*renderQueue, rqLightStencilPass, lightStencilProgram, WorldView,
+                            NULL, instancing ? lightBatches : NULL);
+    if (!useClusters)
+        lightNodes->Collect(*renderQueue, rqLocalLightsPass, localLightsProgram, WorldView,
+                            NULL, instancing ? lightBatches : NULL);
+
+    // Draw the objects, front to back
+    renderQueue->Submit(rqGBufferPass);
     CHECKERROR; 
 
+    // Cull for the next frame while the GPU works on this one
+    if (occlusionCull)
+        occlusion->Start(*this);
+
 
     // unbind FBO
+    glDisable(GL_FRAMEBUFFER_SRGB);
     G_Buffer->UnbindFBO();
     
     // Turn off the shader
@@ -462,8 +666,10 @@ void Scene::DrawScene()
     // Lighting pass //
     ///////////////////
 
-    // Enable & Disable
+    // Enable & Disable.  The pass writes the G-buffer's depth to the
+    // screen's depth buffer (see Lighting.frag) for the light volumes.
     glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_ALWAYS);
     glDisable(GL_BLEND);
     glEnable(GL_CULL_FACE);    
     glCullFace(GL_BACK);
@@ -471,7 +677,7 @@ void Scene::DrawScene()
 
     // Choose Shader
     lightingProgram->UseShader();
-    programId = lightingProgram->programId;
+    program = lightingProgram;
 
     // Set the viewport, and clear the screen
     glViewport(0, 0, width, height);
@@ -480,31 +686,20 @@ void Scene::DrawScene()
     CHECKERROR;
 
     // bind texture
-    G_Buffer->BindTexture(0, programId, "g_buffer_world_pos");
-    G_Buffer->BindTexture(1, programId, "g_buffer_world_norm");
-    G_Buffer->BindTexture(2, programId, "g_buffer_diffuse_color");
-    G_Buffer->BindTexture(3, programId, "g_buffer_specular_color");
+    G_Buffer->BindTexture(0, program, "g_buffer_depth");
+    G_Buffer->BindTexture(1, program, "g_buffer_world_norm");
+    G_Buffer->BindTexture(2, program, "g_buffer_diffuse_color");
+    G_Buffer->BindTexture(3, program, "g_buffer_specular_color");
     CHECKERROR;
 
     // for BRDF
-    loc = glGetUniformLocation(programId, "WorldInverse");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldInverse));
-    loc = glGetUniformLocation(programId, "lightPos");
-    glUniform3fv(loc, 1, &(lightPos[0]));
-    loc = glGetUniformLocation(programId, "lightVal");
-    glUniform3fv(loc, 1, &(lightVal[0]));
-    loc = glGetUniformLocation(programId, "lightAmb");
-    glUniform3fv(loc, 1, &(lightAmb[0]));
+    program->Set(shLightPos, lightPos);
+    program->Set(shLightVal, lightVal);
+    program->Set(shLightAmb, lightAmb);
 
     // for final output
-    loc = glGetUniformLocation(programId, "width");
-    glUniform1ui(loc, width);
-    loc = glGetUniformLocation(programId, "height");
-    glUniform1ui(loc, height);
-    loc = glGetUniformLocation(programId, "ID");
-    glUniform1i(loc, drawID);
-    loc = glGetUniformLocation(programId, "Toggle");
-    glUniform1i(loc, flipToggle);
+    program->Set(shID, drawID);
+    program->Set(shToggle, flipToggle);
     CHECKERROR;
 
     screen->DrawVAO();
@@ -519,6 +714,7 @@ void Scene::DrawScene()
 
     // Turn off the shader
     lightingProgram->UnuseShader();
+    glDepthFunc(GL_LESS);
 
     ///////////////////////
     // Local Lights pass //
@@ -532,43 +728,62 @@ void Scene::DrawScene()
     glEnable(GL_CULL_FACE);
     glCullFace(GL_BACK);
 
-    // Choose Shader
-    localLightsProgram->UseShader();
-    programId = localLightsProgram->programId;
+    // Choose Shader:  one full screen pass over the clustered lights, or
+    // a volume per light
+    program = useClusters ? clusteredProgram : localLightsProgram;
+    program->UseShader();
 
     // bind texture
-    G_Buffer->BindTexture(0, programId, "g_buffer_world_pos");
-    G_Buffer->BindTexture(1, programId, "g_buffer_world_norm");
-    G_Buffer->BindTexture(2, programId, "g_buffer_diffuse_color");
-    G_Buffer->BindTexture(3, programId, "g_buffer_specular_color");
+    G_Buffer->BindTexture(0, program, "g_buffer_depth");
+    G_Buffer->BindTexture(1, program, "g_buffer_world_norm");
+    G_Buffer->BindTexture(2, program, "g_buffer_diffuse_color");
+    G_Buffer->BindTexture(3, program, "g_buffer_specular_color");
     CHECKERROR;
 
     // Set the viewport
     glViewport(0, 0, width, height);
     CHECKERROR;
 
-    loc = glGetUniformLocation(programId, "WorldProj");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldProj));
-    loc = glGetUniformLocation(programId, "WorldView");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldView));
-    CHECKERROR;
-
-    // For BRDF
-    loc = glGetUniformLocation(programId, "WorldInverse");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldInverse));
-    CHECKERROR;
-
-    loc = glGetUniformLocation(programId, "width");
-    glUniform1ui(loc, width);
-    loc = glGetUniformLocation(programId, "height");
-    glUniform1ui(loc, height);
-    CHECKERROR;
-
-    loc = glGetUniformLocation(programId, "debugLocalLight");
-    glUniform1i(loc, debugToggle);
+    program->Set(shDebugLocalLight, debugToggle);
     CHECKERROR;
 
-    lightsRoot->Draw(localLightsProgram, Identity);
+    if (useClusters) {
+        clusters->Build(*lightNodes, WorldView, (ry*width)/height, ry, front,
+                        (mode==0) ? 1000 : back, width, height);
+        clusters->Bind(program);
+        screen->DrawVAO();
+        clusters->Unbind(); }
+    else if (useStencil) {
+        // Count, in the stencil buffer, the volumes each pixel's
+        // geometry is inside of:  one whose back face is behind the
+        // geometry, but not its front face.
+        glEnable(GL_STENCIL_TEST);
+        glClear(GL_STENCIL_BUFFER_BIT);
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_FALSE);
+        glDisable(GL_CULL_FACE);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glStencilFunc(GL_ALWAYS, 0, 0xFF);
+        glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+        glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+        renderQueue->Submit(rqLightStencilPass);
+        CHECKERROR;
+
+        // Then shade only the counted pixels, from the back faces, so
+        // a volume around the eye is still drawn
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDisable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_FRONT);
+        glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        renderQueue->Submit(rqLocalLightsPass);
+
+        glCullFace(GL_BACK);
+        glDisable(GL_STENCIL_TEST); }
+    else
+        renderQueue->Submit(rqLocalLightsPass);
     CHECKERROR;
 
     // unbind textures
@@ -579,5 +794,16 @@ void Scene::DrawScene()
     CHECKERROR;
 
     // Turn off the shader
-    localLightsProgram->UnuseShader();
+    program->UnuseShader();
+
+    // Compare the GL output with the software pipeline's, once per request
+    if (validateEmulator) {
+        validateEmulator = false;
+        std::vector<float> pixels(4*width*height);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, &pixels[0]);
+        CHECKERROR;
+        emulator->DrawScene(*this);
+        EmCompare c = emulator->Compare(pixels, 4.0f/255.0f);
+        printf("Software pipeline: %d of %d pixels differ, max error %f, mean error %f\n",
+               c.differing, c.pixels, c.maxError, c.meanError); }
 }
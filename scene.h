@@ -33,6 +33,14 @@ enum ObjectIds {
 };
 
 class Shader;
+class Emulator;
+class OcclusionCuller;
+class ChunkedGround;
+class InstanceBatcher;
+class FlatHierarchy;
+class RenderQueue;
+class BoundingVolumes;
+class LightClusters;
 
 
 class Scene
@@ -78,13 +86,23 @@ public:
     Object* lightsRoot;
     Object* localLight1, *localLight2, *localLight3;
 
+    // Flattened copies of the two hierarchies, which are drawn (hierarchy.cpp)
+    FlatHierarchy* objectNodes;
+    FlatHierarchy* lightNodes;
+
+    // Frustum culling of the objects, through a BVH of their bounds (bvh.cpp)
+    bool frustumCull;
+    BoundingVolumes* objectBounds;
+
     std::vector<Object*> animated;
-    ProceduralGround* proceduralground;
+    ChunkedGround* proceduralground;     // Chunked LOD terrain (terrain.cpp)
 
     // Shader programs
     ShaderProgram* gbufferProgram;
     ShaderProgram* lightingProgram;
     ShaderProgram* localLightsProgram;
+    ShaderProgram* lightStencilProgram;
+    ShaderProgram* clusteredProgram;
 
 
     // Options menu stuff
@@ -97,8 +115,33 @@ public:
     Shape* screen;
     bool debugToggle;
 
+    // Software pipeline (emulator.cpp), drawn instead of the GL passes when emulate is set
+    bool emulate;
+    Emulator* emulator;
+    FBO* emulatorOutput;
+    bool validateEmulator;      // Compare the next GL frame with the software pipeline's
+
+    // Hierarchical-Z occlusion culling of the G-buffer pass (occlusion.cpp)
+    bool occlusionCull;
+    OcclusionCuller* occlusion;
+
+    // Instanced drawing of the objects and of the light volumes (instancing.cpp)
+    bool instancing;
+    bool multiDraw;             // The objects' batches with glMultiDrawElementsIndirect
+    InstanceBatcher* objectBatches;
+    InstanceBatcher* lightBatches;
+
+    // The frame's draws of both passes, sorted by state (renderqueue.cpp)
+    RenderQueue* renderQueue;
+
+    // Clustered shading of the local lights (clusters.cpp)
+    bool clustered;
+    bool stencilLights;         // Light volumes shade only the geometry inside them (with clustered off)
+    LightClusters* clusters;
+
     void InitializeScene();
     void BuildTransforms();
+    void AddLocalLights(const int count);
     void DrawMenu();
     void DrawScene();
 
@@ -8,13 +8,26 @@
 ////////////////////////////////////////////////////////////////////////
 
 #include <fstream>
+#include <string.h>
 
 #include <glbinding/gl/gl.h>
 #include <glbinding/Binding.h>
 using namespace gl;
 
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
 #include "shader.h"
 
+// The names of the UniformName enum's uniforms, in its order
+static const char* shUniformNames[shUniformCount] = {
+    "packedVertices", "posOffset", "posScale", "instanced",
+    "isLight", "lightPos", "lightVal", "lightAmb", "lightRange",
+    "ID", "Toggle", "debugLocalLight",
+    "tileSize", "tilesX", "tilesY", "slices", "sliceScale", "sliceBias"
+};
+
 // Reads a specified file into a string and returns the string.  The
 // file is examined first to determine the needed string size.
 char* ReadFile(const char* name)
@@ -37,6 +50,8 @@ char* ReadFile(const char* name)
 ShaderProgram::ShaderProgram()
 { 
     programId = glCreateProgram();
+    for (int u=0;  u<shUniformCount;  u++)
+        named[u] = -1;
 }
 
 // Use a shader program
@@ -101,4 +116,70 @@ void ShaderProgram::LinkProgram()
         printf("Link log:\n%s\n", buffer);
         delete buffer;
     }
+
+    Reflect();
+}
+
+// Look up the locations of all the active uniforms (except those in
+// uniform blocks, which have none).  Arrays are known by their names
+// without the "[0]".
+void ShaderProgram::Reflect()
+{
+    uniforms.clear();
+    byName.clear();
+    int count, maxLength;
+    glGetProgramiv(programId, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(programId, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+    std::vector<char> buffer(maxLength+1);
+    for (int i=0;  i<count;  i++) {
+        GLsizei length;
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(programId, i, maxLength+1, &length, &size, &type, &buffer[0]);
+        std::string name(&buffer[0], length);
+        if (name.size() > 3 && name.compare(name.size()-3, 3, "[0]") == 0)
+            name.resize(name.size()-3);
+
+        Uniform u;
+        u.location = glGetUniformLocation(programId, name.c_str());
+        u.set = false;
+        if (u.location < 0)
+            continue;
+        byName[name] = (int)uniforms.size();
+        uniforms.push_back(u); }
+
+    for (int u=0;  u<shUniformCount;  u++) {
+        std::unordered_map<std::string,int>::iterator i = byName.find(shUniformNames[u]);
+        named[u] = i == byName.end() ? -1 : i->second; }
+}
+
+ShaderProgram::Uniform* ShaderProgram::Find(const std::string& name)
+{
+    std::unordered_map<std::string,int>::iterator i = byName.find(name);
+    return i == byName.end() ? NULL : &uniforms[i->second];
+}
+
+int ShaderProgram::Location(const UniformName u) const
+{
+    return named[u] < 0 ? -1 : uniforms[named[u]].location;
+}
+
+int ShaderProgram::Location(const std::string& name)
+{
+    Uniform* u = Find(name);
+    return u ? u->location : -1;
+}
+
+// Whether a uniform is active and the value differs from its last, in
+// which case the value is remembered.
+bool ShaderProgram::Changed(Uniform* u, const void* value, const int bytes)
+{
+    if (!u)
+        return false;
+    if (u->set && memcmp(u->value, value, bytes) == 0)
+        return false;
+    memcpy(u->value, value, bytes);
+    u->set = true;
+    return true;
 }
@@ -5,16 +5,78 @@
 // loaded (method "Use"), its vertex shader and pixel shader will be
 // invoked for all geometry passing through the graphics pipeline.
 // When done, unload it with method "Unuse".
+//
+// After linking, the program's active uniforms are looked up once:
+// their locations are kept in a table by name, and the uniforms the
+// code sets every frame also by a UniformName, which finds them with
+// no string lookup at all.  The Set methods (for the program in use)
+// remember each uniform's value, and skip the upload if it is
+// unchanged.
 ////////////////////////////////////////////////////////////////////////
 
+#ifndef _SHADER
+#define _SHADER
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// The uniforms set by name, in the order of shUniformNames in shader.cpp
+// (The frame's and objects' transformations and colors are in uniform
+// blocks instead;  see ubo.h.)
+enum UniformName {
+    shPackedVertices, shPosOffset, shPosScale, shInstanced,
+    shIsLight, shLightPos, shLightVal, shLightAmb, shLightRange,
+    shID, shToggle, shDebugLocalLight,
+    shTileSize, shTilesX, shTilesY, shSlices, shSliceScale, shSliceBias,
+    shUniformCount
+};
+
 class ShaderProgram
 {
+    // An active uniform, and the last value set (up to a mat4)
+    struct Uniform
+    {
+        int location;
+        bool set;
+        float value[16];
+    };
+    std::vector<Uniform> uniforms;
+    std::unordered_map<std::string,int> byName;  // Index in uniforms
+    int named[shUniformCount];                    // Index in uniforms, or -1 if not active
+
+    void Reflect();
+    Uniform* Find(const std::string& name);
+    Uniform* Find(const UniformName u) { return named[u] < 0 ? NULL : &uniforms[named[u]]; }
+    bool Changed(Uniform* u, const void* value, const int bytes);
+
 public:
     int programId;
-    
+
     ShaderProgram();
     void AddShader(const char* fileName, const GLenum type);
     void LinkProgram();
     void UseShader();
     void UnuseShader();
+
+    // A uniform's location, or -1 if it is not active
+    int Location(const UniformName u) const;
+    int Location(const std::string& name);
+
+    // Set a uniform of the program in use, if it is active and its
+    // value changed.  (Booleans and samplers are set as ints.)
+    template<class N> void Set(const N& u, const int v)
+        { Uniform* p = Find(u);  if (Changed(p, &v, sizeof(v))) glUniform1i(p->location, v); }
+    template<class N> void Set(const N& u, const unsigned int v)
+        { Uniform* p = Find(u);  if (Changed(p, &v, sizeof(v))) glUniform1ui(p->location, v); }
+    template<class N> void Set(const N& u, const float v)
+        { Uniform* p = Find(u);  if (Changed(p, &v, sizeof(v))) glUniform1f(p->location, v); }
+    template<class N> void Set(const N& u, const glm::vec3& v)
+        { Uniform* p = Find(u);  if (Changed(p, &v, sizeof(v))) glUniform3fv(p->location, 1, &v[0]); }
+    template<class N> void Set(const N& u, const glm::mat3& v)
+        { Uniform* p = Find(u);  if (Changed(p, &v, sizeof(v))) glUniformMatrix3fv(p->location, 1, GL_FALSE, &v[0][0]); }
+    template<class N> void Set(const N& u, const glm::mat4& v)
+        { Uniform* p = Find(u);  if (Changed(p, &v, sizeof(v))) glUniformMatrix4fv(p->location, 1, GL_FALSE, &v[0][0]); }
 };
+
+#endif
@@ -24,6 +24,13 @@ float pi2 = 2*pi;
 
 in vec3 eyePos;
 
+// The frame's values, shared by all the programs (see FrameBlock in ubo.h)
+layout(std140) uniform FrameBlock
+{
+    mat4 WorldProj, WorldView, WorldInverse, ViewProjInverse;
+    uint width, height;
+};
+
 // lighting data
 uniform vec3  lightPos;
 uniform vec3  lightVal;
@@ -33,19 +40,45 @@ uniform float lightRange;
 uniform bool isLight;
 uniform bool debugLocalLight;
 
-vec3 BRDF(vec3 Pos, vec3 N, vec3 Kd, vec3 Ks, float alpha)
+// Decoding of the compact G-buffer (see FBO::CreateGBuffer).  The
+// world position is the pixel's depth, unprojected.
+vec3 GBufferPosition(vec2 uv, float depth)
+{
+    vec4 P = ViewProjInverse*vec4(2.0*uv - 1.0, 2.0*depth - 1.0, 1.0);
+    return P.xyz/P.w;
+}
+
+vec3 GBufferNormal(vec2 e)
+{
+    e = 2.0*e - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+float GBufferShininess(float a)
+{
+    return 255.0*a;
+}
+
+// The BRDF for a light given by its position, values and range
+// (whose attenuation applies if local)
+vec3 LightBRDF(vec3 Pos, vec3 N, vec3 Kd, vec3 Ks, float alpha,
+               vec3 lPos, vec3 lVal, vec3 lAmb, float lRange, bool local)
 {
-    vec3 L = normalize(lightPos - Pos);
+    vec3 L = normalize(lPos - Pos);
     vec3 V = normalize(eyePos   - Pos);
     vec3 H = normalize(L + V);  
-    vec3 Ii = lightVal;
-    vec3 Ia = lightAmb;
+    vec3 Ii = lVal;
+    vec3 Ia = lAmb;
 
 
-    float dist = distance(lightPos, Pos);
-    if(isLight) {
-      if(dist <= lightRange && dist > 0.001) {
-        float attenuation = (1.0 / (dist * dist)  - 1.0 / (lightRange * lightRange));
+    float dist = distance(lPos, Pos);
+    if(local) {
+      if(dist <= lRange && dist > 0.001) {
+        float attenuation = (1.0 / (dist * dist)  - 1.0 / (lRange * lRange));
         Ii *= attenuation;
       }
       /*else {
@@ -97,3 +130,9 @@ vec3 BRDF(vec3 Pos, vec3 N, vec3 Kd, vec3 Ks, float alpha)
 
     return Ia * Kd + Ii * LdotN * BRDF_part;
 }
+
+// The BRDF for the light in the uniforms
+vec3 BRDF(vec3 Pos, vec3 N, vec3 Kd, vec3 Ks, float alpha)
+{
+    return LightBRDF(Pos, N, Kd, Ks, alpha, lightPos, lightVal, lightAmb, lightRange, isLight);
+}
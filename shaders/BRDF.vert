@@ -2,7 +2,12 @@
 
 out vec3 eyePos;
 
-uniform mat4 WorldInverse;
+// The frame's values, shared by all the programs (see FrameBlock in ubo.h)
+layout(std140) uniform FrameBlock
+{
+    mat4 WorldProj, WorldView, WorldInverse, ViewProjInverse;
+    uint width, height;
+};
 
 void BRDF()
 {
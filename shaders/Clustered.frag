@@ -0,0 +1,70 @@
+/////////////////////////////////////////////////////////////////////////
+// Pixel shader for the local lights, clustered (see clusters.h):  each
+// pixel adds up the lights binned into its cluster.
+////////////////////////////////////////////////////////////////////////
+#version 330
+
+out vec4 FragColor;
+
+// The frame's values, shared by all the programs (see FrameBlock in ubo.h)
+layout(std140) uniform FrameBlock
+{
+    mat4 WorldProj, WorldView, WorldInverse, ViewProjInverse;
+    uint width, height;
+};
+
+uniform sampler2D g_buffer_depth;
+uniform sampler2D g_buffer_world_norm;
+uniform sampler2D g_buffer_diffuse_color;
+uniform sampler2D g_buffer_specular_color;
+
+// The clusters' lights
+uniform samplerBuffer clusterLights;    // Position and range, value, ambient
+uniform usamplerBuffer clusterRanges;   // Offset and count of each cluster's lights
+uniform usamplerBuffer clusterIndices;
+uniform int tileSize, tilesX, tilesY, slices;
+uniform float sliceScale, sliceBias;
+
+uniform bool debugLocalLight;
+
+vec3 LightBRDF(vec3 Pos, vec3 N, vec3 Kd, vec3 Ks, float alpha,
+               vec3 lPos, vec3 lVal, vec3 lAmb, float lRange, bool local);
+vec3 GBufferPosition(vec2 uv, float depth);
+vec3 GBufferNormal(vec2 e);
+float GBufferShininess(float a);
+
+void main()
+{
+    vec2 uv         = gl_FragCoord.xy / vec2(width, height);
+    float depth     = texture(g_buffer_depth, uv).x;
+    vec3 pos        = GBufferPosition(uv, depth);
+
+    // The pixel's cluster
+    float viewDepth = -(WorldView*vec4(pos, 1.0)).z;
+    int slice       = clamp(int(floor(log(viewDepth)*sliceScale + sliceBias)), 0, slices-1);
+    ivec2 tile      = min(ivec2(gl_FragCoord.xy) / tileSize, ivec2(tilesX-1, tilesY-1));
+    uvec2 range     = texelFetch(clusterRanges, (slice*tilesY + tile.y)*tilesX + tile.x).xy;
+
+    if (debugLocalLight) {
+        FragColor = vec4(float(range.y)/16.0, 0.0, 0.0, 0.0);
+        return; }
+    if (range.y == 0u || depth == 1.0) {
+        FragColor = vec4(0.0);
+        return; }
+
+    vec3 Normal_d   = GBufferNormal(texture(g_buffer_world_norm, uv).xy);
+    vec3 Kd_d       = texture(g_buffer_diffuse_color,  uv).xyz;
+    vec4 Ks_d       = texture(g_buffer_specular_color, uv);
+    float alpha     = GBufferShininess(Ks_d.w);
+
+    vec3 sum = vec3(0.0);
+    for (uint i=0u;  i<range.y;  i++) {
+        int l = 3*int(texelFetch(clusterIndices, int(range.x + i)).x);
+        vec4 lPos = texelFetch(clusterLights, l);
+        if (distance(lPos.xyz, pos) > lPos.w)
+            continue;
+        sum += LightBRDF(pos, Normal_d, Kd_d, Ks_d.xyz, alpha, lPos.xyz,
+                         texelFetch(clusterLights, l+1).xyz, texelFetch(clusterLights, l+2).xyz,
+                         lPos.w, true); }
+    FragColor = vec4(sum, 0.0);
+}
@@ -3,20 +3,29 @@
 ////////////////////////////////////////////////////////////////////////
 #version 330
 
-out vec4 FragColor[];
+// The targets of the compact G-buffer (see FBO::CreateGBuffer):  the
+// normal, octahedrally encoded;  Kd;  Ks and shininess/255.  The
+// position is recovered from depth.
+out vec4 FragColor[3];
 
 in vec3 normalVec;
 in vec2 texCoord;
-in vec3 worldPos;
+flat in vec3 diffuseVal;
+flat in vec4 specularVal;
 
-uniform vec3 diffuse;
-uniform vec3 specular;
-uniform float shininess;
+// Map a direction onto the octahedron |x|+|y|+|z| = 1, unfold its
+// lower half over the upper one, and scale that square to 0..1.
+vec2 OctEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.z >= 0.0 ? n.xy
+                        : (1.0 - abs(n.yx))*vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return 0.5*e + 0.5;
+}
 
 void main()
 {
-    FragColor[0].xyz = worldPos;
-    FragColor[1].xyz = normalVec;
-    FragColor[2].xyz = diffuse;
-    FragColor[3]     = vec4(specular, shininess);
+    FragColor[0]     = vec4(OctEncode(normalVec), 0.0, 0.0);
+    FragColor[1]     = vec4(diffuseVal, 1.0);
+    FragColor[2]     = vec4(specularVal.xyz, specularVal.w/255.0);
 }
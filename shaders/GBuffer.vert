@@ -5,21 +5,62 @@
 ////////////////////////////////////////////////////////////////////////
 #version 330
 
-uniform mat4 WorldView, WorldInverse, WorldProj, ModelTr, NormalTr;
+// The frame's values, shared by all the programs (see FrameBlock in ubo.h)
+layout(std140) uniform FrameBlock
+{
+    mat4 WorldProj, WorldView, WorldInverse, ViewProjInverse;
+    uint width, height;
+};
+
+// The object's values (see ObjectBlock in ubo.h)
+layout(std140) uniform ObjectBlock
+{
+    mat4 ModelTr;
+    mat3 NormalTr;
+    vec3 diffuse;
+    float shininess;
+    vec3 specular;
+    int objectId;
+};
+
+// The shape's vertex format (see VertexFormat in shapes.h):  packed
+// normals are octahedrally encoded, and positions are posOffset +
+// posScale*vertex.
+uniform bool packedVertices;
+uniform vec3 posOffset, posScale;
+
+// When instanced, the transformations and colors come from the
+// instance attributes instead (see InstanceData in instancing.h).
+uniform bool instanced;
 
 in vec4 vertex;
 in vec3 vertexNormal;
 in vec2 vertexTexture;
 in vec3 vertexTangent;
 
+in mat4 instanceTr;
+in mat3 instanceNormalTr;
+in vec3 instanceDiffuse;
+in vec4 instanceSpecular;
+
 out vec3 normalVec;
-out vec3 worldPos;
+flat out vec3 diffuseVal;
+flat out vec4 specularVal;
+
+vec3 OctDecode(vec2 e);
 
 void main()
 {
-    gl_Position = WorldProj*WorldView*ModelTr*vertex;
-    
-    worldPos = (ModelTr*vertex).xyz;
+    vec4 P = vec4(posOffset + posScale*vertex.xyz, vertex.w);
+    vec3 N = packedVertices ? OctDecode(vertexNormal.xy) : vertexNormal;
+
+    mat4 M = instanced ? instanceTr : ModelTr;
+    mat3 NM = instanced ? instanceNormalTr : NormalTr;
+
+    gl_Position = WorldProj*WorldView*M*P;
+
+    normalVec = N*NM; 
 
-    normalVec = vertexNormal*mat3(NormalTr); 
+    diffuseVal = instanced ? instanceDiffuse : diffuse;
+    specularVal = instanced ? instanceSpecular : vec4(specular, shininess);
 }
@@ -0,0 +1,12 @@
+/////////////////////////////////////////////////////////////////////////
+// Pixel shader for marking the light volumes in the stencil buffer:
+// only the stencil operations matter, so nothing is computed.
+////////////////////////////////////////////////////////////////////////
+#version 330
+
+out vec4 FragColor;
+
+void main()
+{
+    FragColor = vec4(0.0);
+}
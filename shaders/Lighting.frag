@@ -6,26 +6,44 @@
 out vec4 FragColor;
 
 
-uniform sampler2D g_buffer_world_pos;
+uniform sampler2D g_buffer_depth;
 uniform sampler2D g_buffer_world_norm;
 uniform sampler2D g_buffer_diffuse_color;
 uniform sampler2D g_buffer_specular_color;
 
-uniform uint width, height;
+// The frame's values, shared by all the programs (see FrameBlock in ubo.h)
+layout(std140) uniform FrameBlock
+{
+    mat4 WorldProj, WorldView, WorldInverse, ViewProjInverse;
+    uint width, height;
+};
 
 // config
 uniform int ID;
 uniform int Toggle;
 uniform vec3  lightAmb;
 vec3 BRDF(vec3 Pos, vec3 N, vec3 Kd, vec3 Ks, float alpha);
+vec3 GBufferPosition(vec2 uv, float depth);
+vec3 GBufferNormal(vec2 e);
+float GBufferShininess(float a);
 
 void main()
 {
     vec2 uv         = gl_FragCoord.xy / vec2(width, height);
-    vec4 WorldPos_d = texture(g_buffer_world_pos,      uv);
-    vec4 Normal_d   = texture(g_buffer_world_norm,     uv);
+    float depth     = texture(g_buffer_depth, uv).x;
+
+    // Nothing was drawn here:  leave the screen's clear color (and depth)
+    if (depth == 1.0)
+        discard;
+
+    // Copy the scene's depth to the screen, for the light volumes'
+    // stencil test
+    gl_FragDepth = depth;
+    vec4 WorldPos_d = vec4(GBufferPosition(uv, depth), 1.0);
+    vec4 Normal_d   = vec4(GBufferNormal(texture(g_buffer_world_norm, uv).xy), 0.0);
     vec4 Kd_d       = texture(g_buffer_diffuse_color,  uv);
     vec4 Ks_d       = texture(g_buffer_specular_color, uv);
+    Ks_d.w          = GBufferShininess(Ks_d.w);
 
     switch( ID )
     {
@@ -44,7 +62,7 @@ void main()
         FragColor = Kd_d;
         return;
       case 4:
-        FragColor = Ks_d;
+        FragColor = vec4(Ks_d.xyz, Ks_d.w/255.0);
         return;
     }
  
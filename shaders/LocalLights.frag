@@ -4,25 +4,46 @@ out vec4 FragColor;
 
 in vec3 normalVec;
 in vec3 worldPos;
+flat in vec3 lightPosVal;
+flat in vec3 lightValVal;
+flat in vec3 lightAmbVal;
+flat in float lightRangeVal;
 
-uniform uint width, height;
+// The frame's values, shared by all the programs (see FrameBlock in ubo.h)
+layout(std140) uniform FrameBlock
+{
+    mat4 WorldProj, WorldView, WorldInverse, ViewProjInverse;
+    uint width, height;
+};
 
-uniform sampler2D g_buffer_world_pos;
+uniform sampler2D g_buffer_depth;
 uniform sampler2D g_buffer_world_norm;
 uniform sampler2D g_buffer_diffuse_color;
 uniform sampler2D g_buffer_specular_color;
 
-vec3 BRDF(vec3 Pos, vec3 N, vec3 Kd, vec3 Ks, float alpha);
+vec3 LightBRDF(vec3 Pos, vec3 N, vec3 Kd, vec3 Ks, float alpha,
+               vec3 lPos, vec3 lVal, vec3 lAmb, float lRange, bool local);
+vec3 GBufferPosition(vec2 uv, float depth);
+vec3 GBufferNormal(vec2 e);
+float GBufferShininess(float a);
 
 void main()
 {   
     // get position
     vec2 uv         = gl_FragCoord.xy / vec2(width, height);
-    vec3 pos        = texture(g_buffer_world_pos,      uv).xyz;
+    float depth     = texture(g_buffer_depth, uv).x;
+    vec3 pos        = GBufferPosition(uv, depth);
+
+    // Only the geometry within the light's range is lit, and not the
+    // background.  (Another light's volume may have let this pixel
+    // through the stencil.)
+    if (depth == 1.0 || distance(pos, lightPosVal) > lightRangeVal)
+        discard;
     
-    vec3 Normal_d   = texture(g_buffer_world_norm,     uv).xyz;
+    vec3 Normal_d   = GBufferNormal(texture(g_buffer_world_norm, uv).xy);
     vec3 Kd_d       = texture(g_buffer_diffuse_color,  uv).xyz;
     vec4 Ks_d       = texture(g_buffer_specular_color, uv);
       
-    FragColor.xyz += BRDF(pos, Normal_d, Kd_d, Ks_d.xyz, Ks_d.w);         
+    FragColor.xyz += LightBRDF(pos, Normal_d, Kd_d, Ks_d.xyz, GBufferShininess(Ks_d.w),
+                               lightPosVal, lightValVal, lightAmbVal, lightRangeVal, true);         
 }
@@ -5,18 +5,69 @@
 ////////////////////////////////////////////////////////////////////////
 #version 330
 
-uniform mat4 WorldView, WorldInverse, WorldProj, ModelTr, NormalTr;
+// The frame's values, shared by all the programs (see FrameBlock in ubo.h)
+layout(std140) uniform FrameBlock
+{
+    mat4 WorldProj, WorldView, WorldInverse, ViewProjInverse;
+    uint width, height;
+};
+
+// The object's values (see ObjectBlock in ubo.h)
+layout(std140) uniform ObjectBlock
+{
+    mat4 ModelTr;
+    mat3 NormalTr;
+    vec3 diffuse;
+    float shininess;
+    vec3 specular;
+    int objectId;
+};
+
+// The shape's vertex format, as in GBuffer.vert
+uniform bool packedVertices;
+uniform vec3 posOffset, posScale;
+
+// The light, from these uniforms or, when instanced, from the
+// instance attributes (see InstanceData in instancing.h)
+uniform bool instanced;
+uniform vec3  lightPos;
+uniform vec3  lightVal;
+uniform vec3  lightAmb;
+uniform float lightRange;
 
 in vec4 vertex;
 in vec3 vertexNormal;
 
+in mat4 instanceTr;
+in mat3 instanceNormalTr;
+in vec3 instanceDiffuse;
+in vec4 instanceSpecular;
+in vec4 instanceLight;
+
 out vec3 normalVec;
+flat out vec3 lightPosVal;
+flat out vec3 lightValVal;
+flat out vec3 lightAmbVal;
+flat out float lightRangeVal;
 
 void BRDF();
 
+vec3 OctDecode(vec2 e);
+
 void main()
 {
-    gl_Position = WorldProj*WorldView*ModelTr*vertex;
+    vec4 P = vec4(posOffset + posScale*vertex.xyz, vertex.w);
+    vec3 N = packedVertices ? OctDecode(vertexNormal.xy) : vertexNormal;
+
+    mat4 M = instanced ? instanceTr : ModelTr;
+    mat3 NM = instanced ? instanceNormalTr : NormalTr;
+
+    gl_Position = WorldProj*WorldView*M*P;
+
+    normalVec = N*NM; 
 
-    normalVec = vertexNormal*mat3(NormalTr); 
+    lightPosVal = instanced ? instanceLight.xyz : lightPos;
+    lightValVal = instanced ? instanceDiffuse : lightVal;
+    lightAmbVal = instanced ? instanceSpecular.xyz : lightAmb;
+    lightRangeVal = instanced ? instanceLight.w : lightRange;
 }
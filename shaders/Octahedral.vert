@@ -0,0 +1,15 @@
+/////////////////////////////////////////////////////////////////////////
+// Decoding of the packed vertex format's normals (see OctEncode in
+// shapes.cpp), linked into every program whose vertex shader reads it
+////////////////////////////////////////////////////////////////////////
+#version 330
+
+vec3 OctDecode(vec2 e)
+{
+    e /= 32767.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
@@ -23,6 +23,7 @@
 #include <vector>
 #include <fstream>
 #include <stdlib.h>
+#include <string.h>
 
 #include <glbinding/gl/gl.h>
 #include <glbinding/Binding.h>
@@ -40,6 +41,9 @@ using namespace gl;
 #include "shapes.h"
 #include "rply.h"
 #include "simplexnoise.h"
+#include "workers.h"
+#include "meshopt.h"
+#include "arena.h"
 
 const float PI = 3.14159f;
 const float rad = PI/180.0f;
@@ -50,68 +54,248 @@ void pushquad(std::vector<glm::ivec3> &Tri, int i, int j, int k, int l)
     Tri.push_back(glm::ivec3(i,k,l));
 }
 
-// Batch up all the data defining a shape to be drawn (example: the
-// teapot) as a Vertex Array object (VAO) and send it to the graphics
-// card.  Return an OpenGL identifier for the created VAO.
-unsigned int VaoFromTris(std::vector<glm::vec4> Pnt,
-                         std::vector<glm::vec3> Nrm,
-                         std::vector<glm::vec2> Tex,
-                         std::vector<glm::vec3> Tan,
-                         std::vector<glm::ivec3> Tri)
-{
-    printf("VaoFromTris %ld %ld\n", Pnt.size(), Tri.size());
-    unsigned int vaoID;
-    glGenVertexArrays(1, &vaoID);
-    glBindVertexArray(vaoID);
-
-    GLuint Pbuff;
-    glGenBuffers(1, &Pbuff);
-    glBindBuffer(GL_ARRAY_BUFFER, Pbuff);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float)*4*Pnt.size(),
-                 &Pnt[0][0], GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+// The same, into the two triangles starting at Tri[q] of a pre-sized
+// list, so that separate threads may fill separate quads.
+void setquad(std::vector<glm::ivec3> &Tri, int q, int i, int j, int k, int l)
+{
+    Tri[q]   = glm::ivec3(i,j,k);
+    Tri[q+1] = glm::ivec3(i,k,l);
+}
+
+// Octahedral encoding of a direction:  project it onto the octahedron
+// |x|+|y|+|z| = 1, fold the lower half out over the upper, and store
+// x and y as 16 bit fractions.  (A zero vector becomes +Z.)
+static void OctEncode(const glm::vec3& n, short* e)
+{
+    const float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    float x = l1 > 0.0f ? n.x/l1 : 0.0f;
+    float y = l1 > 0.0f ? n.y/l1 : 0.0f;
+    if (n.z < 0.0f) {
+        const float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        const float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy; }
+    e[0] = (short)roundf(glm::clamp(x, -1.0f, 1.0f)*32767.0f);
+    e[1] = (short)roundf(glm::clamp(y, -1.0f, 1.0f)*32767.0f);
+}
+
+// IEEE half float, rounded to nearest even
+static unsigned short FloatToHalf(const float f)
+{
+    unsigned int b;
+    memcpy(&b, &f, sizeof(b));
+    const unsigned int sign = (b>>16) & 0x8000;
+    const int e = (int)((b>>23) & 0xff) - 127 + 15;
+    unsigned int m = b & 0x7fffff;
+
+    if (((b>>23) & 0xff) == 0xff)                // Infinity or NaN
+        return sign | 0x7c00 | (m ? 0x200 : 0);
+    if (e >= 31)                                 // Too large
+        return sign | 0x7c00;
+
+    unsigned int h, rest, half;
+    if (e <= 0) {                                // Denormal, or zero
+        if (e < -10)
+            return sign;
+        m |= 0x800000;
+        const int shift = 14 - e;
+        h = m >> shift;
+        rest = m & ((1u<<shift) - 1);
+        half = 1u << (shift-1); }
+    else {
+        h = (e<<10) | (m>>13);
+        rest = m & 0x1fff;
+        half = 0x1000; }
+    if (rest > half || (rest == half && (h&1)))
+        h++;                                     // A carry correctly rounds up the exponent
+    return sign | h;
+}
+
+// A format's layout:  each attribute's components, their type, and
+// its size and offset within a vertex, in bytes.  Returns the stride.
+static int Layout(const VertexFormat format, const int attribs,
+                  int* sizes, GLenum* types, int* bytes, int* offsets)
+{
+    const int floatSizes[4] = { 4, 3, 2, 3 };
+    for (int a=0;  a<4;  a++) {
+        sizes[a] = floatSizes[a];
+        types[a] = GL_FLOAT;
+        bytes[a] = sizeof(float)*sizes[a]; }
+    if (format != vfFloat) {
+        sizes[0] = 3;
+        if (format == vfPacked) {
+            types[0] = GL_UNSIGNED_SHORT;
+            bytes[0] = 8; }                      // Padded to a multiple of 4
+        else
+            bytes[0] = 12;
+        sizes[1] = sizes[3] = 2;
+        types[1] = types[3] = GL_SHORT;
+        bytes[1] = bytes[3] = 4;
+        types[2] = GL_HALF_FLOAT;
+        bytes[2] = 4; }
+
+    int stride = 0;
+    for (int a=0;  a<4;  a++) {
+        offsets[a] = stride;
+        if (attribs & (1<<a))
+            stride += bytes[a]; }
+    return stride;
+}
+
+int VertexAttribs(const std::vector<glm::vec3>& Nrm,
+                  const std::vector<glm::vec2>& Tex,
+                  const std::vector<glm::vec3>& Tan)
+{
+    return 1 | (Nrm.size() > 0 ? 2 : 0) | (Tex.size() > 0 ? 4 : 0) | (Tan.size() > 0 ? 8 : 0);
+}
+
+int VertexStride(const VertexFormat format, const int attribs)
+{
+    int sizes[4], bytes[4], offsets[4];
+    GLenum types[4];
+    return Layout(format, attribs, sizes, types, bytes, offsets);
+}
+
+// The vertices are written one after another, as the destination is
+// usually a mapped buffer.
+void PackVertices(void* dst,
+                  const std::vector<glm::vec4>& Pnt,
+                  const std::vector<glm::vec3>& Nrm,
+                  const std::vector<glm::vec2>& Tex,
+                  const std::vector<glm::vec3>& Tan,
+                  const VertexFormat format,
+                  const glm::vec3& lo, const glm::vec3& hi)
+{
+    const int attribs = VertexAttribs(Nrm, Tex, Tan);
+    const bool has[4] = { true, (attribs&2) != 0, (attribs&4) != 0, (attribs&8) != 0 };
+    int sizes[4], bytes[4], offsets[4];
+    GLenum types[4];
+    const int stride = Layout(format, attribs, sizes, types, bytes, offsets);
+
+    const glm::vec3 extent = hi - lo;
+    char* p = (char*)dst;
+    for (int v=0;  v<Pnt.size();  v++, p += stride) {
+        if (format == vfFloat) {
+            memcpy(p, &Pnt[v][0], bytes[0]);
+            if (has[1]) memcpy(p + offsets[1], &Nrm[v][0], bytes[1]);
+            if (has[2]) memcpy(p + offsets[2], &Tex[v][0], bytes[2]);
+            if (has[3]) memcpy(p + offsets[3], &Tan[v][0], bytes[3]);
+            continue; }
+
+        if (format == vfPacked) {
+            unsigned short q[4] = { 0, 0, 0, 0 };
+            for (int c=0;  c<3;  c++)
+                if (extent[c] > 0.0f)
+                    q[c] = (unsigned short)roundf(glm::clamp((Pnt[v][c]-lo[c])/extent[c], 0.0f, 1.0f)*65535.0f);
+            memcpy(p, q, sizeof(q)); }
+        else
+            memcpy(p, &Pnt[v][0], bytes[0]);
+
+        short e[2];
+        unsigned short t[2];
+        if (has[1]) {
+            OctEncode(Nrm[v], e);
+            memcpy(p + offsets[1], e, sizeof(e)); }
+        if (has[2]) {
+            t[0] = FloatToHalf(Tex[v][0]);
+            t[1] = FloatToHalf(Tex[v][1]);
+            memcpy(p + offsets[2], t, sizeof(t)); }
+        if (has[3]) {
+            OctEncode(Tan[v], e);
+            memcpy(p + offsets[3], e, sizeof(e)); } }
+}
+
+// Integer attributes reach the shader as unnormalized floats, and
+// GBuffer.vert does the scaling.
+void VertexAttributes(const VertexFormat format, const int attribs)
+{
+    int sizes[4], bytes[4], offsets[4];
+    GLenum types[4];
+    const int stride = Layout(format, attribs, sizes, types, bytes, offsets);
+    for (int a=0;  a<4;  a++)
+        if (attribs & (1<<a)) {
+            glEnableVertexAttribArray(a);
+            glVertexAttribPointer(a, sizes[a], types[a], GL_FALSE, stride,
+                                  (const void*)(size_t)offsets[a]); }
+}
+
+// The attributes are written straight into the mapped buffer, so the
+// mesh is never copied on the way.
+unsigned int InterleavedBuffer(const std::vector<glm::vec4>& Pnt,
+                               const std::vector<glm::vec3>& Nrm,
+                               const std::vector<glm::vec2>& Tex,
+                               const std::vector<glm::vec3>& Tan,
+                               const VertexFormat format,
+                               const glm::vec3& lo, const glm::vec3& hi)
+{
+    const int attribs = VertexAttribs(Nrm, Tex, Tan);
+    const GLsizeiptr total = (GLsizeiptr)VertexStride(format, attribs)*Pnt.size();
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, total, NULL, GL_STATIC_DRAW);
+    void* dst = glMapBufferRange(GL_ARRAY_BUFFER, 0, total,
+                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    PackVertices(dst, Pnt, Nrm, Tex, Tan, format, lo, hi);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+
+    VertexAttributes(format, attribs);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return buffer;
+}
+
+// Triangles are taken in order, and a range is closed when the next
+// triangle would stretch its vertices beyond 65536.  Grids and patches
+// number their vertices row by row, so their triangles are local and
+// split into few ranges.  Only if a single triangle spans too far are
+// 32 bit indices used.
+int PackIndices(const std::vector<glm::ivec3>& Tri, std::vector<IndexRange>& ranges,
+                std::vector<unsigned char>& data)
+{
+    ranges.clear();
+    bool fits = true;
+    int lo = 0, hi = -1;
+    for (int t=0;  fits && t<Tri.size();  t++) {
+        const int tlo = std::min(Tri[t][0], std::min(Tri[t][1], Tri[t][2]));
+        const int thi = std::max(Tri[t][0], std::max(Tri[t][1], Tri[t][2]));
+        if (thi-tlo > 65535)
+            fits = false;
+        else if (ranges.empty() || std::max(hi, thi) - std::min(lo, tlo) > 65535) {
+            IndexRange r = { t, 0, tlo };
+            ranges.push_back(r);
+            lo = tlo;
+            hi = thi; }
+        else {
+            lo = std::min(lo, tlo);
+            hi = std::max(hi, thi); }
+        if (fits) {
+            // A range's base is its lowest vertex
+            ranges.back().baseVertex = lo;
+            ranges.back().count++; } }
+
+    if (!fits) {
+        IndexRange r = { 0, (int)Tri.size(), 0 };
+        ranges.assign(1, r);
+        data.resize(sizeof(int)*3*Tri.size());
+        memcpy(&data[0], &Tri[0][0], data.size());
+        return sizeof(int); }
+
+    data.resize(sizeof(unsigned short)*3*Tri.size());
+    unsigned short* indices = (unsigned short*)&data[0];
+    for (int r=0;  r<ranges.size();  r++)
+        for (int t=ranges[r].first;  t<ranges[r].first+ranges[r].count;  t++)
+            for (int c=0;  c<3;  c++)
+                indices[3*t + c] = (unsigned short)(Tri[t][c] - ranges[r].baseVertex);
+    return sizeof(unsigned short);
+}
+
+static unsigned int boundVAO = 0;
 
-    if (Nrm.size() > 0) {
-        GLuint Nbuff;
-        glGenBuffers(1, &Nbuff);
-        glBindBuffer(GL_ARRAY_BUFFER, Nbuff);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float)*3*Nrm.size(),
-                     &Nrm[0][0], GL_STATIC_DRAW);
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0); }
-
-    if (Tex.size() > 0) {
-        GLuint Tbuff;
-        glGenBuffers(1, &Tbuff);
-        glBindBuffer(GL_ARRAY_BUFFER, Tbuff);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float)*2*Tex.size(),
-                     &Tex[0][0], GL_STATIC_DRAW);
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0); }
-
-    if (Tan.size() > 0) {
-        GLuint Dbuff;
-        glGenBuffers(1, &Dbuff);
-        glBindBuffer(GL_ARRAY_BUFFER, Dbuff);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float)*3*Tan.size(),
-                     &Tan[0][0], GL_STATIC_DRAW);
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, 0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0); }
-
-    GLuint Ibuff;
-    glGenBuffers(1, &Ibuff);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, Ibuff);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int)*3*Tri.size(),
-                 &Tri[0][0], GL_STATIC_DRAW);
-
-    glBindVertexArray(0);
-
-    return vaoID;
+void BindVAO(const unsigned int vao)
+{
+    if (vao != boundVAO) {
+        glBindVertexArray(vao);
+        boundVAO = vao; }
 }
 
 void Shape::ComputeSize()
@@ -133,20 +317,50 @@ void Shape::ComputeSize()
     modelTr = Scale(s,s,s)*Translate(-center[0], -center[1], -center[2]);
 }
 
+// Reorder the mesh for the vertex caches (see meshopt.h), then add it
+// to the shared buffers (see arena.h).
 void Shape::MakeVAO()
 {
-    vaoID = VaoFromTris(Pnt, Nrm, Tex, Tan, Tri);
+    MeshCacheReport report;
+    report.name = "Mesh " + std::to_string(CacheReports().size());
+    report.triangles = (int)Tri.size();
+    MeshCacheStats(Tri, report.acmr[0], report.atvr[0]);
+    OptimizeMesh(Pnt, Nrm, Tex, Tan, Tri, true);
+    MeshCacheStats(Tri, report.acmr[1], report.atvr[1]);
+    CacheReports().push_back(report);
+
+    if (format == vfPacked) {
+        posOffset = minP;
+        posScale = (maxP-minP)/65535.0f; }
+    else {
+        posOffset = glm::vec3(0.0);
+        posScale = glm::vec3(1.0); }
+    Arena().Add(this);
     count = Tri.size();
 }
 
 void Shape::DrawVAO()
 {
     CHECKERROR;
-    glBindVertexArray(vaoID);
+    BindVAO(vaoID);
     CHECKERROR;
-    glDrawElements(GL_TRIANGLES, 3*count, GL_UNSIGNED_INT, 0);
+    const GLenum type = indexSize == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    for (int r=0;  r<ranges.size();  r++)
+        glDrawElementsBaseVertex(GL_TRIANGLES, 3*ranges[r].count, type,
+                                 (const void*)(indexOffset + (size_t)indexSize*3*ranges[r].first),
+                                 ranges[r].baseVertex);
+    CHECKERROR;
+}
+
+void Shape::DrawInstances(const int count)
+{
+    CHECKERROR;
+    const GLenum type = indexSize == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    for (int r=0;  r<ranges.size();  r++)
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, 3*ranges[r].count, type,
+                                          (const void*)(indexOffset + (size_t)indexSize*3*ranges[r].first),
+                                          count, ranges[r].baseVertex);
     CHECKERROR;
-    glBindVertexArray(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -304,8 +518,9 @@ glm::vec3 TeapotPoints[] = {
 ////////////////////////////////////////////////////////////////////////////////
 // Builds a Vertex Array Object for the Utah teapot.  Each of the 32
 // patches is represented by an n by n grid of quads triangulated.
-Teapot::Teapot(const int n)
+Teapot::Teapot(const int n, const VertexFormat _format)
 {
+    format = _format;
     diffuseColor = glm::vec3(0.5, 0.5, 0.1);
     specularColor = glm::vec3(1.0, 1.0, 1.0);
     shininess = 120.0;
@@ -661,8 +876,9 @@ int Ply::face_cb(p_ply_argument argument) {
 // Generates a plane with normals, texture coords, and tangent vectors
 // from an n by n grid of small quads.  A single quad might have been
 // sufficient, but that works poorly with the reflection map.
-Plane::Plane(const float r, const int n)
+Plane::Plane(const float r, const int n, const VertexFormat _format)
 {
+    format = _format;
     diffuseColor = glm::vec3(0.3, 0.2, 0.1);
     specularColor = glm::vec3(1.0, 1.0, 1.0);
     shininess = 120.0;
@@ -681,8 +897,8 @@ Plane::Plane(const float r, const int n)
                                       (i  )*(n+1) + (j),
                                       (i  )*(n+1) + (j-1)); } } }
 
-    vaoID = VaoFromTris(Pnt, Nrm, Tex, Tan, Tri);
-    count = Tri.size();
+    ComputeSize();
+    MakeVAO();
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -700,44 +916,183 @@ ProceduralGround::ProceduralGround(const float _range, const int n,
     shininess = 10.0;
     specularColor = glm::vec3(0.0, 0.0, 0.0);
     xoff = range*( time(NULL)%1000 );
-
-    float h = 0.001;
-    for (int i=0;  i<=n;  i++) {
+    cacheQuads = 0;
+
+    // The rows are independent, so they are generated in parallel on
+    // the shared worker pool, each directly into its place in the
+    // pre-sized arrays.  Row i also makes the quads between rows i-1
+    // and i.  Each row's heights and their gradients (for the normals)
+    // are found in a single batch.
+    const int m = n+1;
+    Pnt.resize(m*m);
+    Nrm.resize(m*m);
+    Tex.resize(m*m);
+    Tan.resize(m*m);
+    Tri.resize(2*n*n);
+
+    Workers().ParallelFor(m, [&](int i) {
+        std::vector<float> px(m), py(m), pz(m), dzdx(m), dzdy(m);
         float s = i/float(n);
         for (int j=0;  j<=n;  j++) {
             float t = j/float(n);
-            float x = s*2.0*range-range;
-            float y = t*2.0*range-range;
-            float z = HeightAt(x, y);
-            float zu = HeightAt(x+h, y);
-            float zv = HeightAt(x, y+h);
-            Pnt.push_back(glm::vec4(x, y, z, 1.0));
-            glm::vec3 du(1.0, 0.0, (zu-z)/h);
-            glm::vec3 dv(0.0, 1.0, (zv-z)/h);
-            Nrm.push_back(glm::normalize(glm::cross(du,dv)));
-            Tex.push_back(glm::vec2(s, t));
-            Tan.push_back(glm::vec3(1.0, 0.0, 0.0));
+            px[j] = s*2.0*range-range;
+            py[j] = t*2.0*range-range; }
+        HeightsAt(&px[0], &py[0], &pz[0], &dzdx[0], &dzdy[0], m);
+
+        for (int j=0;  j<=n;  j++) {
+            float t = j/float(n);
+            int v = i*m + j;
+            Pnt[v] = glm::vec4(px[j], py[j], pz[j], 1.0);
+            // The normal of the surface z=f(x,y) is (-df/dx, -df/dy, 1)
+            Nrm[v] = glm::normalize(glm::vec3(-dzdx[j], -dzdy[j], 1.0));
+            Tex[v] = glm::vec2(s, t);
+            Tan[v] = glm::vec3(1.0, 0.0, 0.0);
             if (i>0 && j>0) {
-                pushquad(Tri,
-                         (i-1)*(n+1) + (j-1),
-                         (i-1)*(n+1) + (j),
-                         (i  )*(n+1) + (j),
-                         (i  )*(n+1) + (j-1)); } } }
+                setquad(Tri, 2*((i-1)*n + (j-1)),
+                        (i-1)*(n+1) + (j-1),
+                        (i-1)*(n+1) + (j),
+                        (i  )*(n+1) + (j),
+                        (i  )*(n+1) + (j-1)); } } });
 
-    vaoID = VaoFromTris(Pnt, Nrm, Tex, Tan, Tri);
-    count = Tri.size();
+    ComputeSize();
+    MakeVAO();
+    CacheHeights(n);
 }
 
-float ProceduralGround::HeightAt(const float x, const float y)
+ProceduralGround::ProceduralGround(const float _range,
+                     const float _octaves, const float _persistence, const float _scale,
+                     const float _low, const float _high)
+    :range(_range), octaves(_octaves), persistence(_persistence), scale(_scale), 
+     low(_low), high(_high)
+{
+    diffuseColor = glm::vec3(0.3, 0.2, 0.1);
+    shininess = 10.0;
+    specularColor = glm::vec3(0.0, 0.0, 0.0);
+    xoff = range*( time(NULL)%1000 );
+    vaoID = 0;
+    count = 0;
+    cacheQuads = 0;
+}
+
+float ProceduralGround::HeightAt(const float x, const float y, float* dzdx, float* dzdy)
+{
+    if (!dzdx || !dzdy) {
+        float noise = scaled_octave_noise_2d(octaves, persistence, scale, low, high, x+xoff, y);
+        return Blend(x, y, noise); }
+
+    float noise = scaled_octave_noise_2d_deriv(octaves, persistence, scale, low, high, x+xoff, y,
+                                               dzdx, dzdy);
+    return Blend(x, y, noise, dzdx, dzdy);
+}
+
+void ProceduralGround::HeightsAt(const float* x, const float* y, float* z,
+                                 float* dzdx, float* dzdy, const int n)
+{
+    std::vector<float> nx(n);
+    for (int k=0;  k<n;  k++)
+        nx[k] = x[k]+xoff;
+    scaled_octave_noise_2d_deriv_batch(octaves, persistence, scale, low, high,
+                                       &nx[0], y, z, dzdx, dzdy, n);
+    for (int k=0;  k<n;  k++)
+        z[k] = Blend(x[k], y[k], z[k], &dzdx[k], &dzdy[k]);
+}
+
+void ProceduralGround::CacheHeights(const int n)
+{
+    cacheQuads = n;
+    cacheTiles = (n + pgCacheTile-1)/pgCacheTile;
+    cacheStep = 2.0f*range/n;
+    cacheHeights.assign(cacheTiles*cacheTiles, std::vector<float>());
+}
+
+// A tile of the cached grid, computed if need be.  The grid's vertex
+// (k,l) is at -range + (k,l)*cacheStep, and the noise batch is padded
+// to the SIMD width, so the heights are the ones ChunkedGround's
+// finest chunks get for the same grid, bit for bit.
+const float* ProceduralGround::CacheTile(const int ti, const int tj)
+{
+    std::vector<float>& tile = cacheHeights[ti*cacheTiles + tj];
+    if (tile.empty()) {
+        const int m = pgCacheTile+1;
+        const int count = (m*m + 7) & ~7;
+        std::vector<float> px(count, 0.0f), py(count, 0.0f), pz(count), dzdx(count), dzdy(count);
+        for (int i=0;  i<m;  i++)
+            for (int j=0;  j<m;  j++) {
+                px[i*m + j] = -range + (ti*pgCacheTile + i)*cacheStep;
+                py[i*m + j] = -range + (tj*pgCacheTile + j)*cacheStep; }
+        HeightsAt(&px[0], &py[0], &pz[0], &dzdx[0], &dzdy[0], count);
+        tile.assign(pz.begin(), pz.begin() + m*m); }
+    return &tile[0];
+}
+
+// Within quad (i,j) of the grid, the mesh's triangles are
+// (i,j),(i,j+1),(i+1,j+1) where v>=u and (i,j),(i+1,j+1),(i+1,j)
+// where u>=v, for (u,v) the position within the quad, and each is a
+// plane through its three heights.
+float ProceduralGround::MeshHeightAt(const float x, const float y, float* dzdx, float* dzdy)
+{
+    if (cacheQuads == 0)
+        return HeightAt(x, y, dzdx, dzdy);
+
+    const float fx = glm::clamp((x+range)/cacheStep, 0.0f, (float)cacheQuads);
+    const float fy = glm::clamp((y+range)/cacheStep, 0.0f, (float)cacheQuads);
+    const int i = std::min((int)fx, cacheQuads-1);
+    const int j = std::min((int)fy, cacheQuads-1);
+    const float u = fx-i, v = fy-j;
+
+    const int m = pgCacheTile+1;
+    const float* tile = CacheTile(i/pgCacheTile, j/pgCacheTile);
+    const float* z0 = tile + (i%pgCacheTile)*m + j%pgCacheTile;
+    const float z00 = z0[0], z01 = z0[1], z10 = z0[m], z11 = z0[m+1];
+
+    float sx, sy;
+    if (v >= u) {
+        sx = z11-z01;
+        sy = z01-z00; }
+    else {
+        sx = z10-z00;
+        sy = z11-z10; }
+    if (dzdx && dzdy) {
+        *dzdx = sx/cacheStep;
+        *dzdy = sy/cacheStep; }
+    return z00 + u*sx + v*sy;
+}
+
+void ProceduralGround::MeshHeightsAt(const float* x, const float* y, float* z,
+                                     float* dzdx, float* dzdy, const int n)
+{
+    for (int k=0;  k<n;  k++)
+        z[k] = MeshHeightAt(x[k], y[k], dzdx ? &dzdx[k] : NULL, dzdy ? &dzdy[k] : NULL);
+}
+
+// Flatten the noise towards low at the edge of the range, and towards
+// the high point in the middle.  If dx and dy are given, they hold the
+// noise's partial derivatives on entry, and the blended height's on
+// return.
+float ProceduralGround::Blend(const float x, const float y, const float noise, float* dx, float* dy)
 {
     glm::vec3 highPoint = glm::vec3(0.0, 0.0, 0.01);
 
-    float rs = glm::smoothstep(range-20.0f, range, sqrtf(x*x+y*y));
-    float noise = scaled_octave_noise_2d(octaves, persistence, scale, low, high, x+xoff, y);
+    float r = sqrtf(x*x+y*y);
+    float rs = glm::smoothstep(range-20.0f, range, r);
     float z = (1-rs)*noise + rs*low;
     
-    float hs = glm::smoothstep(15.0f, 45.0f,
-                               glm::l2Norm(glm::vec3(x,y,0)-glm::vec3(highPoint.x,highPoint.y,0)));
+    float d = glm::l2Norm(glm::vec3(x,y,0)-glm::vec3(highPoint.x,highPoint.y,0));
+    float hs = glm::smoothstep(15.0f, 45.0f, d);
+
+    if (dx && dy) {
+        // smoothstep(e0,e1,v) = u*u*(3-2u) with u = clamp((v-e0)/(e1-e0)),
+        // so its derivative is 6u(1-u)/(e1-e0), times d|v|/dx = x/|v|.
+        float ru = glm::clamp((r-(range-20.0f))/20.0f, 0.0f, 1.0f);
+        float drs = r > 0.0f ? 6.0f*ru*(1-ru)/20.0f/r : 0.0f;
+        float hu = glm::clamp((d-15.0f)/30.0f, 0.0f, 1.0f);
+        float dhs = d > 0.0f ? 6.0f*hu*(1-hu)/30.0f/d : 0.0f;
+
+        float zx = (1-rs)*(*dx) + drs*x*(low-noise);
+        float zy = (1-rs)*(*dy) + drs*y*(low-noise);
+        *dx = hs*zx + dhs*(x-highPoint.x)*(z-highPoint.z);
+        *dy = hs*zy + dhs*(y-highPoint.y)*(z-highPoint.z); }
+
     return (1-hs)*highPoint.z + hs*z;
 }
 
@@ -765,8 +1120,8 @@ Quad::Quad(const int n)
                          (i  )*(n+1) + (j),
                          (i  )*(n+1) + (j-1)); } } }
 
-    vaoID = VaoFromTris(Pnt, Nrm, Tex, Tan, Tri);
-    count = Tri.size();
+    ComputeSize();
+    MakeVAO();
 }
 
 Screen::Screen()
@@ -28,11 +28,78 @@
 
 #include <vector>
 
+const int pgCacheTile = 32;     // Quads along each side of a tile of cached heights
+
+// How vertices are laid out on the graphics card.  vfFloat is the
+// float attributes above, 48 bytes a vertex.  The packed formats hold
+// normals and tangents octahedrally encoded in two 16 bit integers
+// each, and texture coordinates as half floats, with positions either
+// as 16 bit fractions of the mesh's bounding box (vfPacked, 20 bytes)
+// or as three floats (vfPackedFloatPos, 24 bytes), for meshes whose
+// vertices must meet others' exactly.  GBuffer.vert decodes them.
+enum VertexFormat { vfFloat, vfPacked, vfPackedFloatPos };
+
+// The attribute slots a mesh fills, bit a for slot a:  the position
+// always, and the others if their arrays are not empty
+int VertexAttribs(const std::vector<glm::vec3>& Nrm,
+                  const std::vector<glm::vec2>& Tex,
+                  const std::vector<glm::vec3>& Tan);
+
+// Bytes per vertex in a format, with the given attributes
+int VertexStride(const VertexFormat format, const int attribs);
+
+// Write a mesh's vertices to dst, interleaved in the format.  For
+// vfPacked, the positions are quantized within [lo,hi].
+void PackVertices(void* dst,
+                  const std::vector<glm::vec4>& Pnt,
+                  const std::vector<glm::vec3>& Nrm,
+                  const std::vector<glm::vec2>& Tex,
+                  const std::vector<glm::vec3>& Tan,
+                  const VertexFormat format,
+                  const glm::vec3& lo=glm::vec3(0.0), const glm::vec3& hi=glm::vec3(0.0));
+
+// Point the bound VAO's attribute slots at vertices in the format,
+// from the start of the bound GL_ARRAY_BUFFER
+void VertexAttributes(const VertexFormat format, const int attribs);
+
+// Send a mesh's vertex attributes to the graphics card, interleaved in
+// a buffer of its own, and point the bound VAO's attribute slots into
+// it.  Nrm, Tex and Tan may be empty, and then take no room.  Returns
+// the buffer's OpenGL identifier.
+unsigned int InterleavedBuffer(const std::vector<glm::vec4>& Pnt,
+                               const std::vector<glm::vec3>& Nrm,
+                               const std::vector<glm::vec2>& Tex,
+                               const std::vector<glm::vec3>& Tan,
+                               const VertexFormat format=vfFloat,
+                               const glm::vec3& lo=glm::vec3(0.0), const glm::vec3& hi=glm::vec3(0.0));
+
+// A run of triangles drawn by one call:  count triangles starting at
+// triangle first of the shape's indices, which are relative to vertex
+// baseVertex
+struct IndexRange
+{
+    int first, count, baseVertex;
+};
+
+// A mesh's triangles as index data.  Where the vertex count allows,
+// the indices are 16 bits;  a larger mesh is split into ranges that
+// each span at most 65536 vertices, so long as its triangles are local
+// enough.  Returns the index size in bytes, the ranges to draw, and
+// the data.
+int PackIndices(const std::vector<glm::ivec3>& Tri, std::vector<IndexRange>& ranges,
+                std::vector<unsigned char>& data);
+
+// glBindVertexArray, skipped if the VAO is bound already.  All VAOs
+// are bound through this, so consecutive draws from a shared VAO (see
+// arena.h) bind nothing.
+void BindVAO(const unsigned int vao);
+
 class Shape
 {
 public:
 
-    // The OpenGL identifier of this VAO
+    // The OpenGL identifier of the VAO this shape is drawn from (shared
+    // with the other shapes in its MeshArena pool)
     unsigned int vaoID;
 
     // Data arrays
@@ -49,6 +116,12 @@ public:
     std::vector<glm::ivec3> Tri;
     unsigned int count;
 
+    // The index size in bytes, where the indices start in the VAO's
+    // index buffer, and the ranges drawn (set by MakeVAO)
+    int indexSize;
+    size_t indexOffset;
+    std::vector<IndexRange> ranges;
+
     // Defined by SetTransform by scanning data arrays
     glm::vec3 minP, maxP;
     glm::vec3 center;
@@ -56,13 +129,24 @@ public:
     glm::mat4 modelTr;
     bool animate;
 
+    // The VAO's vertex format, and the scale and offset that recover
+    // its positions (set by MakeVAO)
+    VertexFormat format;
+    glm::vec3 posOffset, posScale;
+
     // Constructor and destructor
-    Shape() :animate(false) {}
+    Shape() :animate(false), format(vfFloat), posOffset(0.0), posScale(1.0), indexSize(4), indexOffset(0) {}
     virtual ~Shape() {}
 
     virtual void ComputeSize();
     virtual void MakeVAO();
     virtual void DrawVAO();
+
+    // Draw the mesh count times, for the bound instance attributes
+    // (see instancing.h), from a VAO bound already.  Shapes drawn some
+    // other way than by their ranges are not Instanceable.
+    virtual bool Instanceable() const { return true; }
+    void DrawInstances(const int count);
 };
 
 class Box: public Shape
@@ -93,13 +177,13 @@ public:
 class Teapot: public Shape
 {
 public:
-    Teapot(const int n);
+    Teapot(const int n, const VertexFormat _format=vfFloat);
 };
 
 class Plane: public Shape
 {
 public:
-    Plane(const float range, const int n);
+    Plane(const float range, const int n, const VertexFormat _format=vfFloat);
 };
 
 class ProceduralGround: public Shape
@@ -116,7 +200,42 @@ public:
     ProceduralGround(const float _range, const int n,
                      const float _octaves, const float _persistence, const float _scale,
                      const float _low, const float _high);
-    float HeightAt(const float x, const float y);
+    // The height at (x,y), and its partial derivatives if dzdx and
+    // dzdy are given.
+    float HeightAt(const float x, const float y, float* dzdx=NULL, float* dzdy=NULL);
+
+    // HeightAt for n points, with the noise evaluated in SIMD batches
+    void HeightsAt(const float* x, const float* y, float* z, float* dzdx, float* dzdy, const int n);
+
+    // Sample heights from a grid of n by n quads over the ground,
+    // triangulated as the mesh is, instead of the noise.  Built from
+    // the same heights as a mesh of that grid, the result lies exactly
+    // on its surface.  The grid's heights are computed a tile at a
+    // time, the first time a tile is sampled.
+    void CacheHeights(const int n);
+
+    // The height of the cached grid's surface at (x,y), and its slope
+    // if dzdx and dzdy are given.  Without a cache, HeightAt.
+    float MeshHeightAt(const float x, const float y, float* dzdx=NULL, float* dzdy=NULL);
+
+    // MeshHeightAt for n points (dzdx and dzdy may be NULL)
+    void MeshHeightsAt(const float* x, const float* y, float* z, float* dzdx, float* dzdy, const int n);
+
+protected:
+    // The height function alone, with no mesh (for ChunkedGround)
+    ProceduralGround(const float _range,
+                     const float _octaves, const float _persistence, const float _scale,
+                     const float _low, const float _high);
+
+private:
+    // The cached grid:  cacheQuads across, in cacheTiles by cacheTiles
+    // tiles of (pgCacheTile+1)^2 heights each, empty until sampled
+    int cacheQuads, cacheTiles;
+    float cacheStep;
+    std::vector<std::vector<float> > cacheHeights;
+
+    float Blend(const float x, const float y, const float noise, float* dx=NULL, float* dy=NULL);
+    const float* CacheTile(const int ti, const int tj);
 };
 
 class Quad: public Shape
@@ -17,6 +17,7 @@
 
 
 #include <math.h>
+#include <stddef.h>
 
 #include "simplexnoise.h"
 
@@ -473,3 +474,664 @@ int fastfloor( const float x ) { return x > 0 ? (int) x : (int) x - 1; }
 float dot( const int* g, const float x, const float y ) { return g[0]*x + g[1]*y; }
 float dot( const int* g, const float x, const float y, const float z ) { return g[0]*x + g[1]*y + g[2]*z; }
 float dot( const int* g, const float x, const float y, const float z, const float w ) { return g[0]*x + g[1]*y + g[2]*z + g[3]*w; }
+
+
+
+/* Simplex noise with derivatives.
+
+The value of 2D Simplex noise is a sum over the three corners of the
+simplex cell of t^4 * dot(g, p), where p is the offset from the corner,
+g its gradient, and t = 0.5 - |p|^2 (clamped at zero).  Its gradient is
+therefore the sum of t^4 * g - 8 t^3 dot(g, p) p, found alongside the
+value at little extra cost:  the corner offsets differ from (x, y) only
+by constants within a cell, so dp/dx and dp/dy are the unit vectors.
+The gradient is continuous, as t^4 and t^3 both vanish at the edge of
+each corner's support.
+*/
+
+// One corner's contribution and its gradient, added to n, dx and dy.
+static inline void corner_deriv( const int* g, const float x, const float y, float& n, float& dx, float& dy ) {
+    float t = 0.5 - x*x-y*y;
+    if(t<0) return;
+    float t2 = t * t;
+    float t4 = t2 * t2;
+    float d = dot(g, x, y);
+    n += t4 * d;
+    dx += t4 * g[0] - 8 * t2 * t * d * x;
+    dy += t4 * g[1] - 8 * t2 * t * d * y;
+}
+
+
+// 2D raw Simplex noise and its partial derivatives.
+float raw_noise_2d_deriv( const float x, const float y, float* dx, float* dy ) {
+    // Skew the input space to determine which simplex cell we're in
+    float F2 = 0.5 * (sqrtf(3.0) - 1.0);
+    float s = (x + y) * F2;
+    int i = fastfloor( x + s );
+    int j = fastfloor( y + s );
+
+    float G2 = (3.0 - sqrtf(3.0)) / 6.0;
+    float t = (i + j) * G2;
+    float x0 = x-(i-t);
+    float y0 = y-(j-t);
+
+    int i1, j1;
+    if(x0>y0) {i1=1; j1=0;}
+    else {i1=0; j1=1;}
+
+    float x1 = x0 - i1 + G2;
+    float y1 = y0 - j1 + G2;
+    float x2 = x0 - 1.0 + 2.0 * G2;
+    float y2 = y0 - 1.0 + 2.0 * G2;
+
+    int ii = i & 255;
+    int jj = j & 255;
+    int gi0 = perm[ii+perm[jj]] % 12;
+    int gi1 = perm[ii+i1+perm[jj+j1]] % 12;
+    int gi2 = perm[ii+1+perm[jj+1]] % 12;
+
+    float n = 0, gx = 0, gy = 0;
+    corner_deriv(grad3[gi0], x0, y0, n, gx, gy);
+    corner_deriv(grad3[gi1], x1, y1, n, gx, gy);
+    corner_deriv(grad3[gi2], x2, y2, n, gx, gy);
+
+    *dx = 70.0 * gx;
+    *dy = 70.0 * gy;
+    return 70.0 * n;
+}
+
+
+// 2D Multi-octave Simplex noise and its partial derivatives.  Each
+// octave's gradient is scaled by its frequency as well as its amplitude.
+float octave_noise_2d_deriv( const float octaves, const float persistence, const float scale,
+                             const float x, const float y, float* dx, float* dy ) {
+    float total = 0, totalX = 0, totalY = 0;
+    float frequency = scale;
+    float amplitude = 1;
+    float maxAmplitude = 0;
+
+    for( int i=0; i < octaves; i++ ) {
+        float nx, ny;
+        total += raw_noise_2d_deriv( x * frequency, y * frequency, &nx, &ny ) * amplitude;
+        totalX += nx * amplitude * frequency;
+        totalY += ny * amplitude * frequency;
+
+        frequency *= 2;
+        maxAmplitude += amplitude;
+        amplitude *= persistence;
+    }
+
+    *dx = totalX / maxAmplitude;
+    *dy = totalY / maxAmplitude;
+    return total / maxAmplitude;
+}
+
+
+// 2D Scaled Multi-octave Simplex noise and its partial derivatives.
+float scaled_octave_noise_2d_deriv( const float octaves, const float persistence, const float scale,
+                                    const float loBound, const float hiBound,
+                                    const float x, const float y, float* dx, float* dy ) {
+    float value = octave_noise_2d_deriv(octaves, persistence, scale, x, y, dx, dy);
+    *dx = *dx * (hiBound - loBound) / 2;
+    *dy = *dy * (hiBound - loBound) / 2;
+    return value * (hiBound - loBound) / 2 + (hiBound + loBound) / 2;
+}
+
+
+
+/* Batch Simplex noise.
+
+The batch functions evaluate the single point functions above for whole
+arrays of points, 8 at a time with AVX2 or 4 at a time with SSE2 (the
+best the CPU supports, as detected for the software pipeline in
+raster.cpp), and one at a time for any remainder.  The arithmetic is the
+same, in the same order, except that the few terms the single point
+code evaluates in double precision are done in float, so results agree
+to within float rounding.
+*/
+
+#include "raster.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define NOISE_X86
+#include <immintrin.h>
+#endif
+
+#if defined(NOISE_X86) && defined(__GNUC__)
+#define NOISE_TARGET_AVX2 __attribute__((target("avx2")))
+#define NOISE_TARGET_SSE2 __attribute__((target("sse2")))
+#else
+#define NOISE_TARGET_AVX2
+#define NOISE_TARGET_SSE2
+#endif
+
+// Points per chunk of the octave loops
+static const int batchChunk = 256;
+
+// The gradient of each permutation table entry, grad3[perm[i] % 12], as
+// floats, so the SIMD versions can find it with a single lookup.
+static struct GradientTables {
+    float gx[512], gy[512], gz[512];
+    GradientTables() {
+        for (int i=0;  i<512;  i++) {
+            const int* g = grad3[perm[i] % 12];
+            gx[i] = (float)g[0];  gy[i] = (float)g[1];  gz[i] = (float)g[2]; } }
+} gradients;
+
+static EmSimdLevel NoiseSimdLevel() {
+    static const EmSimdLevel level = EmDetectSimd();
+    return level;
+}
+
+
+#ifdef NOISE_X86
+
+// SSE2 has no gathers, so table lookups go through memory.
+NOISE_TARGET_SSE2
+static inline __m128i lookup4( const int* table, const __m128i idx ) {
+    int i[4];
+    _mm_storeu_si128((__m128i*)i, idx);
+    return _mm_setr_epi32(table[i[0]], table[i[1]], table[i[2]], table[i[3]]);
+}
+
+NOISE_TARGET_SSE2
+static inline __m128 lookup4( const float* table, const __m128i idx ) {
+    int i[4];
+    _mm_storeu_si128((__m128i*)i, idx);
+    return _mm_setr_ps(table[i[0]], table[i[1]], table[i[2]], table[i[3]]);
+}
+
+// fastfloor(): truncate, then subtract one unless x > 0.
+NOISE_TARGET_SSE2
+static inline __m128i fastfloor4( const __m128 x ) {
+    const __m128 positive = _mm_cmpgt_ps(x, _mm_setzero_ps());
+    return _mm_add_epi32(_mm_cvttps_epi32(x), _mm_andnot_si128(_mm_castps_si128(positive), _mm_set1_epi32(-1)));
+}
+
+// One corner's contribution:  t^4 * dot(g, x) where t = r2 - |x|^2 >= 0.
+NOISE_TARGET_SSE2
+static inline __m128 corner4( const __m128 r2, const __m128 x, const __m128 y, const __m128 gx, const __m128 gy ) {
+    __m128 t = _mm_sub_ps(_mm_sub_ps(r2, _mm_mul_ps(x, x)), _mm_mul_ps(y, y));
+    const __m128 inside = _mm_cmpge_ps(t, _mm_setzero_ps());
+    t = _mm_mul_ps(t, t);
+    const __m128 n = _mm_mul_ps(_mm_mul_ps(t, t), _mm_add_ps(_mm_mul_ps(gx, x), _mm_mul_ps(gy, y)));
+    return _mm_and_ps(inside, n);
+}
+
+// The same with its gradient, t^4 * g - 8 t^3 dot(g, x) x, added to dx and dy.
+NOISE_TARGET_SSE2
+static inline __m128 cornerDeriv4( const __m128 r2, const __m128 x, const __m128 y, const __m128 gx, const __m128 gy,
+                                   __m128& dx, __m128& dy ) {
+    const __m128 t = _mm_max_ps(_mm_sub_ps(_mm_sub_ps(r2, _mm_mul_ps(x, x)), _mm_mul_ps(y, y)), _mm_setzero_ps());
+    const __m128 t2 = _mm_mul_ps(t, t);
+    const __m128 t4 = _mm_mul_ps(t2, t2);
+    const __m128 d = _mm_add_ps(_mm_mul_ps(gx, x), _mm_mul_ps(gy, y));
+    const __m128 k = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(8.0f), _mm_mul_ps(t2, t)), d);
+    dx = _mm_add_ps(dx, _mm_sub_ps(_mm_mul_ps(t4, gx), _mm_mul_ps(k, x)));
+    dy = _mm_add_ps(dy, _mm_sub_ps(_mm_mul_ps(t4, gy), _mm_mul_ps(k, y)));
+    return _mm_mul_ps(t4, d);
+}
+
+NOISE_TARGET_SSE2
+static inline __m128 corner4( const __m128 r2, const __m128 x, const __m128 y, const __m128 z,
+                              const __m128 gx, const __m128 gy, const __m128 gz ) {
+    __m128 t = _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(r2, _mm_mul_ps(x, x)), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+    const __m128 inside = _mm_cmpge_ps(t, _mm_setzero_ps());
+    t = _mm_mul_ps(t, t);
+    const __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, x), _mm_mul_ps(gy, y)), _mm_mul_ps(gz, z));
+    return _mm_and_ps(inside, _mm_mul_ps(_mm_mul_ps(t, t), d));
+}
+
+// raw_noise_2d() of 4 points, and raw_noise_2d_deriv() if dx and dy are given
+NOISE_TARGET_SSE2
+static void raw_noise_2d_sse2( const float* px, const float* py, float* out, float* dx, float* dy ) {
+    const float F2 = 0.5 * (sqrtf(3.0) - 1.0);
+    const float G2 = (3.0 - sqrtf(3.0)) / 6.0;
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128i mask = _mm_set1_epi32(255), ione = _mm_set1_epi32(1);
+
+    const __m128 x = _mm_loadu_ps(px), y = _mm_loadu_ps(py);
+    const __m128 s = _mm_mul_ps(_mm_add_ps(x, y), _mm_set1_ps(F2));
+    const __m128i i = fastfloor4(_mm_add_ps(x, s));
+    const __m128i j = fastfloor4(_mm_add_ps(y, s));
+    const __m128 t = _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(i, j)), _mm_set1_ps(G2));
+    const __m128 x0 = _mm_sub_ps(x, _mm_sub_ps(_mm_cvtepi32_ps(i), t));
+    const __m128 y0 = _mm_sub_ps(y, _mm_sub_ps(_mm_cvtepi32_ps(j), t));
+
+    const __m128 lower = _mm_cmpgt_ps(x0, y0);
+    const __m128i i1 = _mm_and_si128(_mm_castps_si128(lower), ione);
+    const __m128i j1 = _mm_andnot_si128(_mm_castps_si128(lower), ione);
+    const __m128 x1 = _mm_add_ps(_mm_sub_ps(x0, _mm_and_ps(lower, one)), _mm_set1_ps(G2));
+    const __m128 y1 = _mm_add_ps(_mm_sub_ps(y0, _mm_andnot_ps(lower, one)), _mm_set1_ps(G2));
+    const __m128 x2 = _mm_add_ps(_mm_sub_ps(x0, one), _mm_set1_ps(2.0f*G2));
+    const __m128 y2 = _mm_add_ps(_mm_sub_ps(y0, one), _mm_set1_ps(2.0f*G2));
+
+    const __m128i ii = _mm_and_si128(i, mask);
+    const __m128i jj = _mm_and_si128(j, mask);
+    const __m128i g0 = _mm_add_epi32(ii, lookup4(perm, jj));
+    const __m128i g1 = _mm_add_epi32(_mm_add_epi32(ii, i1), lookup4(perm, _mm_add_epi32(jj, j1)));
+    const __m128i g2 = _mm_add_epi32(_mm_add_epi32(ii, ione), lookup4(perm, _mm_add_epi32(jj, ione)));
+
+    const __m128 r2 = _mm_set1_ps(0.5f), scale = _mm_set1_ps(70.0f);
+    const __m128 gx0 = lookup4(gradients.gx, g0), gy0 = lookup4(gradients.gy, g0);
+    const __m128 gx1 = lookup4(gradients.gx, g1), gy1 = lookup4(gradients.gy, g1);
+    const __m128 gx2 = lookup4(gradients.gx, g2), gy2 = lookup4(gradients.gy, g2);
+    __m128 n0, n1, n2;
+    if (dx) {
+        __m128 ddx = _mm_setzero_ps(), ddy = _mm_setzero_ps();
+        n0 = cornerDeriv4(r2, x0, y0, gx0, gy0, ddx, ddy);
+        n1 = cornerDeriv4(r2, x1, y1, gx1, gy1, ddx, ddy);
+        n2 = cornerDeriv4(r2, x2, y2, gx2, gy2, ddx, ddy);
+        _mm_storeu_ps(dx, _mm_mul_ps(scale, ddx));
+        _mm_storeu_ps(dy, _mm_mul_ps(scale, ddy)); }
+    else {
+        n0 = corner4(r2, x0, y0, gx0, gy0);
+        n1 = corner4(r2, x1, y1, gx1, gy1);
+        n2 = corner4(r2, x2, y2, gx2, gy2); }
+    _mm_storeu_ps(out, _mm_mul_ps(scale, _mm_add_ps(_mm_add_ps(n0, n1), n2)));
+}
+
+// raw_noise_3d() of 4 points
+NOISE_TARGET_SSE2
+static void raw_noise_3d_sse2( const float* px, const float* py, const float* pz, float* out ) {
+    const float F3 = 1.0/3.0;
+    const float G3 = 1.0/6.0;
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128i mask = _mm_set1_epi32(255), ione = _mm_set1_epi32(1);
+
+    const __m128 x = _mm_loadu_ps(px), y = _mm_loadu_ps(py), z = _mm_loadu_ps(pz);
+    const __m128 s = _mm_mul_ps(_mm_add_ps(_mm_add_ps(x, y), z), _mm_set1_ps(F3));
+    const __m128i i = fastfloor4(_mm_add_ps(x, s));
+    const __m128i j = fastfloor4(_mm_add_ps(y, s));
+    const __m128i k = fastfloor4(_mm_add_ps(z, s));
+    const __m128 t = _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_add_epi32(i, j), k)), _mm_set1_ps(G3));
+    const __m128 x0 = _mm_sub_ps(x, _mm_sub_ps(_mm_cvtepi32_ps(i), t));
+    const __m128 y0 = _mm_sub_ps(y, _mm_sub_ps(_mm_cvtepi32_ps(j), t));
+    const __m128 z0 = _mm_sub_ps(z, _mm_sub_ps(_mm_cvtepi32_ps(k), t));
+
+    // The simplex corner offsets of raw_noise_3d(), from the three comparisons
+    const __m128 xy = _mm_cmpge_ps(x0, y0), xz = _mm_cmpge_ps(x0, z0), yz = _mm_cmpge_ps(y0, z0);
+    const __m128 i1 = _mm_and_ps(xy, xz);
+    const __m128 j1 = _mm_andnot_ps(xy, yz);
+    const __m128 k1 = _mm_andnot_ps(_mm_or_ps(yz, i1), _mm_castsi128_ps(_mm_set1_epi32(-1)));
+    const __m128 i2 = _mm_or_ps(xy, _mm_and_ps(yz, xz));
+    const __m128 j2 = _mm_or_ps(_mm_andnot_ps(xy, _mm_castsi128_ps(_mm_set1_epi32(-1))), yz);
+    const __m128 k2 = _mm_andnot_ps(_mm_and_ps(yz, _mm_or_ps(xy, xz)), _mm_castsi128_ps(_mm_set1_epi32(-1)));
+
+    const __m128 x1 = _mm_add_ps(_mm_sub_ps(x0, _mm_and_ps(i1, one)), _mm_set1_ps(G3));
+    const __m128 y1 = _mm_add_ps(_mm_sub_ps(y0, _mm_and_ps(j1, one)), _mm_set1_ps(G3));
+    const __m128 z1 = _mm_add_ps(_mm_sub_ps(z0, _mm_and_ps(k1, one)), _mm_set1_ps(G3));
+    const __m128 x2 = _mm_add_ps(_mm_sub_ps(x0, _mm_and_ps(i2, one)), _mm_set1_ps(2.0f*G3));
+    const __m128 y2 = _mm_add_ps(_mm_sub_ps(y0, _mm_and_ps(j2, one)), _mm_set1_ps(2.0f*G3));
+    const __m128 z2 = _mm_add_ps(_mm_sub_ps(z0, _mm_and_ps(k2, one)), _mm_set1_ps(2.0f*G3));
+    const __m128 x3 = _mm_add_ps(_mm_sub_ps(x0, one), _mm_set1_ps(3.0f*G3));
+    const __m128 y3 = _mm_add_ps(_mm_sub_ps(y0, one), _mm_set1_ps(3.0f*G3));
+    const __m128 z3 = _mm_add_ps(_mm_sub_ps(z0, one), _mm_set1_ps(3.0f*G3));
+
+    const __m128i ii = _mm_and_si128(i, mask);
+    const __m128i jj = _mm_and_si128(j, mask);
+    const __m128i kk = _mm_and_si128(k, mask);
+    #define OFFSET(m) _mm_and_si128(_mm_castps_si128(m), ione)
+    const __m128i g0 = _mm_add_epi32(ii, lookup4(perm, _mm_add_epi32(jj, lookup4(perm, kk))));
+    const __m128i g1 = _mm_add_epi32(_mm_add_epi32(ii, OFFSET(i1)),
+                       lookup4(perm, _mm_add_epi32(_mm_add_epi32(jj, OFFSET(j1)),
+                                     lookup4(perm, _mm_add_epi32(kk, OFFSET(k1))))));
+    const __m128i g2 = _mm_add_epi32(_mm_add_epi32(ii, OFFSET(i2)),
+                       lookup4(perm, _mm_add_epi32(_mm_add_epi32(jj, OFFSET(j2)),
+                                     lookup4(perm, _mm_add_epi32(kk, OFFSET(k2))))));
+    const __m128i g3 = _mm_add_epi32(_mm_add_epi32(ii, ione),
+                       lookup4(perm, _mm_add_epi32(_mm_add_epi32(jj, ione),
+                                     lookup4(perm, _mm_add_epi32(kk, ione)))));
+    #undef OFFSET
+
+    const __m128 r2 = _mm_set1_ps(0.6f);
+    const __m128 n0 = corner4(r2, x0, y0, z0, lookup4(gradients.gx, g0), lookup4(gradients.gy, g0), lookup4(gradients.gz, g0));
+    const __m128 n1 = corner4(r2, x1, y1, z1, lookup4(gradients.gx, g1), lookup4(gradients.gy, g1), lookup4(gradients.gz, g1));
+    const __m128 n2 = corner4(r2, x2, y2, z2, lookup4(gradients.gx, g2), lookup4(gradients.gy, g2), lookup4(gradients.gz, g2));
+    const __m128 n3 = corner4(r2, x3, y3, z3, lookup4(gradients.gx, g3), lookup4(gradients.gy, g3), lookup4(gradients.gz, g3));
+    _mm_storeu_ps(out, _mm_mul_ps(_mm_set1_ps(32.0f), _mm_add_ps(_mm_add_ps(_mm_add_ps(n0, n1), n2), n3)));
+}
+
+
+NOISE_TARGET_AVX2
+static inline __m256i fastfloor8( const __m256 x ) {
+    const __m256 positive = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ);
+    return _mm256_add_epi32(_mm256_cvttps_epi32(x), _mm256_andnot_si256(_mm256_castps_si256(positive), _mm256_set1_epi32(-1)));
+}
+
+NOISE_TARGET_AVX2
+static inline __m256 corner8( const __m256 r2, const __m256 x, const __m256 y, const __m256 gx, const __m256 gy ) {
+    __m256 t = _mm256_sub_ps(_mm256_sub_ps(r2, _mm256_mul_ps(x, x)), _mm256_mul_ps(y, y));
+    const __m256 inside = _mm256_cmp_ps(t, _mm256_setzero_ps(), _CMP_GE_OQ);
+    t = _mm256_mul_ps(t, t);
+    const __m256 n = _mm256_mul_ps(_mm256_mul_ps(t, t), _mm256_add_ps(_mm256_mul_ps(gx, x), _mm256_mul_ps(gy, y)));
+    return _mm256_and_ps(inside, n);
+}
+
+NOISE_TARGET_AVX2
+static inline __m256 cornerDeriv8( const __m256 r2, const __m256 x, const __m256 y, const __m256 gx, const __m256 gy,
+                                   __m256& dx, __m256& dy ) {
+    const __m256 t = _mm256_max_ps(_mm256_sub_ps(_mm256_sub_ps(r2, _mm256_mul_ps(x, x)), _mm256_mul_ps(y, y)), _mm256_setzero_ps());
+    const __m256 t2 = _mm256_mul_ps(t, t);
+    const __m256 t4 = _mm256_mul_ps(t2, t2);
+    const __m256 d = _mm256_add_ps(_mm256_mul_ps(gx, x), _mm256_mul_ps(gy, y));
+    const __m256 k = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(8.0f), _mm256_mul_ps(t2, t)), d);
+    dx = _mm256_add_ps(dx, _mm256_sub_ps(_mm256_mul_ps(t4, gx), _mm256_mul_ps(k, x)));
+    dy = _mm256_add_ps(dy, _mm256_sub_ps(_mm256_mul_ps(t4, gy), _mm256_mul_ps(k, y)));
+    return _mm256_mul_ps(t4, d);
+}
+
+NOISE_TARGET_AVX2
+static inline __m256 corner8( const __m256 r2, const __m256 x, const __m256 y, const __m256 z,
+                              const __m256 gx, const __m256 gy, const __m256 gz ) {
+    __m256 t = _mm256_sub_ps(_mm256_sub_ps(_mm256_sub_ps(r2, _mm256_mul_ps(x, x)), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z));
+    const __m256 inside = _mm256_cmp_ps(t, _mm256_setzero_ps(), _CMP_GE_OQ);
+    t = _mm256_mul_ps(t, t);
+    const __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(gx, x), _mm256_mul_ps(gy, y)), _mm256_mul_ps(gz, z));
+    return _mm256_and_ps(inside, _mm256_mul_ps(_mm256_mul_ps(t, t), d));
+}
+
+// raw_noise_2d() of 8 points, and raw_noise_2d_deriv() if dx and dy are given
+NOISE_TARGET_AVX2
+static void raw_noise_2d_avx2( const float* px, const float* py, float* out, float* dx, float* dy ) {
+    const float F2 = 0.5 * (sqrtf(3.0) - 1.0);
+    const float G2 = (3.0 - sqrtf(3.0)) / 6.0;
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256i mask = _mm256_set1_epi32(255), ione = _mm256_set1_epi32(1);
+
+    const __m256 x = _mm256_loadu_ps(px), y = _mm256_loadu_ps(py);
+    const __m256 s = _mm256_mul_ps(_mm256_add_ps(x, y), _mm256_set1_ps(F2));
+    const __m256i i = fastfloor8(_mm256_add_ps(x, s));
+    const __m256i j = fastfloor8(_mm256_add_ps(y, s));
+    const __m256 t = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(i, j)), _mm256_set1_ps(G2));
+    const __m256 x0 = _mm256_sub_ps(x, _mm256_sub_ps(_mm256_cvtepi32_ps(i), t));
+    const __m256 y0 = _mm256_sub_ps(y, _mm256_sub_ps(_mm256_cvtepi32_ps(j), t));
+
+    const __m256 lower = _mm256_cmp_ps(x0, y0, _CMP_GT_OQ);
+    const __m256i i1 = _mm256_and_si256(_mm256_castps_si256(lower), ione);
+    const __m256i j1 = _mm256_andnot_si256(_mm256_castps_si256(lower), ione);
+    const __m256 x1 = _mm256_add_ps(_mm256_sub_ps(x0, _mm256_and_ps(lower, one)), _mm256_set1_ps(G2));
+    const __m256 y1 = _mm256_add_ps(_mm256_sub_ps(y0, _mm256_andnot_ps(lower, one)), _mm256_set1_ps(G2));
+    const __m256 x2 = _mm256_add_ps(_mm256_sub_ps(x0, one), _mm256_set1_ps(2.0f*G2));
+    const __m256 y2 = _mm256_add_ps(_mm256_sub_ps(y0, one), _mm256_set1_ps(2.0f*G2));
+
+    const __m256i ii = _mm256_and_si256(i, mask);
+    const __m256i jj = _mm256_and_si256(j, mask);
+    const __m256i g0 = _mm256_add_epi32(ii, _mm256_i32gather_epi32(perm, jj, 4));
+    const __m256i g1 = _mm256_add_epi32(_mm256_add_epi32(ii, i1), _mm256_i32gather_epi32(perm, _mm256_add_epi32(jj, j1), 4));
+    const __m256i g2 = _mm256_add_epi32(_mm256_add_epi32(ii, ione), _mm256_i32gather_epi32(perm, _mm256_add_epi32(jj, ione), 4));
+
+    const __m256 r2 = _mm256_set1_ps(0.5f), scale = _mm256_set1_ps(70.0f);
+    const __m256 gx0 = _mm256_i32gather_ps(gradients.gx, g0, 4), gy0 = _mm256_i32gather_ps(gradients.gy, g0, 4);
+    const __m256 gx1 = _mm256_i32gather_ps(gradients.gx, g1, 4), gy1 = _mm256_i32gather_ps(gradients.gy, g1, 4);
+    const __m256 gx2 = _mm256_i32gather_ps(gradients.gx, g2, 4), gy2 = _mm256_i32gather_ps(gradients.gy, g2, 4);
+    __m256 n0, n1, n2;
+    if (dx) {
+        __m256 ddx = _mm256_setzero_ps(), ddy = _mm256_setzero_ps();
+        n0 = cornerDeriv8(r2, x0, y0, gx0, gy0, ddx, ddy);
+        n1 = cornerDeriv8(r2, x1, y1, gx1, gy1, ddx, ddy);
+        n2 = cornerDeriv8(r2, x2, y2, gx2, gy2, ddx, ddy);
+        _mm256_storeu_ps(dx, _mm256_mul_ps(scale, ddx));
+        _mm256_storeu_ps(dy, _mm256_mul_ps(scale, ddy)); }
+    else {
+        n0 = corner8(r2, x0, y0, gx0, gy0);
+        n1 = corner8(r2, x1, y1, gx1, gy1);
+        n2 = corner8(r2, x2, y2, gx2, gy2); }
+    _mm256_storeu_ps(out, _mm256_mul_ps(scale, _mm256_add_ps(_mm256_add_ps(n0, n1), n2)));
+}
+
+// raw_noise_3d() of 8 points
+NOISE_TARGET_AVX2
+static void raw_noise_3d_avx2( const float* px, const float* py, const float* pz, float* out ) {
+    const float F3 = 1.0/3.0;
+    const float G3 = 1.0/6.0;
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 all = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    const __m256i mask = _mm256_set1_epi32(255), ione = _mm256_set1_epi32(1);
+
+    const __m256 x = _mm256_loadu_ps(px), y = _mm256_loadu_ps(py), z = _mm256_loadu_ps(pz);
+    const __m256 s = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(x, y), z), _mm256_set1_ps(F3));
+    const __m256i i = fastfloor8(_mm256_add_ps(x, s));
+    const __m256i j = fastfloor8(_mm256_add_ps(y, s));
+    const __m256i k = fastfloor8(_mm256_add_ps(z, s));
+    const __m256 t = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_add_epi32(i, j), k)), _mm256_set1_ps(G3));
+    const __m256 x0 = _mm256_sub_ps(x, _mm256_sub_ps(_mm256_cvtepi32_ps(i), t));
+    const __m256 y0 = _mm256_sub_ps(y, _mm256_sub_ps(_mm256_cvtepi32_ps(j), t));
+    const __m256 z0 = _mm256_sub_ps(z, _mm256_sub_ps(_mm256_cvtepi32_ps(k), t));
+
+    // The simplex corner offsets of raw_noise_3d(), from the three comparisons
+    const __m256 xy = _mm256_cmp_ps(x0, y0, _CMP_GE_OQ);
+    const __m256 xz = _mm256_cmp_ps(x0, z0, _CMP_GE_OQ);
+    const __m256 yz = _mm256_cmp_ps(y0, z0, _CMP_GE_OQ);
+    const __m256 i1 = _mm256_and_ps(xy, xz);
+    const __m256 j1 = _mm256_andnot_ps(xy, yz);
+    const __m256 k1 = _mm256_andnot_ps(_mm256_or_ps(yz, i1), all);
+    const __m256 i2 = _mm256_or_ps(xy, _mm256_and_ps(yz, xz));
+    const __m256 j2 = _mm256_or_ps(_mm256_andnot_ps(xy, all), yz);
+    const __m256 k2 = _mm256_andnot_ps(_mm256_and_ps(yz, _mm256_or_ps(xy, xz)), all);
+
+    const __m256 x1 = _mm256_add_ps(_mm256_sub_ps(x0, _mm256_and_ps(i1, one)), _mm256_set1_ps(G3));
+    const __m256 y1 = _mm256_add_ps(_mm256_sub_ps(y0, _mm256_and_ps(j1, one)), _mm256_set1_ps(G3));
+    const __m256 z1 = _mm256_add_ps(_mm256_sub_ps(z0, _mm256_and_ps(k1, one)), _mm256_set1_ps(G3));
+    const __m256 x2 = _mm256_add_ps(_mm256_sub_ps(x0, _mm256_and_ps(i2, one)), _mm256_set1_ps(2.0f*G3));
+    const __m256 y2 = _mm256_add_ps(_mm256_sub_ps(y0, _mm256_and_ps(j2, one)), _mm256_set1_ps(2.0f*G3));
+    const __m256 z2 = _mm256_add_ps(_mm256_sub_ps(z0, _mm256_and_ps(k2, one)), _mm256_set1_ps(2.0f*G3));
+    const __m256 x3 = _mm256_add_ps(_mm256_sub_ps(x0, one), _mm256_set1_ps(3.0f*G3));
+    const __m256 y3 = _mm256_add_ps(_mm256_sub_ps(y0, one), _mm256_set1_ps(3.0f*G3));
+    const __m256 z3 = _mm256_add_ps(_mm256_sub_ps(z0, one), _mm256_set1_ps(3.0f*G3));
+
+    const __m256i ii = _mm256_and_si256(i, mask);
+    const __m256i jj = _mm256_and_si256(j, mask);
+    const __m256i kk = _mm256_and_si256(k, mask);
+    #define OFFSET(m) _mm256_and_si256(_mm256_castps_si256(m), ione)
+    #define PERM(v) _mm256_i32gather_epi32(perm, v, 4)
+    const __m256i g0 = _mm256_add_epi32(ii, PERM(_mm256_add_epi32(jj, PERM(kk))));
+    const __m256i g1 = _mm256_add_epi32(_mm256_add_epi32(ii, OFFSET(i1)),
+                       PERM(_mm256_add_epi32(_mm256_add_epi32(jj, OFFSET(j1)), PERM(_mm256_add_epi32(kk, OFFSET(k1))))));
+    const __m256i g2 = _mm256_add_epi32(_mm256_add_epi32(ii, OFFSET(i2)),
+                       PERM(_mm256_add_epi32(_mm256_add_epi32(jj, OFFSET(j2)), PERM(_mm256_add_epi32(kk, OFFSET(k2))))));
+    const __m256i g3 = _mm256_add_epi32(_mm256_add_epi32(ii, ione),
+                       PERM(_mm256_add_epi32(_mm256_add_epi32(jj, ione), PERM(_mm256_add_epi32(kk, ione)))));
+    #undef PERM
+    #undef OFFSET
+
+    #define GRAD(g) _mm256_i32gather_ps(gradients.gx, g, 4), _mm256_i32gather_ps(gradients.gy, g, 4), _mm256_i32gather_ps(gradients.gz, g, 4)
+    const __m256 r2 = _mm256_set1_ps(0.6f);
+    const __m256 n0 = corner8(r2, x0, y0, z0, GRAD(g0));
+    const __m256 n1 = corner8(r2, x1, y1, z1, GRAD(g1));
+    const __m256 n2 = corner8(r2, x2, y2, z2, GRAD(g2));
+    const __m256 n3 = corner8(r2, x3, y3, z3, GRAD(g3));
+    #undef GRAD
+    _mm256_storeu_ps(out, _mm256_mul_ps(_mm256_set1_ps(32.0f), _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(n0, n1), n2), n3)));
+}
+
+#endif
+
+
+// 2D raw Simplex noise of n points
+void raw_noise_2d_batch( const float* x, const float* y, float* out, const int n ) {
+    int k = 0;
+#ifdef NOISE_X86
+    const EmSimdLevel level = NoiseSimdLevel();
+    if (level >= emAVX2)
+        for ( ; k+8 <= n; k += 8)
+            raw_noise_2d_avx2(x+k, y+k, out+k, NULL, NULL);
+    if (level >= emSSE2)
+        for ( ; k+4 <= n; k += 4)
+            raw_noise_2d_sse2(x+k, y+k, out+k, NULL, NULL);
+#endif
+    for ( ; k < n; k++)
+        out[k] = raw_noise_2d(x[k], y[k]);
+}
+
+
+// 3D raw Simplex noise of n points
+void raw_noise_3d_batch( const float* x, const float* y, const float* z, float* out, const int n ) {
+    int k = 0;
+#ifdef NOISE_X86
+    const EmSimdLevel level = NoiseSimdLevel();
+    if (level >= emAVX2)
+        for ( ; k+8 <= n; k += 8)
+            raw_noise_3d_avx2(x+k, y+k, z+k, out+k);
+    if (level >= emSSE2)
+        for ( ; k+4 <= n; k += 4)
+            raw_noise_3d_sse2(x+k, y+k, z+k, out+k);
+#endif
+    for ( ; k < n; k++)
+        out[k] = raw_noise_3d(x[k], y[k], z[k]);
+}
+
+
+// 2D raw Simplex noise and its partial derivatives at n points
+void raw_noise_2d_deriv_batch( const float* x, const float* y, float* out, float* dx, float* dy, const int n ) {
+    int k = 0;
+#ifdef NOISE_X86
+    const EmSimdLevel level = NoiseSimdLevel();
+    if (level >= emAVX2)
+        for ( ; k+8 <= n; k += 8)
+            raw_noise_2d_avx2(x+k, y+k, out+k, dx+k, dy+k);
+    if (level >= emSSE2)
+        for ( ; k+4 <= n; k += 4)
+            raw_noise_2d_sse2(x+k, y+k, out+k, dx+k, dy+k);
+#endif
+    for ( ; k < n; k++)
+        out[k] = raw_noise_2d_deriv(x[k], y[k], &dx[k], &dy[k]);
+}
+
+
+// 2D Multi-octave Simplex noise of n points, in chunks so each octave's
+// scaled coordinates fit on the stack.
+void octave_noise_2d_batch( const float octaves, const float persistence, const float scale,
+                            const float* x, const float* y, float* out, const int n ) {
+    float sx[batchChunk], sy[batchChunk], raw[batchChunk], total[batchChunk];
+    for (int base = 0; base < n; base += batchChunk) {
+        const int m = n-base < batchChunk ? n-base : batchChunk;
+        float frequency = scale;
+        float amplitude = 1;
+        float maxAmplitude = 0;
+        for (int k = 0; k < m; k++)
+            total[k] = 0;
+
+        for( int i=0; i < octaves; i++ ) {
+            for (int k = 0; k < m; k++) {
+                sx[k] = x[base+k] * frequency;
+                sy[k] = y[base+k] * frequency;
+            }
+            raw_noise_2d_batch(sx, sy, raw, m);
+            for (int k = 0; k < m; k++)
+                total[k] += raw[k] * amplitude;
+
+            frequency *= 2;
+            maxAmplitude += amplitude;
+            amplitude *= persistence;
+        }
+
+        for (int k = 0; k < m; k++)
+            out[base+k] = total[k] / maxAmplitude;
+    }
+}
+
+
+// 2D Multi-octave Simplex noise and its partial derivatives at n points
+void octave_noise_2d_deriv_batch( const float octaves, const float persistence, const float scale,
+                                  const float* x, const float* y, float* out, float* dx, float* dy, const int n ) {
+    float sx[batchChunk], sy[batchChunk], raw[batchChunk], rawX[batchChunk], rawY[batchChunk];
+    float total[batchChunk], totalX[batchChunk], totalY[batchChunk];
+    for (int base = 0; base < n; base += batchChunk) {
+        const int m = n-base < batchChunk ? n-base : batchChunk;
+        float frequency = scale;
+        float amplitude = 1;
+        float maxAmplitude = 0;
+        for (int k = 0; k < m; k++)
+            total[k] = totalX[k] = totalY[k] = 0;
+
+        for( int i=0; i < octaves; i++ ) {
+            for (int k = 0; k < m; k++) {
+                sx[k] = x[base+k] * frequency;
+                sy[k] = y[base+k] * frequency;
+            }
+            raw_noise_2d_deriv_batch(sx, sy, raw, rawX, rawY, m);
+            for (int k = 0; k < m; k++) {
+                total[k] += raw[k] * amplitude;
+                totalX[k] += rawX[k] * amplitude * frequency;
+                totalY[k] += rawY[k] * amplitude * frequency;
+            }
+
+            frequency *= 2;
+            maxAmplitude += amplitude;
+            amplitude *= persistence;
+        }
+
+        for (int k = 0; k < m; k++) {
+            out[base+k] = total[k] / maxAmplitude;
+            dx[base+k] = totalX[k] / maxAmplitude;
+            dy[base+k] = totalY[k] / maxAmplitude;
+        }
+    }
+}
+
+
+// 3D Multi-octave Simplex noise of n points
+void octave_noise_3d_batch( const float octaves, const float persistence, const float scale,
+                            const float* x, const float* y, const float* z, float* out, const int n ) {
+    float sx[batchChunk], sy[batchChunk], sz[batchChunk], raw[batchChunk], total[batchChunk];
+    for (int base = 0; base < n; base += batchChunk) {
+        const int m = n-base < batchChunk ? n-base : batchChunk;
+        float frequency = scale;
+        float amplitude = 1;
+        float maxAmplitude = 0;
+        for (int k = 0; k < m; k++)
+            total[k] = 0;
+
+        for( int i=0; i < octaves; i++ ) {
+            for (int k = 0; k < m; k++) {
+                sx[k] = x[base+k] * frequency;
+                sy[k] = y[base+k] * frequency;
+                sz[k] = z[base+k] * frequency;
+            }
+            raw_noise_3d_batch(sx, sy, sz, raw, m);
+            for (int k = 0; k < m; k++)
+                total[k] += raw[k] * amplitude;
+
+            frequency *= 2;
+            maxAmplitude += amplitude;
+            amplitude *= persistence;
+        }
+
+        for (int k = 0; k < m; k++)
+            out[base+k] = total[k] / maxAmplitude;
+    }
+}
+
+
+// 2D Scaled Multi-octave Simplex noise of n points
+void scaled_octave_noise_2d_batch( const float octaves, const float persistence, const float scale,
+                                   const float loBound, const float hiBound,
+                                   const float* x, const float* y, float* out, const int n ) {
+    octave_noise_2d_batch(octaves, persistence, scale, x, y, out, n);
+    for (int k = 0; k < n; k++)
+        out[k] = out[k] * (hiBound - loBound) / 2 + (hiBound + loBound) / 2;
+}
+
+
+// 3D Scaled Multi-octave Simplex noise of n points
+void scaled_octave_noise_3d_batch( const float octaves, const float persistence, const float scale,
+                                   const float loBound, const float hiBound,
+                                   const float* x, const float* y, const float* z, float* out, const int n ) {
+    octave_noise_3d_batch(octaves, persistence, scale, x, y, z, out, n);
+    for (int k = 0; k < n; k++)
+        out[k] = out[k] * (hiBound - loBound) / 2 + (hiBound + loBound) / 2;
+}
+
+
+// 2D Scaled Multi-octave Simplex noise and its partial derivatives at n points
+void scaled_octave_noise_2d_deriv_batch( const float octaves, const float persistence, const float scale,
+                                         const float loBound, const float hiBound,
+                                         const float* x, const float* y, float* out, float* dx, float* dy, const int n ) {
+    octave_noise_2d_deriv_batch(octaves, persistence, scale, x, y, out, dx, dy, n);
+    for (int k = 0; k < n; k++) {
+        out[k] = out[k] * (hiBound - loBound) / 2 + (hiBound + loBound) / 2;
+        dx[k] = dx[k] * (hiBound - loBound) / 2;
+        dy[k] = dy[k] * (hiBound - loBound) / 2;
+    }
+}
@@ -0,0 +1,468 @@
+////////////////////////////////////////////////////////////////////////
+// Chunked, level of detail terrain.  See terrain.h.
+//
+// Vertex positions are computed from integer coordinates on the grid
+// of the finest level, so a vertex shared by two chunks (of the same
+// or of neighbouring levels) gets exactly the same position and
+// height in both.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <algorithm>
+#include <chrono>
+#include <set>
+
+#include <glbinding/gl/gl.h>
+#include <glbinding/Binding.h>
+using namespace gl;
+
+#include <glu.h>                // For gluErrorString
+#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line terrain.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "terrain.h"
+#include "meshopt.h"
+
+static long long ChunkKey(const int level, const int x, const int y)
+{
+    return ((long long)level<<48) | ((long long)x<<24) | (long long)y;
+}
+
+ChunkedGround::ChunkedGround(const float _range, const float spacing,
+                             const float _octaves, const float _persistence, const float _scale,
+                             const float _low, const float _high)
+    : ProceduralGround(_range, _octaves, _persistence, _scale, _low, _high),
+      frame(0), finished(NULL), gathered(false), gatherPending(false), quit(false),
+      requestedCount(0), uploadedCount(0), evictedCount(0), updateTime(0)
+{
+    // The finest level is the first with chunks no coarser than spacing
+    maxLevel = 0;
+    while (maxLevel < 20 && NodeSize(maxLevel)/trChunkQuads > spacing)
+        maxLevel++;
+
+    // Shared vertices must meet exactly, so positions stay floats
+    format = vfPackedFloatPos;
+
+    // Height queries near the eye then land on the finest chunks' surface
+    CacheHeights(trChunkQuads<<maxLevel);
+
+    minP = glm::vec3(-range, -range, low);
+    maxP = glm::vec3(range, range, high);
+    BuildIndices();
+
+    for (int t=0;  t<trGeneratorThreads;  t++)
+        threads.push_back(std::thread(&ChunkedGround::Thread, this));
+}
+
+ChunkedGround::~ChunkedGround()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true; }
+    wake.notify_all();
+    for (int t=0;  t<threads.size();  t++)
+        threads[t].join();
+
+    for (std::map<long long, TerrainChunk*>::iterator c=chunks.begin();  c!=chunks.end();  c++)
+        Free(c->second);
+    glDeleteBuffers(1, &indexBuffer);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Distance from the eye to a node's box, which spans the full range
+// of heights.
+float ChunkedGround::Distance(const glm::vec3& eye, const int level, const int x, const int y) const
+{
+    const float s = NodeSize(level);
+    const float x0 = -range + x*s;
+    const float y0 = -range + y*s;
+    const float dx = std::max(std::max(x0-eye.x, eye.x-(x0+s)), 0.0f);
+    const float dy = std::max(std::max(y0-eye.y, eye.y-(y0+s)), 0.0f);
+    const float dz = std::max(std::max(low-eye.z, eye.z-high), 0.0f);
+    return sqrtf(dx*dx + dy*dy + dz*dz);
+}
+
+// Collect the nodes to be drawn.  A node is split when the eye is
+// within trLodFactor of its size.  If a node were to meet one two
+// levels finer, that one's parent (half its size) would be split, so
+// the eye would be within trLodFactor*s/2 of it, and so within
+// trLodFactor*s/2 + s/sqrt(2) of the node itself.  With trLodFactor at
+// least sqrt(2) that is within trLodFactor*s, and the node would have
+// been split too.
+void ChunkedGround::Select(const glm::vec3& eye, const int level, const int x, const int y,
+                           std::vector<long long>& keys)
+{
+    if (level < maxLevel && Distance(eye, level, x, y) < trLodFactor*NodeSize(level)) {
+        for (int c=0;  c<4;  c++)
+            Select(eye, level+1, 2*x + (c&1), 2*y + (c>>1), keys); }
+    else
+        keys.push_back(ChunkKey(level, x, y));
+}
+
+////////////////////////////////////////////////////////////////////////
+// The index lists for each combination of coarser neighbours.  The
+// grid is triangulated as ProceduralGround's is;  along an edge that
+// meets a coarser chunk, each odd vertex is moved onto the even one
+// before it, which folds one triangle of each pair away and fans the
+// rest from the even vertices the coarser chunk shares.
+void ChunkedGround::BuildIndices()
+{
+    const int n = trChunkQuads;
+    std::vector<glm::ivec3> all;
+    for (int e=0;  e<trEdgeMasks;  e++) {
+        std::vector<glm::ivec3>& Tri = stitched[e];
+        for (int i=1;  i<=n;  i++)
+            for (int j=1;  j<=n;  j++) {
+                int v[4][2] = { {i-1,j-1}, {i-1,j}, {i,j}, {i,j-1} };
+                int q[4];
+                for (int k=0;  k<4;  k++) {
+                    int vi = v[k][0], vj = v[k][1];
+                    if (((e&trWest && vi==0) || (e&trEast && vi==n)) && vj%2==1)
+                        vj--;
+                    if (((e&trSouth && vj==0) || (e&trNorth && vj==n)) && vi%2==1)
+                        vi--;
+                    q[k] = vi*(n+1) + vj; }
+                if (q[0]!=q[1] && q[1]!=q[2] && q[2]!=q[0])
+                    Tri.push_back(glm::ivec3(q[0], q[1], q[2]));
+                if (q[0]!=q[2] && q[2]!=q[3] && q[3]!=q[0])
+                    Tri.push_back(glm::ivec3(q[0], q[2], q[3])); }
+
+        // Every chunk shares the lists, so only the triangles are reordered
+        MeshCacheReport report;
+        report.name = "Terrain edges " + std::to_string(e);
+        report.triangles = (int)Tri.size();
+        MeshCacheStats(Tri, report.acmr[0], report.atvr[0]);
+        OptimizeTriangles(Tri, (n+1)*(n+1));
+        MeshCacheStats(Tri, report.acmr[1], report.atvr[1]);
+        CacheReports().push_back(report);
+
+        indexStart[e] = (int)all.size();
+        all.insert(all.end(), Tri.begin(), Tri.end()); }
+
+    // A chunk has few enough vertices for 16 bit indices
+    std::vector<unsigned short> indices(3*all.size());
+    for (int t=0;  t<all.size();  t++)
+        for (int c=0;  c<3;  c++)
+            indices[3*t + c] = (unsigned short)all[t][c];
+
+    glGenBuffers(1, &indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short)*indices.size(),
+                 &indices[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    CHECKERROR;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Compute a chunk's vertices.  Run on the generator threads.
+void ChunkedGround::Generate(TerrainChunk* chunk)
+{
+    const int m = trChunkQuads+1;
+    const int step = 1<<(maxLevel-chunk->level);
+    const int finest = trChunkQuads<<maxLevel;     // Quads across the finest grid
+    const float d = 2.0f*range/finest;
+
+    // Padded to a multiple of the SIMD width, so every height comes
+    // from the same noise code, bit for bit.
+    const int count = (m*m + 7) & ~7;
+    std::vector<float> px(count, 0.0f), py(count, 0.0f), pz(count), dzdx(count), dzdy(count);
+    for (int i=0;  i<m;  i++)
+        for (int j=0;  j<m;  j++) {
+            px[i*m + j] = -range + ((chunk->x*trChunkQuads + i)*step)*d;
+            py[i*m + j] = -range + ((chunk->y*trChunkQuads + j)*step)*d; }
+    HeightsAt(&px[0], &py[0], &pz[0], &dzdx[0], &dzdy[0], count);
+
+    chunk->Pnt.resize(m*m);
+    chunk->Nrm.resize(m*m);
+    chunk->Tex.resize(m*m);
+    chunk->Tan.resize(m*m);
+    for (int i=0;  i<m;  i++)
+        for (int j=0;  j<m;  j++) {
+            const int v = i*m + j;
+            chunk->Pnt[v] = glm::vec4(px[v], py[v], pz[v], 1.0);
+            chunk->Nrm[v] = glm::normalize(glm::vec3(-dzdx[v], -dzdy[v], 1.0));
+            chunk->Tex[v] = glm::vec2(float((chunk->x*trChunkQuads + i)*step)/finest,
+                                      float((chunk->y*trChunkQuads + j)*step)/finest);
+            chunk->Tan[v] = glm::vec3(1.0, 0.0, 0.0); }
+}
+
+// A generator thread:  gather the next selection when asked, else
+// take requested chunks in order, compute them, and push them onto
+// the finished stack for the render thread.  The
+// push is a lock-free compare and swap, and as the render thread only
+// ever takes the whole stack at once, there is no ABA problem.
+void ChunkedGround::Thread()
+{
+    while (true) {
+        TerrainChunk* chunk = NULL;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return quit || gatherPending || !requests.empty(); });
+            if (quit)
+                return;
+            if (gatherPending)
+                gatherPending = false;
+            else {
+                chunk = requests.front();
+                requests.pop_front(); } }
+
+        if (!chunk) {
+            Gather();
+            gathered = true;
+            continue; }
+
+        Generate(chunk);
+
+        chunk->next = finished.load();
+        while (!finished.compare_exchange_weak(chunk->next, chunk)) {} }
+}
+
+// Send a chunk's vertices to the graphics card, in a VAO of its own
+// (chunks come and go, so they are not in the MeshArena), with the
+// shared index lists.
+void ChunkedGround::Upload(TerrainChunk* chunk)
+{
+    glGenVertexArrays(1, &chunk->vaoID);
+    BindVAO(chunk->vaoID);
+    chunk->buffer = InterleavedBuffer(chunk->Pnt, chunk->Nrm, chunk->Tex, chunk->Tan, format);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    BindVAO(0);
+    CHECKERROR;
+}
+
+void ChunkedGround::Free(TerrainChunk* chunk)
+{
+    // Deleting the bound VAO would unbind it behind BindVAO's back
+    BindVAO(0);
+    glDeleteBuffers(1, &chunk->buffer);
+    glDeleteVertexArrays(1, &chunk->vaoID);
+    delete chunk;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Copy the chunks of the selection being gathered into the back
+// arrays.  Run on a generator thread.
+void ChunkedGround::Gather()
+{
+    backPnt.clear();
+    backNrm.clear();
+    backTex.clear();
+    backTan.clear();
+    backTri.clear();
+    backMin = glm::vec3(range, range, high);
+    backMax = glm::vec3(-range, -range, low);
+    for (int s=0;  s<gathering.size();  s++) {
+        const TerrainChunk* chunk = gathering[s].chunk;
+        const std::vector<glm::ivec3>& tris = stitched[gathering[s].edges];
+        const int base = (int)backPnt.size();
+        backPnt.insert(backPnt.end(), chunk->Pnt.begin(), chunk->Pnt.end());
+        backNrm.insert(backNrm.end(), chunk->Nrm.begin(), chunk->Nrm.end());
+        backTex.insert(backTex.end(), chunk->Tex.begin(), chunk->Tex.end());
+        backTan.insert(backTan.end(), chunk->Tan.begin(), chunk->Tan.end());
+        const int first = (int)backTri.size();
+        backTri.resize(first + tris.size());
+        for (int t=0;  t<tris.size();  t++)
+            backTri[first+t] = tris[t] + base;
+        for (int v=0;  v<chunk->Pnt.size();  v++) {
+            backMin = glm::min(backMin, chunk->Pnt[v].xyz());
+            backMax = glm::max(backMax, chunk->Pnt[v].xyz()); } }
+}
+
+bool ChunkedGround::Resident(const long long key) const
+{
+    std::map<long long, TerrainChunk*>::const_iterator c = chunks.find(key);
+    return c != chunks.end() && c->second->state == trUploaded;
+}
+
+// Append uploaded chunks that exactly cover a node:  its own, or
+// covers of all four of its children.  On failure nothing is added.
+bool ChunkedGround::Cover(const int level, const int x, const int y, std::vector<long long>& cover) const
+{
+    const long long key = ChunkKey(level, x, y);
+    if (Resident(key)) {
+        cover.push_back(key);
+        return true; }
+    if (level == maxLevel || chunks.find(ChunkKey(level+1, 2*x, 2*y)) == chunks.end())
+        return false;
+
+    const size_t size = cover.size();
+    for (int c=0;  c<4;  c++)
+        if (!Cover(level+1, 2*x + (c&1), 2*y + (c>>1), cover)) {
+            cover.resize(size);
+            return false; }
+    return true;
+}
+
+void ChunkedGround::Update(const glm::vec3& eye)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    frame++;
+    std::vector<long long> keys;
+    Select(eye, 0, 0, 0, keys);
+
+    // Queue the newly selected chunks for the generator threads
+    std::vector<TerrainChunk*> missing;
+    for (int k=0;  k<keys.size();  k++) {
+        TerrainChunk*& chunk = chunks[keys[k]];
+        if (!chunk) {
+            chunk = new TerrainChunk();
+            chunk->level = (int)(keys[k]>>48);
+            chunk->x = (int)((keys[k]>>24) & 0xffffff);
+            chunk->y = (int)(keys[k] & 0xffffff);
+            chunk->state = trRequested;
+            missing.push_back(chunk); }
+        chunk->lastUsed = frame; }
+
+    if (missing.size() > 0) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            requests.insert(requests.end(), missing.begin(), missing.end()); }
+        wake.notify_all(); }
+    requestedCount = (int)missing.size();
+
+    // Take the chunks the generators have finished (newest first on
+    // the stack, so reversed), and upload a few of them.  Until
+    // something is drawn there is no limit.
+    TerrainChunk* done = finished.exchange(NULL);
+    std::vector<TerrainChunk*> arrived;
+    for ( ;  done;  done = done->next)
+        arrived.push_back(done);
+    for (int i=(int)arrived.size()-1;  i>=0;  i--) {
+        arrived[i]->state = trGenerated;
+        uploads.push_back(arrived[i]); }
+
+    uploadedCount = 0;
+    while (uploads.size() > 0 && (selection.empty() || uploadedCount < trUploadsPerFrame)) {
+        Upload(uploads.front());
+        uploads.front()->state = trUploaded;
+        uploads.pop_front();
+        uploadedCount++; }
+
+    // Each selected node is drawn as its own chunk once that is
+    // uploaded.  Until then its area is drawn from the uploaded chunks
+    // nearest it in the tree:  its descendants (what was drawn before
+    // the eye came nearer), or else an ancestor (before it went away).
+    std::vector<long long> cover;
+    bool complete = true;
+    for (int k=0;  k<keys.size();  k++) {
+        const int level = (int)(keys[k]>>48);
+        const int x = (int)((keys[k]>>24) & 0xffffff), y = (int)(keys[k] & 0xffffff);
+        if (Cover(level, x, y, cover))
+            continue;
+        int l = level-1;
+        for ( ;  l>=0 && !Resident(ChunkKey(l, x>>(level-l), y>>(level-l)));  l--) {}
+        if (l >= 0)
+            cover.push_back(ChunkKey(l, x>>(level-l), y>>(level-l)));
+        else
+            complete = false; }
+
+    // An ancestor stands in for all of its descendants, and is drawn once
+    std::set<long long> drawn(cover.begin(), cover.end());
+    std::vector<long long> order;
+    for (int c=0;  c<cover.size();  c++) {
+        const int level = (int)(cover[c]>>48);
+        const int x = (int)((cover[c]>>24) & 0xffffff), y = (int)(cover[c] & 0xffffff);
+        bool hidden = false;
+        for (int l=level-1;  !hidden && l>=0;  l--)
+            hidden = drawn.count(ChunkKey(l, x>>(level-l), y>>(level-l))) > 0;
+        if (!hidden && std::find(order.begin(), order.end(), cover[c]) == order.end())
+            order.push_back(cover[c]); }
+    drawn = std::set<long long>(order.begin(), order.end());
+
+    // Find each chunk's coarser neighbours.  Only a node one level up
+    // can be a neighbour's leaf;  the chunk's own parent never is.  (A
+    // stand-in may meet chunks more levels away, and crack slightly,
+    // until the selected chunks arrive.)
+    auto isDrawn = [&](const int l, const int x, const int y) {
+        return drawn.count(ChunkKey(l, x, y)) > 0; };
+
+    std::vector<TrDraw> next(order.size());
+    for (int k=0;  k<order.size();  k++) {
+        TerrainChunk* chunk = chunks[order[k]];
+        const int l = chunk->level, x = chunk->x, y = chunk->y, n = 1<<l;
+        int edges = 0;
+        if (l > 0) {
+            if (x > 0   && isDrawn(l-1, (x-1)>>1, y>>1)) edges |= trWest;
+            if (x < n-1 && isDrawn(l-1, (x+1)>>1, y>>1)) edges |= trEast;
+            if (y > 0   && isDrawn(l-1, x>>1, (y-1)>>1)) edges |= trSouth;
+            if (y < n-1 && isDrawn(l-1, x>>1, (y+1)>>1)) edges |= trNorth; }
+        next[k].chunk = chunk;
+        next[k].edges = edges;
+        chunk->lastUsed = frame; }
+
+    // A finished gather's selection is drawn from now on, and its
+    // arrays become the Shape's.
+    if (gathered) {
+        gathered = false;
+        selection.swap(gathering);
+        gathering.clear();
+        Pnt.swap(backPnt);
+        Nrm.swap(backNrm);
+        Tex.swap(backTex);
+        Tan.swap(backTan);
+        Tri.swap(backTri);
+        minP = backMin;
+        maxP = backMax;
+        count = Tri.size(); }
+
+    // The chunks to draw replace those drawn once gathered, one
+    // gather at a time.  Only at the start, with nothing drawn yet, is
+    // an incomplete cover waited on.
+    const bool ready = gathering.empty() && (complete || !selection.empty());
+
+    bool changed = next.size() != selection.size();
+    for (int k=0;  !changed && k<next.size();  k++)
+        changed = next[k].chunk != selection[k].chunk || next[k].edges != selection[k].edges;
+
+    if (ready && changed) {
+        gathering.swap(next);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            gatherPending = true; }
+        wake.notify_one(); }
+
+    for (int k=0;  k<selection.size();  k++)
+        selection[k].chunk->lastUsed = frame;
+    for (int k=0;  k<gathering.size();  k++)
+        gathering[k].chunk->lastUsed = frame;
+
+    // Free the unused chunks the eye has left behind, and the oldest
+    // unused ones if there are still too many.
+    std::vector<TerrainChunk*> unused;
+    evictedCount = 0;
+    for (std::map<long long, TerrainChunk*>::iterator c=chunks.begin();  c!=chunks.end(); ) {
+        TerrainChunk* chunk = c->second;
+        if (chunk->lastUsed == frame || chunk->state != trUploaded)
+            c++;
+        else if (Distance(eye, chunk->level, chunk->x, chunk->y) > trEvictFactor*NodeSize(chunk->level)) {
+            Free(chunk);
+            c = chunks.erase(c);
+            evictedCount++; }
+        else {
+            unused.push_back(chunk);
+            c++; } }
+
+    if (chunks.size() > trMaxChunks) {
+        std::sort(unused.begin(), unused.end(),
+                  [](const TerrainChunk* a, const TerrainChunk* b) { return a->lastUsed < b->lastUsed; });
+        for (int i=0;  i<unused.size() && chunks.size() > trMaxChunks;  i++) {
+            chunks.erase(ChunkKey(unused[i]->level, unused[i]->x, unused[i]->y));
+            Free(unused[i]);
+            evictedCount++; } }
+
+    updateTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void ChunkedGround::DrawVAO()
+{
+    CHECKERROR;
+    for (int s=0;  s<selection.size();  s++) {
+        const int e = selection[s].edges;
+        BindVAO(selection[s].chunk->vaoID);
+        glDrawElements(GL_TRIANGLES, 3*(GLsizei)stitched[e].size(), GL_UNSIGNED_SHORT,
+                       (const void*)(sizeof(unsigned short)*3*indexStart[e])); }
+    CHECKERROR;
+}
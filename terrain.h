@@ -0,0 +1,152 @@
+////////////////////////////////////////////////////////////////////////
+// Chunked, level of detail terrain for the island (CDLOD style).
+//
+// The ground's square [-range,range]^2 is the root of a quadtree.
+// Each node is drawn, when selected, as a chunk of trChunkQuads by
+// trChunkQuads quads, so deeper nodes have finer grids.  Every frame,
+// Update selects nodes around the eye:  a node is split if the eye is
+// within trLodFactor times its size, down to the level whose grid
+// spacing is the requested detail.  That factor keeps neighbouring
+// chunks within one level of each other, and a chunk next to a coarser
+// one is drawn with one of 16 index lists whose triangles skip the
+// vertices the coarser chunk lacks along that edge, so there are no
+// cracks.
+//
+// Chunks are requested the first time they are selected, kept while
+// the eye stays near, and freed once it moves trEvictFactor times
+// their size away (or when over the trMaxChunks budget).
+//
+// So that moving the eye never stalls a frame, chunks are generated
+// on threads of their own, which hand them back to the render thread
+// on a lock-free stack.  Update uploads at most trUploadsPerFrame of
+// them a frame.  A selected node whose chunk is not yet on the
+// graphics card is drawn with the uploaded chunks nearest it in the
+// tree instead (the finer ones it replaces, or a coarser one), so
+// the drawn chunks keep up with the eye however fast it moves.
+//
+// The drawn chunks are also gathered into the Shape's Pnt, Nrm, Tex,
+// Tan and Tri arrays, for the software pipeline and the occlusion
+// culler.  That copy is made on a generator thread into a second set
+// of arrays, and a new set of chunks is drawn once both are ready.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _TERRAIN
+#define _TERRAIN
+
+#include <vector>
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "shapes.h"
+
+const int trChunkQuads = 32;        // Quads along each side of a chunk (even, at most 254)
+const float trLodFactor = 2.0f;     // Split nodes nearer than this times their size (at least sqrt(2))
+const float trEvictFactor = 3.0f;   // Free unused chunks farther than this times their size
+const int trMaxChunks = 1024;       // Most chunks kept at once
+const int trGeneratorThreads = 2;   // Threads computing chunks
+const int trUploadsPerFrame = 4;    // Chunks sent to the graphics card per frame
+
+// Edges of a chunk that meet a coarser neighbour
+enum TrEdge { trWest=1, trEast=2, trSouth=4, trNorth=8, trEdgeMasks=16 };
+
+// Where a chunk is in the pipeline (known only to the render thread)
+enum TrState { trRequested, trGenerated, trUploaded };
+
+// One quadtree node's mesh
+struct TerrainChunk
+{
+    int level, x, y;
+    std::vector<glm::vec4> Pnt;
+    std::vector<glm::vec3> Nrm;
+    std::vector<glm::vec2> Tex;
+    std::vector<glm::vec3> Tan;
+    unsigned int vaoID;
+    unsigned int buffer;        // Its interleaved vertices
+    int lastUsed;               // Frame in which it was last selected
+    TrState state;
+    TerrainChunk* next;         // Link in the finished stack
+};
+
+// A selected chunk, and the edges it stitches to coarser neighbours
+struct TrDraw
+{
+    TerrainChunk* chunk;
+    int edges;
+};
+
+class ChunkedGround: public ProceduralGround
+{
+    int maxLevel;               // Deepest level of the quadtree
+    int frame;
+
+    std::map<long long, TerrainChunk*> chunks;
+    std::vector<TrDraw> selection;      // The chunks drawn
+    std::vector<TrDraw> gathering;      // The next selection, while its arrays are gathered
+
+    // The next selection's arrays, gathered on a generator thread and
+    // swapped with the Shape's when done
+    std::vector<glm::vec4> backPnt;
+    std::vector<glm::vec3> backNrm;
+    std::vector<glm::vec2> backTex;
+    std::vector<glm::vec3> backTan;
+    std::vector<glm::ivec3> backTri;
+    glm::vec3 backMin, backMax;
+
+    // Generator threads, their requests (under the mutex), and the
+    // chunks they have finished (lock-free)
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<TerrainChunk*> requests;
+    std::atomic<TerrainChunk*> finished;
+    std::atomic<bool> gathered;
+    bool gatherPending, quit;
+
+    std::deque<TerrainChunk*> uploads;  // Finished chunks waiting for upload
+
+    // The 16 stitched index lists, one after another in indexBuffer
+    std::vector<glm::ivec3> stitched[trEdgeMasks];
+    int indexStart[trEdgeMasks];
+    unsigned int indexBuffer;
+
+    float NodeSize(const int level) const { return 2.0f*range/(1<<level); }
+    float Distance(const glm::vec3& eye, const int level, const int x, const int y) const;
+    void Select(const glm::vec3& eye, const int level, const int x, const int y,
+                std::vector<long long>& keys);
+    bool Resident(const long long key) const;
+    bool Cover(const int level, const int x, const int y, std::vector<long long>& cover) const;
+    void BuildIndices();
+    void Generate(TerrainChunk* chunk);
+    void Upload(TerrainChunk* chunk);
+    void Free(TerrainChunk* chunk);
+    void Gather();
+    void Thread();
+
+public:
+    // Statistics of the last Update, with its time in milliseconds
+    int requestedCount, uploadedCount, evictedCount;
+    float updateTime;
+
+    // Ground of the given radius, whose finest chunks have about the
+    // given grid spacing.
+    ChunkedGround(const float _range, const float spacing,
+                  const float _octaves, const float _persistence, const float _scale,
+                  const float _low, const float _high);
+    ~ChunkedGround();
+
+    // Select, request, upload and evict chunks for an eye position.
+    // Call from the GL thread, before the ground is drawn.
+    void Update(const glm::vec3& eye);
+
+    int ChunkCount() const { return (int)chunks.size(); }
+    int SelectedCount() const { return (int)selection.size(); }
+
+    virtual void DrawVAO();
+    virtual bool Instanceable() const { return false; }
+};
+
+#endif
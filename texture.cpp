@@ -16,6 +16,7 @@ using namespace gl;
 #define GLM_SWIZZLE
 #include <glm/glm.hpp>
 
+#include "shader.h"
 #include "texture.h"
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -53,12 +54,11 @@ Texture::Texture(const std::string &path) : textureId(0)
 // a small integer specifying which texture unit should load the
 // texture.  The name parameter is the sampler2d in the shader program
 // which will provide access to the texture.
-void Texture::BindTexture(const int unit, const int programId, const std::string& name)
+void Texture::BindTexture(const int unit, ShaderProgram* program, const std::string& name)
 {
     glActiveTexture((gl::GLenum)((int)GL_TEXTURE0 + unit));
     glBindTexture(GL_TEXTURE_2D, textureId);
-    int loc = glGetUniformLocation(programId, name.c_str());
-    glUniform1i(loc, unit);
+    program->Set(name, unit);
 }
 
 // Unbind a texture from a texture unit whne no longer needed.
@@ -13,6 +13,8 @@
 // identifies it.  It also supplies two methods for binding and
 // unbinding the texture to/from a shader.
 
+class ShaderProgram;
+
 class Texture
 {
  public:
@@ -22,7 +24,7 @@ class Texture
     Texture();
     Texture(const std::string &filename);
 
-    void BindTexture(const int unit, const int programId, const std::string& name);
+    void BindTexture(const int unit, ShaderProgram* program, const std::string& name);
     void UnbindTexture(const int unit);
 };
 
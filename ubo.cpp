@@ -0,0 +1,98 @@
+////////////////////////////////////////////////////////////////////////
+// Uniform buffer objects for the frame's and the objects' values.  See
+// ubo.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glbinding/gl/gl.h>
+#include <glbinding/Binding.h>
+using namespace gl;
+
+#include <glu.h>                // For gluErrorString
+#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line ubo.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "ubo.h"
+
+void BindUniformBlocks(const int programId)
+{
+    GLuint index = glGetUniformBlockIndex(programId, "FrameBlock");
+    if (index != GL_INVALID_INDEX)
+        glUniformBlockBinding(programId, index, ubFrameBinding);
+    index = glGetUniformBlockIndex(programId, "ObjectBlock");
+    if (index != GL_INVALID_INDEX)
+        glUniformBlockBinding(programId, index, ubObjectBinding);
+    CHECKERROR;
+}
+
+void SetFrameBlock(const FrameBlock& block)
+{
+    static GLuint buffer = 0;
+    if (!buffer) {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameBlock), NULL, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, ubFrameBinding, buffer); }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameBlock), &block);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    CHECKERROR;
+}
+
+// A map that does not fit in the rest of the ring starts it over in
+// fresh storage (doubled if the map is bigger than all of it).  Any
+// other map lands past everything mapped since then, which no draw
+// can be reading, so it need not wait.
+void* UniformRing::Map(const int count, const size_t blockSize, size_t& offset, size_t& stride)
+{
+    if (!buffer) {
+        GLint align;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+        alignment = align > 0 ? align : 256;
+        size = ubRingBytes;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_STREAM_DRAW); }
+
+    stride = (blockSize + alignment-1)/alignment*alignment;
+    const size_t bytes = count*stride;
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    if (head + bytes > size) {
+        while (size < bytes)
+            size *= 2;
+        glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_STREAM_DRAW);
+        head = 0; }
+
+    offset = head;
+    head += bytes;
+    void* p = glMapBufferRange(GL_UNIFORM_BUFFER, offset, bytes,
+                               GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    CHECKERROR;
+    return p;
+}
+
+void UniformRing::Unmap()
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    CHECKERROR;
+}
+
+void UniformRing::Bind(const int binding, const size_t offset, const size_t blockSize)
+{
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, blockSize);
+}
+
+UniformRing& ObjectRing()
+{
+    static UniformRing ring;
+    return ring;
+}
@@ -0,0 +1,76 @@
+////////////////////////////////////////////////////////////////////////
+// Uniform buffer objects for the values shared by all the programs,
+// and for each object's values.
+//
+// FrameBlock holds the frame's transformations and viewport size.
+// It is written once per frame by SetFrameBlock into a buffer bound to
+// ubFrameBinding, which every program's FrameBlock is bound to (by
+// BindUniformBlocks), so no program needs them set separately.
+//
+// ObjectBlock holds an object's transformations and surface values.
+// RenderQueue::Submit writes the blocks of all the objects it draws
+// into a UniformRing with one map, then binds each object's block
+// (with glBindBufferRange) before drawing it.  The ring is appended to
+// with unsynchronized maps, and orphaned when it wraps around, so the
+// blocks of draws still in flight are never overwritten.  (GL 3.3 has
+// no persistent mapping, so the ring is mapped once per pass instead.)
+//
+// The structs are laid out by the std140 rules, and must agree with
+// the blocks declared in the shaders.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _UBO
+#define _UBO
+
+const int ubFrameBinding = 0;       // Binding point of FrameBlock
+const int ubObjectBinding = 1;      // Binding point of ObjectBlock
+const size_t ubRingBytes = 1<<20;   // Initial size of the ring of ObjectBlocks
+
+struct FrameBlock
+{
+    glm::mat4 WorldProj, WorldView, WorldInverse;
+    glm::mat4 ViewProjInverse;  // Inverse of WorldProj*WorldView, to recover positions from depth
+    unsigned int width, height;
+    unsigned int pad[2];
+};
+
+struct ObjectBlock
+{
+    glm::mat4 ModelTr;
+    glm::vec4 NormalTr[3];      // A mat3's columns, each padded to a vec4
+    glm::vec3 diffuse;
+    float shininess;
+    glm::vec3 specular;
+    int objectId;
+};
+
+// Bind a linked program's FrameBlock and ObjectBlock (if it uses them)
+// to their binding points.
+void BindUniformBlocks(const int programId);
+
+// Upload the frame's block
+void SetFrameBlock(const FrameBlock& block);
+
+class UniformRing
+{
+    unsigned int buffer;
+    size_t size, head;          // In bytes
+    size_t alignment;           // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+
+public:
+    UniformRing() : buffer(0), size(0), head(0), alignment(0) {}
+
+    // Map room for count blocks of blockSize bytes, each one stride
+    // bytes after the previous, starting offset bytes into the buffer.
+    // The stride is blockSize rounded up to the offset alignment.
+    void* Map(const int count, const size_t blockSize, size_t& offset, size_t& stride);
+    void Unmap();
+
+    // Bind blockSize bytes at offset to a binding point
+    void Bind(const int binding, const size_t offset, const size_t blockSize);
+};
+
+// The ring used for the ObjectBlocks
+UniformRing& ObjectRing();
+
+#endif
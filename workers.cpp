@@ -0,0 +1,85 @@
+////////////////////////////////////////////////////////////////////////
+// A small pool of worker threads.  The pool is created once and
+// reused for every parallel loop, so that per-frame work (such as the
+// software pipeline in emulator.cpp) does not pay for thread creation.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+
+#include "workers.h"
+
+WorkerPool::WorkerPool(int n)
+    : job(NULL), jobCount(0), next(0), busy(0), generation(0), quit(false)
+{
+    if (n <= 0)
+        n = std::max(1, (int)std::thread::hardware_concurrency()) - 1;
+    for (int i=0;  i<n;  i++)
+        threads.push_back(std::thread(&WorkerPool::Worker, this));
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true; }
+    wake.notify_all();
+    for (int i=0;  i<threads.size();  i++)
+        threads[i].join();
+}
+
+// Hand out indices of the current loop until there are none left.
+void WorkerPool::RunIndices()
+{
+    for (int i=next++;  i<jobCount;  i=next++)
+        (*job)(i);
+}
+
+void WorkerPool::Worker()
+{
+    unsigned int seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return quit || generation != seen; });
+            if (quit) return;
+            seen = generation; }
+
+        RunIndices();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busy == 0)
+            done.notify_all(); }
+}
+
+void WorkerPool::ParallelFor(const int count, const std::function<void(int)>& fn)
+{
+    if (count <= 0) return;
+
+    // Not worth waking anyone for a single index
+    if (count == 1 || threads.empty()) {
+        for (int i=0;  i<count;  i++)
+            fn(i);
+        return; }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &fn;
+        jobCount = count;
+        next = 0;
+        busy = (int)threads.size();
+        generation++; }
+    wake.notify_all();
+
+    // The calling thread works too, then waits for the stragglers.
+    RunIndices();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return busy == 0; });
+    job = NULL;
+}
+
+WorkerPool& Workers()
+{
+    static WorkerPool pool;
+    return pool;
+}
@@ -0,0 +1,54 @@
+////////////////////////////////////////////////////////////////////////
+// A small pool of worker threads.  The pool is created once and
+// reused for every parallel loop, so that per-frame work (such as the
+// software pipeline in emulator.cpp) does not pay for thread creation.
+//
+// A parallel loop is run by:
+//    pool.ParallelFor(count, [&](int i) { ... });
+// which calls the function once for each i in [0,count), spread over
+// all workers and the calling thread, and returns when all are done.
+// Only one loop runs at a time, and a loop body must not start another.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _WORKERS
+#define _WORKERS
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+class WorkerPool
+{
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+
+    // The loop currently being run
+    const std::function<void(int)>* job;
+    int jobCount;
+    std::atomic<int> next;      // Next index to be handed out
+    int busy;                   // Workers still inside the current loop
+    unsigned int generation;    // Incremented for each new loop
+    bool quit;
+
+    void Worker();
+    void RunIndices();
+
+public:
+    // Zero threads means one per hardware thread (minus the caller).
+    WorkerPool(int n=0);
+    ~WorkerPool();
+
+    // Number of threads that take part in a loop, including the caller.
+    int Size() const { return (int)threads.size()+1; }
+
+    void ParallelFor(const int count, const std::function<void(int)>& fn);
+};
+
+// The pool shared by all CPU-side parallel work.
+WorkerPool& Workers();
+
+#endif